@@ -0,0 +1,240 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+#include <algorithm>
+
+// what SceneBVH and MeshBVH share: the node layout, the binned sah build, the slab test and
+// the nearest child first traversal rays go through
+namespace BVH {
+    const unsigned MAX_LEAF_SIZE = 4;
+    const unsigned BIN_COUNT = 12;
+    //deeper nodes stay leaves, keeps the traversal stacks fixed size
+    const unsigned MAX_DEPTH = 48;
+
+    // 32 bytes. children of a node are allocated as a pair, right is always left + 1
+    struct Node {
+        glm::vec3 min;
+        //first child for interior nodes, first leaf slot for leaves
+        uint32_t leftOrFirst;
+        glm::vec3 max;
+        //0 for interior nodes
+        uint32_t count;
+    };
+
+    struct Box {
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    inline float area(const glm::vec3& min, const glm::vec3& max) {
+        glm::vec3 extent = glm::max(max - min, glm::vec3(0.0f));
+        return 2.0f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+    }
+
+    // points on the surface count as inside
+    inline bool contains(const glm::vec3& min, const glm::vec3& max, const glm::vec3& point) {
+        return glm::all(glm::greaterThanEqual(point, min)) && glm::all(glm::lessThanEqual(point, max));
+    }
+
+    // slab test, entry is where the ray goes in (0 when it starts inside)
+    inline bool intersectBox(const glm::vec3& min, const glm::vec3& max, const glm::vec3& origin,
+        const glm::vec3& inverseDirection, float maxDistance, float& entry) {
+        glm::vec3 t0 = (min - origin) * inverseDirection;
+        glm::vec3 t1 = (max - origin) * inverseDirection;
+        glm::vec3 tMin = glm::min(t0, t1);
+        glm::vec3 tMax = glm::max(t0, t1);
+        entry = std::max(std::max(tMin.x, tMin.y), std::max(tMin.z, 0.0f));
+        float exit = std::min(std::min(tMax.x, tMax.y), std::min(tMax.z, maxDistance));
+        return entry <= exit;
+    }
+
+    // box around a leaf's slots
+    inline void setNodeBounds(Node& node, const std::vector<Box>& boxes) {
+        node.min = glm::vec3(FLT_MAX);
+        node.max = glm::vec3(-FLT_MAX);
+        for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+            node.min = glm::min(node.min, boxes[i].min);
+            node.max = glm::max(node.max, boxes[i].max);
+        }
+    }
+
+    // binned sah build over leaf slots. boxes, centroids and payload are parallel arrays that
+    // get permuted together as nodes split, so each leaf ends up owning a contiguous range of
+    // them. payload is whatever a leaf slot stands for, an object or a triangle index
+    template<typename Payload>
+    class Builder {
+    public:
+        Builder(std::vector<Node>& nodes, std::vector<Box>& boxes, std::vector<glm::vec3>& centroids,
+            std::vector<Payload>& payload) : nodes(nodes), boxes(boxes), centroids(centroids), payload(payload) {
+        }
+
+        void build() {
+            nodes.clear();
+            if (boxes.empty())
+                return;
+            nodes.reserve(boxes.size() * 2);
+            nodes.push_back(Node());
+            nodes[0].leftOrFirst = 0;
+            nodes[0].count = (uint32_t)boxes.size();
+            subdivide(0, 0);
+        }
+
+    private:
+        struct Bin {
+            glm::vec3 min = glm::vec3(FLT_MAX);
+            glm::vec3 max = glm::vec3(-FLT_MAX);
+            uint32_t count = 0;
+        };
+
+        // binned sah split along the widest centroid axis, leaves when no split beats not splitting
+        void subdivide(uint32_t nodeIndex, unsigned depth) {
+            Node& node = nodes[nodeIndex];
+            setNodeBounds(node, boxes);
+            uint32_t first = node.leftOrFirst;
+            uint32_t count = node.count;
+            if (count <= 1 || depth + 1 >= MAX_DEPTH)
+                return;
+
+            glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+            for (uint32_t i = first; i < first + count; i++) {
+                centroidMin = glm::min(centroidMin, centroids[i]);
+                centroidMax = glm::max(centroidMax, centroids[i]);
+            }
+            glm::vec3 extent = centroidMax - centroidMin;
+            int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+            if (extent[axis] <= 0.0f) {
+                //every centroid in one spot, nothing to split on
+                return;
+            }
+
+            Bin bins[BIN_COUNT];
+            float scale = BIN_COUNT / extent[axis];
+            for (uint32_t i = first; i < first + count; i++) {
+                int bin = std::min((int)BIN_COUNT - 1, (int)((centroids[i][axis] - centroidMin[axis]) * scale));
+                bins[bin].count++;
+                bins[bin].min = glm::min(bins[bin].min, boxes[i].min);
+                bins[bin].max = glm::max(bins[bin].max, boxes[i].max);
+            }
+
+            //sweep from both sides for the area and count left and right of every bin boundary
+            float leftArea[BIN_COUNT - 1], rightArea[BIN_COUNT - 1];
+            uint32_t leftCount[BIN_COUNT - 1], rightCount[BIN_COUNT - 1];
+            glm::vec3 leftMin(FLT_MAX), leftMax(-FLT_MAX), rightMin(FLT_MAX), rightMax(-FLT_MAX);
+            uint32_t leftSum = 0, rightSum = 0;
+            for (unsigned i = 0; i < BIN_COUNT - 1; i++) {
+                leftSum += bins[i].count;
+                leftCount[i] = leftSum;
+                leftMin = glm::min(leftMin, bins[i].min);
+                leftMax = glm::max(leftMax, bins[i].max);
+                leftArea[i] = area(leftMin, leftMax);
+
+                unsigned j = BIN_COUNT - 1 - i;
+                rightSum += bins[j].count;
+                rightCount[j - 1] = rightSum;
+                rightMin = glm::min(rightMin, bins[j].min);
+                rightMax = glm::max(rightMax, bins[j].max);
+                rightArea[j - 1] = area(rightMin, rightMax);
+            }
+
+            int bestSplit = -1;
+            float bestCost = FLT_MAX;
+            for (unsigned i = 0; i < BIN_COUNT - 1; i++) {
+                if (leftCount[i] == 0 || rightCount[i] == 0)
+                    continue;
+                float splitCost = leftArea[i] * leftCount[i] + rightArea[i] * rightCount[i];
+                if (splitCost < bestCost) {
+                    bestCost = splitCost;
+                    bestSplit = (int)i;
+                }
+            }
+
+            //small nodes stay leaves unless the split pays for the extra node visited,
+            //a traversal step costs about as much as testing one leaf slot
+            float nodeArea = area(node.min, node.max);
+            if (bestSplit < 0 || (count <= MAX_LEAF_SIZE && bestCost + nodeArea >= nodeArea * count))
+                return;
+
+            //partition the slots around the chosen boundary
+            int64_t i = first, j = (int64_t)first + count - 1;
+            while (i <= j) {
+                int bin = std::min((int)BIN_COUNT - 1, (int)((centroids[i][axis] - centroidMin[axis]) * scale));
+                if (bin <= bestSplit) {
+                    i++;
+                }
+                else {
+                    std::swap(payload[i], payload[j]);
+                    std::swap(boxes[i], boxes[j]);
+                    std::swap(centroids[i], centroids[j]);
+                    j--;
+                }
+            }
+            uint32_t leftSize = (uint32_t)(i - first);
+            if (leftSize == 0 || leftSize == count)
+                return;
+
+            uint32_t left = (uint32_t)nodes.size();
+            nodes.push_back(Node());
+            nodes.push_back(Node());
+            //push_back may have moved the array
+            nodes[nodeIndex].leftOrFirst = left;
+            nodes[nodeIndex].count = 0;
+            nodes[left].leftOrFirst = first;
+            nodes[left].count = leftSize;
+            nodes[left + 1].leftOrFirst = first + leftSize;
+            nodes[left + 1].count = count - leftSize;
+
+            subdivide(left, depth + 1);
+            subdivide(left + 1, depth + 1);
+        }
+
+        std::vector<Node>& nodes;
+        std::vector<Box>& boxes;
+        std::vector<glm::vec3>& centroids;
+        std::vector<Payload>& payload;
+    };
+
+    // walks every node the ray enters before distance, nearer child first so closer hits
+    // shrink distance early. testLeaf(first, count, distance) tests a leaf's slots and lowers
+    // distance to any closer hit it finds
+    template<typename LeafTest>
+    void raycastClosest(const std::vector<Node>& nodes, const glm::vec3& origin, const glm::vec3& inverseDirection,
+        float& distance, const LeafTest& testLeaf) {
+        if (nodes.empty())
+            return;
+
+        uint32_t stack[MAX_DEPTH + 1];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0) {
+            const Node& node = nodes[stack[--stackSize]];
+            float entry;
+            if (!intersectBox(node.min, node.max, origin, inverseDirection, distance, entry))
+                continue;
+
+            if (node.count > 0) {
+                testLeaf(node.leftOrFirst, node.count, distance);
+                continue;
+            }
+
+            //push the further child first so the nearer one is visited first
+            uint32_t nearChild = node.leftOrFirst, farChild = node.leftOrFirst + 1;
+            float nearEntry = FLT_MAX, farEntry = FLT_MAX;
+            bool nearHit = intersectBox(nodes[nearChild].min, nodes[nearChild].max, origin, inverseDirection, distance,
+                nearEntry);
+            bool farHit = intersectBox(nodes[farChild].min, nodes[farChild].max, origin, inverseDirection, distance,
+                farEntry);
+            if (nearHit && farHit && farEntry < nearEntry) {
+                std::swap(nearChild, farChild);
+                std::swap(nearHit, farHit);
+            }
+            if (farHit)
+                stack[stackSize++] = farChild;
+            if (nearHit)
+                stack[stackSize++] = nearChild;
+        }
+    }
+}
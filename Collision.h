@@ -0,0 +1,625 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+#include "EntityStore.h"
+#include "JobSystem.h"
+
+enum ColliderShape {
+    COLLIDER_SPHERE,
+    COLLIDER_CAPSULE,
+    COLLIDER_BOX
+};
+
+// an entity's collision shape in its own space, scaled along with it. CollisionWorld fills in proxy
+struct Collider {
+    uint32_t shape;
+    glm::vec3 center;
+    //spheres and capsules
+    float radius;
+    //capsules run this far either way along z from the center
+    float halfLength;
+    //boxes
+    glm::vec3 halfExtents;
+    //static colliders are placed once and never collide with each other
+    uint32_t isStatic;
+    uint32_t proxy;
+};
+
+// a collider placed in the world
+struct CollisionShape {
+    uint32_t shape;
+    glm::vec3 center;
+    //columns are the shape's x, y and z in world space
+    glm::mat3 axes;
+    float radius;
+    float halfLength;
+    glm::vec3 halfExtents;
+};
+
+// where two shapes touch. the normal points from a towards b, moving b along it by depth
+// separates them
+struct Contact {
+    Entity a;
+    Entity b;
+    glm::vec3 point;
+    glm::vec3 normal;
+    float depth;
+};
+
+// counters add up from the start, colliders, pairs and contacts are as of the last step
+struct CollisionStats {
+    unsigned steps = 0;
+    size_t swaps = 0;
+    double broadphaseMs = 0.0;
+    double narrowphaseMs = 0.0;
+    size_t colliders = 0;
+    //from the broadphase
+    size_t pairs = 0;
+    size_t contacts = 0;
+};
+
+inline CollisionShape placeCollider(const Collider& collider, const glm::vec3& position, const glm::quat& rotation,
+    const glm::vec3& scale) {
+    CollisionShape placed;
+    placed.shape = collider.shape;
+    placed.axes = glm::mat3_cast(rotation);
+    placed.center = position + placed.axes * (collider.center * scale);
+    glm::vec3 size = glm::abs(scale);
+    //round shapes stay round, the widest scale wins
+    if (collider.shape == COLLIDER_CAPSULE)
+        placed.radius = collider.radius * std::max(size.x, size.y);
+    else
+        placed.radius = collider.radius * std::max(std::max(size.x, size.y), size.z);
+    placed.halfLength = collider.halfLength * size.z;
+    placed.halfExtents = collider.halfExtents * size;
+    return placed;
+}
+
+inline void shapeBounds(const CollisionShape& placed, glm::vec3& min, glm::vec3& max) {
+    glm::vec3 extent;
+    if (placed.shape == COLLIDER_BOX) {
+        glm::mat3 absolute(glm::abs(placed.axes[0]), glm::abs(placed.axes[1]), glm::abs(placed.axes[2]));
+        extent = absolute * placed.halfExtents;
+    }
+    else
+        extent = glm::abs(placed.axes[2]) * placed.halfLength + placed.radius;
+    min = placed.center - extent;
+    max = placed.center + extent;
+}
+
+// closest points between segments p1-q1 and p2-q2, from real-time collision detection 5.1.9
+inline void closestPointsOnSegments(const glm::vec3& p1, const glm::vec3& q1, const glm::vec3& p2, const glm::vec3& q2,
+    glm::vec3& c1, glm::vec3& c2) {
+    glm::vec3 d1 = q1 - p1, d2 = q2 - p2, r = p1 - p2;
+    float a = glm::dot(d1, d1), e = glm::dot(d2, d2), f = glm::dot(d2, r);
+    float s = 0.0f, t = 0.0f;
+    if (a <= 1e-8f && e <= 1e-8f) {
+        c1 = p1;
+        c2 = p2;
+        return;
+    }
+    if (a <= 1e-8f)
+        t = glm::clamp(f / e, 0.0f, 1.0f);
+    else {
+        float c = glm::dot(d1, r);
+        if (e <= 1e-8f)
+            s = glm::clamp(-c / a, 0.0f, 1.0f);
+        else {
+            float b = glm::dot(d1, d2);
+            float denominator = a * e - b * b;
+            //parallel segments, any s will do
+            s = denominator > 1e-8f ? glm::clamp((b * f - c * e) / denominator, 0.0f, 1.0f) : 0.0f;
+            t = (b * s + f) / e;
+            if (t < 0.0f) {
+                t = 0.0f;
+                s = glm::clamp(-c / a, 0.0f, 1.0f);
+            }
+            else if (t > 1.0f) {
+                t = 1.0f;
+                s = glm::clamp((b - c) / a, 0.0f, 1.0f);
+            }
+        }
+    }
+    c1 = p1 + d1 * s;
+    c2 = p2 + d2 * t;
+}
+
+inline glm::vec3 closestPointOnSegment(const glm::vec3& from, const glm::vec3& to, const glm::vec3& point) {
+    glm::vec3 along = to - from;
+    float lengthSquared = glm::dot(along, along);
+    float t = lengthSquared > 1e-8f ? glm::clamp(glm::dot(point - from, along) / lengthSquared, 0.0f, 1.0f) : 0.0f;
+    return from + along * t;
+}
+
+inline glm::vec3 closestPointOnBox(const CollisionShape& box, const glm::vec3& point) {
+    glm::vec3 local = glm::transpose(box.axes) * (point - box.center);
+    return box.center + box.axes * glm::clamp(local, -box.halfExtents, box.halfExtents);
+}
+
+// spheres of radius ra at a and rb at b, which also covers the closest points of capsules
+inline bool collideRound(const glm::vec3& a, float ra, const glm::vec3& b, float rb, Contact& contact) {
+    glm::vec3 offset = b - a;
+    float distanceSquared = glm::dot(offset, offset);
+    if (distanceSquared >= (ra + rb) * (ra + rb))
+        return false;
+    float distance = std::sqrt(distanceSquared);
+    contact.normal = distance > 1e-6f ? offset / distance : glm::vec3(0.0f, 1.0f, 0.0f);
+    contact.depth = ra + rb - distance;
+    //halfway between the two surfaces
+    contact.point = a + contact.normal * (ra - contact.depth * 0.5f);
+    return true;
+}
+
+// a sphere at center against the box, normal from the sphere towards the box
+inline bool collideRoundBox(const glm::vec3& center, float radius, const CollisionShape& box, Contact& contact) {
+    glm::vec3 local = glm::transpose(box.axes) * (center - box.center);
+    glm::vec3 clamped = glm::clamp(local, -box.halfExtents, box.halfExtents);
+    if (clamped != local) {
+        glm::vec3 surface = box.center + box.axes * clamped;
+        glm::vec3 offset = surface - center;
+        float distanceSquared = glm::dot(offset, offset);
+        if (distanceSquared >= radius * radius)
+            return false;
+        float distance = std::sqrt(distanceSquared);
+        contact.normal = offset / distance;
+        contact.depth = radius - distance;
+        contact.point = surface + contact.normal * contact.depth * 0.5f;
+        return true;
+    }
+
+    //center inside the box, out through the nearest face
+    glm::vec3 room = box.halfExtents - glm::abs(local);
+    int face = room.x < room.y ? (room.x < room.z ? 0 : 2) : (room.y < room.z ? 1 : 2);
+    float side = local[face] < 0.0f ? -1.0f : 1.0f;
+    contact.normal = -box.axes[face] * side;
+    contact.depth = radius + room[face];
+    contact.point = center - contact.normal * (room[face] - contact.depth * 0.5f);
+    return true;
+}
+
+// a capsule against the box through the point of its segment nearest the box. alternating
+// between the two closest point queries converges on it for convex shapes, a few rounds do
+inline bool collideCapsuleBox(const CollisionShape& capsule, const CollisionShape& box, Contact& contact) {
+    glm::vec3 from = capsule.center - capsule.axes[2] * capsule.halfLength;
+    glm::vec3 to = capsule.center + capsule.axes[2] * capsule.halfLength;
+    glm::vec3 nearest = closestPointOnSegment(from, to, box.center);
+    for (int round = 0; round < 4; round++)
+        nearest = closestPointOnSegment(from, to, closestPointOnBox(box, nearest));
+    return collideRoundBox(nearest, capsule.radius, box, contact);
+}
+
+// separating axis test over both boxes' faces and the 9 edge pairs, the contact is on the
+// axis they overlap least along
+inline bool collideBoxes(const CollisionShape& a, const CollisionShape& b, Contact& contact) {
+    glm::vec3 offset = b.center - a.center;
+    float leastDepth = FLT_MAX;
+    glm::vec3 leastAxis(0.0f);
+    int leastIndex = 0;
+    for (int index = 0; index < 15; index++) {
+        glm::vec3 axis;
+        if (index < 3)
+            axis = a.axes[index];
+        else if (index < 6)
+            axis = b.axes[index - 3];
+        else {
+            axis = glm::cross(a.axes[(index - 6) / 3], b.axes[(index - 6) % 3]);
+            float length = glm::length(axis);
+            //parallel edges, the face axes already cover them
+            if (length < 1e-4f)
+                continue;
+            axis /= length;
+        }
+        float reachA = glm::dot(glm::abs(glm::transpose(a.axes) * axis), a.halfExtents);
+        float reachB = glm::dot(glm::abs(glm::transpose(b.axes) * axis), b.halfExtents);
+        float depth = reachA + reachB - std::abs(glm::dot(offset, axis));
+        if (depth <= 0.0f)
+            return false;
+        //edge axes only win clearly, they're the least stable
+        if (depth < leastDepth * (index < 6 ? 1.0f : 0.95f)) {
+            leastDepth = depth;
+            leastAxis = glm::dot(offset, axis) < 0.0f ? -axis : axis;
+            leastIndex = index;
+        }
+    }
+
+    contact.normal = leastAxis;
+    contact.depth = leastDepth;
+    glm::vec3 signA = glm::sign(glm::transpose(a.axes) * leastAxis);
+    glm::vec3 signB = glm::sign(glm::transpose(b.axes) * -leastAxis);
+    if (leastIndex < 3) {
+        //b's corner deepest into a's face
+        contact.point = b.center + b.axes * (signB * b.halfExtents) + leastAxis * leastDepth * 0.5f;
+    }
+    else if (leastIndex < 6)
+        contact.point = a.center + a.axes * (signA * a.halfExtents) - leastAxis * leastDepth * 0.5f;
+    else {
+        //the two edges nearest each other, found from the corners facing the other box
+        int edgeA = (leastIndex - 6) / 3, edgeB = (leastIndex - 6) % 3;
+        glm::vec3 cornerA = signA * a.halfExtents, cornerB = signB * b.halfExtents;
+        cornerA[edgeA] = 0.0f;
+        cornerB[edgeB] = 0.0f;
+        glm::vec3 middleA = a.center + a.axes * cornerA, middleB = b.center + b.axes * cornerB;
+        glm::vec3 nearestA, nearestB;
+        closestPointsOnSegments(middleA - a.axes[edgeA] * a.halfExtents[edgeA], middleA + a.axes[edgeA] * a.halfExtents[edgeA],
+            middleB - b.axes[edgeB] * b.halfExtents[edgeB], middleB + b.axes[edgeB] * b.halfExtents[edgeB], nearestA, nearestB);
+        contact.point = (nearestA + nearestB) * 0.5f;
+    }
+    return true;
+}
+
+// fills in contact's point, normal and depth when the shapes overlap
+inline bool collideShapes(const CollisionShape& a, const CollisionShape& b, Contact& contact) {
+    //the pairs are written one way round, the rest flip
+    if (a.shape > b.shape) {
+        if (!collideShapes(b, a, contact))
+            return false;
+        contact.normal = -contact.normal;
+        return true;
+    }
+
+    glm::vec3 fromA = a.center - a.axes[2] * a.halfLength, toA = a.center + a.axes[2] * a.halfLength;
+    glm::vec3 fromB = b.center - b.axes[2] * b.halfLength, toB = b.center + b.axes[2] * b.halfLength;
+    if (a.shape == COLLIDER_SPHERE && b.shape == COLLIDER_SPHERE)
+        return collideRound(a.center, a.radius, b.center, b.radius, contact);
+    if (a.shape == COLLIDER_SPHERE && b.shape == COLLIDER_CAPSULE)
+        return collideRound(a.center, a.radius, closestPointOnSegment(fromB, toB, a.center), b.radius, contact);
+    if (a.shape == COLLIDER_CAPSULE && b.shape == COLLIDER_CAPSULE) {
+        glm::vec3 nearestA, nearestB;
+        closestPointsOnSegments(fromA, toA, fromB, toB, nearestA, nearestB);
+        return collideRound(nearestA, a.radius, nearestB, b.radius, contact);
+    }
+    if (a.shape == COLLIDER_SPHERE)
+        return collideRoundBox(a.center, a.radius, b, contact);
+    if (a.shape == COLLIDER_CAPSULE)
+        return collideCapsuleBox(a, b, contact);
+    return collideBoxes(a, b, contact);
+}
+
+// broadphase over boxes: the boxes' low and high ends are kept sorted along two axes, the two
+// they're most spread out along, and a pair is two boxes whose ranges overlap on both. the
+// third axis is left to the narrowphase, in a flat scene it's so crowded that every nudge
+// would reorder it. boxes move a little per step, so the ends are re-sorted by insertion sort
+// in close to linear time, and every swap of one box's low end past another's high end is a
+// pair starting or ending on that axis. pairs are kept between updates and only those swaps
+// change them. adding or removing proxies re-sorts from scratch on the next update
+class SweepAndPrune {
+public:
+    static const uint32_t INVALID = 0xFFFFFFFFu;
+
+    struct Pair {
+        uint32_t a;
+        uint32_t b;
+    };
+
+    uint32_t add(const glm::vec3& min, const glm::vec3& max, bool isStatic) {
+        uint32_t proxy;
+        if (!freeProxies.empty()) {
+            proxy = freeProxies.back();
+            freeProxies.pop_back();
+        }
+        else {
+            proxy = (uint32_t)mins.size();
+            mins.push_back(glm::vec3(0.0f));
+            maxs.push_back(glm::vec3(0.0f));
+            flags.push_back(0);
+        }
+        mins[proxy] = min;
+        maxs[proxy] = max;
+        flags[proxy] = LIVE | (isStatic ? STATIC : 0);
+        proxyCount++;
+        rebuildNeeded = true;
+        return proxy;
+    }
+
+    void remove(uint32_t proxy) {
+        flags[proxy] = 0;
+        freeProxies.push_back(proxy);
+        proxyCount--;
+        rebuildNeeded = true;
+    }
+
+    // takes effect on the next update, different proxies can be set from different threads
+    void setBounds(uint32_t proxy, const glm::vec3& min, const glm::vec3& max) {
+        mins[proxy] = min;
+        maxs[proxy] = max;
+    }
+
+    void update() {
+        swapCount = 0;
+        if (rebuildNeeded) {
+            rebuild();
+            return;
+        }
+
+        for (int sorted = 0; sorted < 2; sorted++) {
+            int axis = sortedAxes[sorted];
+            std::vector<Endpoint>& endpoints = axes[sorted];
+            for (Endpoint& endpoint : endpoints)
+                endpoint.value = isHigh(endpoint) ? maxs[proxyOf(endpoint)][axis] : mins[proxyOf(endpoint)][axis];
+
+            for (size_t i = 1; i < endpoints.size(); i++) {
+                Endpoint moving = endpoints[i];
+                size_t j = i;
+                for (; j > 0 && comesBefore(moving, endpoints[j - 1]); j--) {
+                    const Endpoint& passed = endpoints[j - 1];
+                    //a box going flat on this axis or coming out of it passes its own other end
+                    bool sameProxy = proxyOf(moving) == proxyOf(passed);
+                    if (!sameProxy && !isHigh(moving) && isHigh(passed)) {
+                        //a low end moved below a high one, the ranges now overlap on this axis
+                        if (overlaps(proxyOf(moving), proxyOf(passed)))
+                            addPair(proxyOf(moving), proxyOf(passed));
+                    }
+                    else if (!sameProxy && isHigh(moving) && !isHigh(passed))
+                        removePair(proxyOf(moving), proxyOf(passed));
+                    endpoints[j] = passed;
+                }
+                endpoints[j] = moving;
+                swapCount += i - j;
+            }
+        }
+    }
+
+    // as of the last update
+    const std::vector<Pair>& getPairs() const {
+        return pairs;
+    }
+
+    // endpoint swaps in the last update, how much the order changed
+    size_t getSwapCount() const {
+        return swapCount;
+    }
+
+    size_t size() const {
+        return proxyCount;
+    }
+
+private:
+    static const uint8_t LIVE = 1;
+    static const uint8_t STATIC = 2;
+
+    // proxy << 1, plus one for the high end
+    struct Endpoint {
+        float value;
+        uint32_t packed;
+    };
+
+    static uint32_t proxyOf(const Endpoint& endpoint) {
+        return endpoint.packed >> 1;
+    }
+
+    static bool isHigh(const Endpoint& endpoint) {
+        return (endpoint.packed & 1) != 0;
+    }
+
+    // the order rebuild sorts into and update keeps: on ties high ends go ahead of low ones,
+    // touching isn't overlapping. that puts a box flat on the axis (a zero radius or a zero
+    // half extent) with its high end ahead of its own low end
+    static bool comesBefore(const Endpoint& a, const Endpoint& b) {
+        return a.value < b.value || (a.value == b.value && isHigh(a) && !isHigh(b));
+    }
+
+    // on the sorted axes. touching boxes don't overlap, the same as the strict compare in the sort
+    bool overlaps(uint32_t a, uint32_t b) const {
+        if ((flags[a] & STATIC) && (flags[b] & STATIC))
+            return false;
+        for (int axis : sortedAxes) {
+            if (mins[a][axis] >= maxs[b][axis] || mins[b][axis] >= maxs[a][axis])
+                return false;
+        }
+        return true;
+    }
+
+    static uint64_t pairKey(uint32_t a, uint32_t b) {
+        return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+    }
+
+    void addPair(uint32_t a, uint32_t b) {
+        //a pair can start on more than one axis in the same update
+        if (pairIndex.find(pairKey(a, b)) != pairIndex.end())
+            return;
+        pairIndex[pairKey(a, b)] = (uint32_t)pairs.size();
+        pairs.push_back(Pair{ std::min(a, b), std::max(a, b) });
+    }
+
+    // the last pair takes the removed one's place
+    void removePair(uint32_t a, uint32_t b) {
+        std::unordered_map<uint64_t, uint32_t>::iterator found = pairIndex.find(pairKey(a, b));
+        if (found == pairIndex.end())
+            return;
+        uint32_t index = found->second;
+        pairIndex.erase(found);
+        if (index + 1 != pairs.size()) {
+            pairs[index] = pairs.back();
+            pairIndex[pairKey(pairs[index].a, pairs[index].b)] = index;
+        }
+        pairs.pop_back();
+    }
+
+    // picks the axes, sorts them from scratch and finds the pairs by sweeping the first
+    void rebuild() {
+        rebuildNeeded = false;
+        glm::vec3 low(FLT_MAX), high(-FLT_MAX);
+        for (uint32_t proxy = 0; proxy < mins.size(); proxy++) {
+            if (!(flags[proxy] & LIVE))
+                continue;
+            low = glm::min(low, mins[proxy] + maxs[proxy]);
+            high = glm::max(high, mins[proxy] + maxs[proxy]);
+        }
+        //the centers' spread, the narrowest axis is dropped
+        glm::vec3 spread = high - low;
+        int dropped = spread.x < spread.y ? (spread.x < spread.z ? 0 : 2) : (spread.y < spread.z ? 1 : 2);
+        sortedAxes[0] = dropped == 0 ? 1 : 0;
+        sortedAxes[1] = dropped == 2 ? 1 : 2;
+
+        for (int sorted = 0; sorted < 2; sorted++) {
+            int axis = sortedAxes[sorted];
+            std::vector<Endpoint>& endpoints = axes[sorted];
+            endpoints.clear();
+            for (uint32_t proxy = 0; proxy < mins.size(); proxy++) {
+                if (!(flags[proxy] & LIVE))
+                    continue;
+                endpoints.push_back(Endpoint{ mins[proxy][axis], proxy << 1 });
+                endpoints.push_back(Endpoint{ maxs[proxy][axis], (proxy << 1) | 1 });
+            }
+            std::sort(endpoints.begin(), endpoints.end(), comesBefore);
+        }
+
+        pairs.clear();
+        pairIndex.clear();
+        std::vector<uint32_t> open;
+        std::vector<uint32_t> openSlot(mins.size(), (uint32_t)INVALID);
+        //slot of a box closed before it opened, one flat on the sweep axis
+        const uint32_t flat = INVALID - 1;
+        for (const Endpoint& endpoint : axes[0]) {
+            uint32_t proxy = proxyOf(endpoint);
+            if (isHigh(endpoint)) {
+                uint32_t slot = openSlot[proxy];
+                if (slot == INVALID) {
+                    openSlot[proxy] = flat;
+                    continue;
+                }
+                //the last open box takes the closed one's place
+                open[slot] = open.back();
+                openSlot[open[slot]] = slot;
+                open.pop_back();
+                continue;
+            }
+            for (uint32_t other : open) {
+                if (overlaps(proxy, other))
+                    addPair(proxy, other);
+            }
+            //a flat box can only overlap the ones already open, it closes as it opens
+            if (openSlot[proxy] == flat)
+                continue;
+            openSlot[proxy] = (uint32_t)open.size();
+            open.push_back(proxy);
+        }
+    }
+
+    std::vector<glm::vec3> mins;
+    std::vector<glm::vec3> maxs;
+    std::vector<uint8_t> flags;
+    std::vector<uint32_t> freeProxies;
+    size_t proxyCount = 0;
+    bool rebuildNeeded = false;
+
+    //indexes of the two sorted axes, and their ends
+    int sortedAxes[2] = { 0, 2 };
+    std::vector<Endpoint> axes[2];
+    std::vector<Pair> pairs;
+    std::unordered_map<uint64_t, uint32_t> pairIndex;
+    size_t swapCount = 0;
+};
+
+// collision detection for every entity with a Collider. each step places the moving
+// colliders and refits their broadphase boxes on the job system, updates the broadphase,
+// then runs the narrowphase over its pairs on the job system too. static colliders are
+// placed once, when they're first seen. only detects, responding to the contacts is left
+// to the caller
+class CollisionWorld {
+public:
+    // TransformType needs position, rotation and scale, in world space
+    template <typename TransformType>
+    void update(EntityStore& entities, JobSystem& jobs) {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        entities.forEachArray<TransformType, Collider>([&](size_t count, const Entity* handles,
+            TransformType* transforms, Collider* colliders) {
+            //new proxies grow the per proxy arrays, so they're added before going parallel
+            for (size_t i = 0; i < count; i++) {
+                if (colliders[i].proxy == SweepAndPrune::INVALID)
+                    addProxy(handles[i], transforms[i], colliders[i]);
+            }
+            jobs.parallelFor(count, 256, [&](size_t begin, size_t end, unsigned) {
+                for (size_t i = begin; i < end; i++) {
+                    if (!colliders[i].isStatic)
+                        place(transforms[i], colliders[i]);
+                }
+            });
+        });
+        broadphase.update();
+        std::chrono::high_resolution_clock::time_point swept = std::chrono::high_resolution_clock::now();
+
+        const std::vector<SweepAndPrune::Pair>& pairs = broadphase.getPairs();
+        pairContacts.resize(pairs.size());
+        pairHits.resize(pairs.size());
+        jobs.parallelFor(pairs.size(), 128, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; i++) {
+                pairHits[i] = collideShapes(shapes[pairs[i].a], shapes[pairs[i].b], pairContacts[i]);
+                pairContacts[i].a = proxyEntities[pairs[i].a];
+                pairContacts[i].b = proxyEntities[pairs[i].b];
+            }
+        });
+        contacts.clear();
+        for (size_t i = 0; i < pairs.size(); i++) {
+            if (pairHits[i])
+                contacts.push_back(pairContacts[i]);
+        }
+        std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+        stats.steps++;
+        stats.swaps += broadphase.getSwapCount();
+        stats.broadphaseMs += std::chrono::duration<double, std::milli>(swept - start).count();
+        stats.narrowphaseMs += std::chrono::duration<double, std::milli>(end - swept).count();
+        stats.colliders = broadphase.size();
+        stats.pairs = pairs.size();
+        stats.contacts = contacts.size();
+    }
+
+    // for an entity about to be destroyed
+    void remove(Collider& collider) {
+        broadphase.remove(collider.proxy);
+        collider.proxy = SweepAndPrune::INVALID;
+    }
+
+    // from the last update
+    const std::vector<Contact>& getContacts() const {
+        return contacts;
+    }
+
+    const CollisionStats& getStats() const {
+        return stats;
+    }
+
+    void resetStats() {
+        stats = CollisionStats();
+    }
+
+private:
+    template <typename TransformType>
+    void addProxy(Entity entity, const TransformType& transform, Collider& collider) {
+        collider.proxy = broadphase.add(glm::vec3(0.0f), glm::vec3(0.0f), collider.isStatic != 0);
+        if (collider.proxy >= shapes.size()) {
+            shapes.resize(collider.proxy + 1);
+            proxyEntities.resize(collider.proxy + 1);
+        }
+        proxyEntities[collider.proxy] = entity;
+        place(transform, collider);
+    }
+
+    template <typename TransformType>
+    void place(const TransformType& transform, const Collider& collider) {
+        CollisionShape& placed = shapes[collider.proxy];
+        placed = placeCollider(collider, transform.position, transform.rotation, transform.scale);
+        glm::vec3 min, max;
+        shapeBounds(placed, min, max);
+        broadphase.setBounds(collider.proxy, min, max);
+    }
+
+    SweepAndPrune broadphase;
+    //per proxy
+    std::vector<CollisionShape> shapes;
+    std::vector<Entity> proxyEntities;
+    //per pair, filled in parallel and gathered into contacts
+    std::vector<Contact> pairContacts;
+    std::vector<uint8_t> pairHits;
+    std::vector<Contact> contacts;
+    CollisionStats stats;
+};
@@ -0,0 +1,273 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <vector>
+#include <cstring>
+#include <cstdint>
+#include "GLState.h"
+#include "MeshArena.h"
+
+// linear buffer of gl commands. any thread can record into its own buffer, only the gl
+// thread replays them (through the state tracker, so redundant binds still get elided).
+// every command is a small header followed by its payload, packed back to back
+class CommandBuffer {
+public:
+    void clear() {
+        data.clear();
+        commandCount = 0;
+    }
+
+    bool empty() const {
+        return commandCount == 0;
+    }
+
+    size_t getCommandCount() const {
+        return commandCount;
+    }
+
+    void bindProgram(GLuint program) {
+        GLuint payload[] = { program };
+        write(BIND_PROGRAM, payload, sizeof(payload));
+    }
+
+    void bindVertexArray(GLuint vertexArray) {
+        GLuint payload[] = { vertexArray };
+        write(BIND_VERTEX_ARRAY, payload, sizeof(payload));
+    }
+
+    void bindTexture(GLuint unit, GLenum target, GLuint texture) {
+        GLuint payload[] = { unit, target, texture };
+        write(BIND_TEXTURE, payload, sizeof(payload));
+    }
+
+    // MeshArena::bindInstanceBuffer on replay, also binds the arena's vao for that stream
+    void bindInstanceBuffer(GLuint buffer, MeshArena::VertexStream stream = MeshArena::FULL_STREAM) {
+        GLuint payload[] = { buffer, (GLuint)stream };
+        write(BIND_INSTANCE_BUFFER, payload, sizeof(payload));
+    }
+
+    void setDepthMask(bool enabled) {
+        GLuint payload[] = { enabled ? 1u : 0u };
+        write(DEPTH_MASK, payload, sizeof(payload));
+    }
+
+    void setDepthFunc(GLenum func) {
+        GLuint payload[] = { func };
+        write(DEPTH_FUNC, payload, sizeof(payload));
+    }
+
+    void uniformMatrix4(GLint location, const glm::mat4& value) {
+        writeUniform(UNIFORM_MAT4, location, glm::value_ptr(value), 16);
+    }
+
+    void uniformMatrix3(GLint location, const glm::mat3& value) {
+        writeUniform(UNIFORM_MAT3, location, glm::value_ptr(value), 9);
+    }
+
+    void uniform3(GLint location, const glm::vec3& value) {
+        writeUniform(UNIFORM_VEC3, location, glm::value_ptr(value), 3);
+    }
+
+    void uniform1(GLint location, float value) {
+        writeUniform(UNIFORM_FLOAT, location, &value, 1);
+    }
+
+    // glDrawElementsBaseVertex on whatever vao is bound, with unsigned int indices
+    void drawElements(const DrawElementsIndirectCommand& command) {
+        write(DRAW_ELEMENTS, &command, sizeof(command));
+    }
+
+    void drawElementsInstanced(const DrawElementsIndirectCommand& command) {
+        write(DRAW_ELEMENTS_INSTANCED, &command, sizeof(command));
+    }
+
+    // glDrawElementsIndirect with the command-th DrawElementsIndirectCommand in buffer, for
+    // commands the gpu wrote itself
+    void drawElementsIndirect(GLuint buffer, GLuint command) {
+        GLuint payload[] = { buffer, command };
+        write(DRAW_ELEMENTS_INDIRECT, payload, sizeof(payload));
+    }
+
+    // the commands and their per draw data are copied inline, MeshArena::multiDraw on replay
+    void multiDraw(const DrawElementsIndirectCommand* commands, const MultiDrawData* drawData, size_t count,
+        MeshArena::VertexStream stream = MeshArena::FULL_STREAM) {
+        uint32_t header[] = { (uint32_t)count, (uint32_t)stream };
+        size_t offset = begin(MULTI_DRAW, sizeof(header) + count * (sizeof(*commands) + sizeof(*drawData)));
+        append(offset, header, sizeof(header));
+        append(offset, commands, count * sizeof(*commands));
+        append(offset, drawData, count * sizeof(*drawData));
+    }
+
+    // draws until endConditionalRender are dropped on the gpu when query passed no samples
+    void beginConditionalRender(GLuint query) {
+        GLuint payload[] = { query };
+        write(BEGIN_CONDITIONAL_RENDER, payload, sizeof(payload));
+    }
+
+    void endConditionalRender() {
+        write(END_CONDITIONAL_RENDER, nullptr, 0);
+    }
+
+    // replays on the gl thread, arena is what instance buffer and multi draw commands go through
+    void execute(MeshArena& arena) const {
+        GLState& state = GLState::get();
+        size_t offset = 0;
+
+        while (offset < data.size()) {
+            Header header;
+            memcpy(&header, &data[offset], sizeof(header));
+            const unsigned char* payload = &data[offset + sizeof(header)];
+            offset += sizeof(header) + header.size;
+
+            switch (header.type) {
+            case BIND_PROGRAM:
+                state.useProgram(read<GLuint>(payload, 0));
+                break;
+            case BIND_VERTEX_ARRAY:
+                state.bindVertexArray(read<GLuint>(payload, 0));
+                break;
+            case BIND_TEXTURE:
+                state.bindTexture(read<GLuint>(payload, 0), read<GLuint>(payload, 1), read<GLuint>(payload, 2));
+                break;
+            case BIND_INSTANCE_BUFFER:
+                arena.bindInstanceBuffer(read<GLuint>(payload, 0), (MeshArena::VertexStream)read<GLuint>(payload, 1));
+                break;
+            case DEPTH_MASK:
+                state.setDepthMask(read<GLuint>(payload, 0) != 0);
+                break;
+            case DEPTH_FUNC:
+                state.setDepthFunc(read<GLuint>(payload, 0));
+                break;
+            case UNIFORM_MAT4:
+                glUniformMatrix4fv(read<GLint>(payload, 0), 1, GL_FALSE, uniformData(payload, header.size));
+                break;
+            case UNIFORM_MAT3:
+                glUniformMatrix3fv(read<GLint>(payload, 0), 1, GL_FALSE, uniformData(payload, header.size));
+                break;
+            case UNIFORM_VEC3:
+                glUniform3fv(read<GLint>(payload, 0), 1, uniformData(payload, header.size));
+                break;
+            case UNIFORM_FLOAT:
+                glUniform1f(read<GLint>(payload, 0), uniformData(payload, header.size)[0]);
+                break;
+            case DRAW_ELEMENTS:
+            case DRAW_ELEMENTS_INSTANCED: {
+                DrawElementsIndirectCommand command;
+                memcpy(&command, payload, sizeof(command));
+                void* firstIndex = (void*)((size_t)command.firstIndex * sizeof(GLuint));
+                if (header.type == DRAW_ELEMENTS)
+                    glDrawElementsBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, firstIndex, command.baseVertex);
+                else if (command.baseInstance != 0)
+                    glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+                        firstIndex, command.instanceCount, command.baseVertex, command.baseInstance);
+                else
+                    glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, firstIndex,
+                        command.instanceCount, command.baseVertex);
+                break;
+            }
+            case DRAW_ELEMENTS_INDIRECT:
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, read<GLuint>(payload, 0));
+                glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+                    (void*)((size_t)read<GLuint>(payload, 1) * sizeof(DrawElementsIndirectCommand)));
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+                break;
+            case MULTI_DRAW: {
+                uint32_t drawCount = read<uint32_t>(payload, 0);
+                MeshArena::VertexStream stream = (MeshArena::VertexStream)read<uint32_t>(payload, 1);
+                //payload is only byte aligned inside the vector, copy out before handing it to gl
+                multiDrawCommands.resize(drawCount);
+                multiDrawData.resize(drawCount);
+                const unsigned char* commands = payload + 2 * sizeof(uint32_t);
+                memcpy(multiDrawCommands.data(), commands, drawCount * sizeof(DrawElementsIndirectCommand));
+                memcpy(multiDrawData.data(), commands + drawCount * sizeof(DrawElementsIndirectCommand),
+                    drawCount * sizeof(MultiDrawData));
+                arena.multiDraw(multiDrawCommands.data(), drawCount, multiDrawData.data(), stream);
+                break;
+            }
+            case BEGIN_CONDITIONAL_RENDER:
+                //queries are a frame old by the time they're used, so waiting for them costs nothing
+                glBeginConditionalRender(read<GLuint>(payload, 0), GL_QUERY_WAIT);
+                break;
+            case END_CONDITIONAL_RENDER:
+                glEndConditionalRender();
+                break;
+            }
+        }
+    }
+
+private:
+    enum CommandType : uint32_t {
+        BIND_PROGRAM,
+        BIND_VERTEX_ARRAY,
+        BIND_TEXTURE,
+        BIND_INSTANCE_BUFFER,
+        DEPTH_MASK,
+        DEPTH_FUNC,
+        UNIFORM_MAT4,
+        UNIFORM_MAT3,
+        UNIFORM_VEC3,
+        UNIFORM_FLOAT,
+        DRAW_ELEMENTS,
+        DRAW_ELEMENTS_INSTANCED,
+        DRAW_ELEMENTS_INDIRECT,
+        MULTI_DRAW,
+        BEGIN_CONDITIONAL_RENDER,
+        END_CONDITIONAL_RENDER
+    };
+
+    struct Header {
+        uint32_t type;
+        uint32_t size;
+    };
+
+    template<typename T>
+    static T read(const unsigned char* payload, size_t index) {
+        T value;
+        memcpy(&value, payload + index * sizeof(T), sizeof(T));
+        return value;
+    }
+
+    // uniform payloads are a location followed by the floats
+    const GLfloat* uniformData(const unsigned char* payload, uint32_t size) const {
+        memcpy(uniformScratch, payload + sizeof(GLint), size - sizeof(GLint));
+        return uniformScratch;
+    }
+
+    // reserves header plus payload and returns where the payload starts
+    size_t begin(CommandType type, size_t size) {
+        Header header = { type, (uint32_t)size };
+        size_t offset = data.size();
+        data.resize(offset + sizeof(header) + size);
+        memcpy(&data[offset], &header, sizeof(header));
+        commandCount++;
+        return offset + sizeof(header);
+    }
+
+    void append(size_t& offset, const void* bytes, size_t size) {
+        if (size == 0)
+            return;
+        memcpy(&data[offset], bytes, size);
+        offset += size;
+    }
+
+    void write(CommandType type, const void* payload, size_t size) {
+        size_t offset = begin(type, size);
+        append(offset, payload, size);
+    }
+
+    void writeUniform(CommandType type, GLint location, const GLfloat* values, size_t count) {
+        size_t offset = begin(type, sizeof(location) + count * sizeof(GLfloat));
+        append(offset, &location, sizeof(location));
+        append(offset, values, count * sizeof(GLfloat));
+    }
+
+    std::vector<unsigned char> data;
+    size_t commandCount = 0;
+
+    //replay scratch, only touched on the gl thread
+    mutable GLfloat uniformScratch[16];
+    mutable std::vector<DrawElementsIndirectCommand> multiDrawCommands;
+    mutable std::vector<MultiDrawData> multiDrawData;
+};
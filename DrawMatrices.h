@@ -0,0 +1,107 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <xmmintrin.h>
+#include <cstddef>
+
+// matrices the vertex shader needs for one object, computed once on the cpu
+// instead of once per vertex
+struct DrawMatrices {
+    glm::mat4 mvp;
+    glm::mat4 model;
+    glm::mat3 normal;
+};
+
+// cross product of the xyz lanes of a and b (w lane ends up as 0)
+inline __m128 crossSSE(__m128 a, __m128 b) {
+    __m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+    return _mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+// out = a * b, all column major (glm layout)
+inline void multiplyMat4SSE(const float* a, const float* b, float* out) {
+    __m128 a0 = _mm_loadu_ps(a);
+    __m128 a1 = _mm_loadu_ps(a + 4);
+    __m128 a2 = _mm_loadu_ps(a + 8);
+    __m128 a3 = _mm_loadu_ps(a + 12);
+
+    for (int i = 0; i < 4; i++) {
+        __m128 col = _mm_mul_ps(a0, _mm_set1_ps(b[i * 4]));
+        col = _mm_add_ps(col, _mm_mul_ps(a1, _mm_set1_ps(b[i * 4 + 1])));
+        col = _mm_add_ps(col, _mm_mul_ps(a2, _mm_set1_ps(b[i * 4 + 2])));
+        col = _mm_add_ps(col, _mm_mul_ps(a3, _mm_set1_ps(b[i * 4 + 3])));
+        _mm_storeu_ps(out + i * 4, col);
+    }
+}
+
+// transpose(inverse(mat3(m))) using the cofactor form:
+// the columns are the cross products of the other two columns divided by the determinant
+inline glm::mat3 normalMatrixSSE(const glm::mat4& m) {
+    const float* p = &m[0][0];
+    __m128 c0 = _mm_loadu_ps(p);
+    __m128 c1 = _mm_loadu_ps(p + 4);
+    __m128 c2 = _mm_loadu_ps(p + 8);
+
+    __m128 r0 = crossSSE(c1, c2);
+    __m128 r1 = crossSSE(c2, c0);
+    __m128 r2 = crossSSE(c0, c1);
+
+    //determinant = dot(c0, cross(c1, c2)), w lane of r0 is 0 so it drops out
+    alignas(16) float d[4];
+    _mm_store_ps(d, _mm_mul_ps(c0, r0));
+    float det = d[0] + d[1] + d[2];
+    __m128 invDet = _mm_set1_ps(det != 0.0f ? 1.0f / det : 0.0f);
+
+    alignas(16) float n[12];
+    _mm_store_ps(n, _mm_mul_ps(r0, invDet));
+    _mm_store_ps(n + 4, _mm_mul_ps(r1, invDet));
+    _mm_store_ps(n + 8, _mm_mul_ps(r2, invDet));
+
+    return glm::mat3(
+        n[0], n[1], n[2],
+        n[4], n[5], n[6],
+        n[8], n[9], n[10]
+    );
+}
+
+// batched pass over every object drawn this frame
+inline void computeDrawMatrices(const glm::mat4* models, std::size_t count,
+    const glm::mat4& viewProj, DrawMatrices* out) {
+    for (std::size_t i = 0; i < count; i++) {
+        multiplyMat4SSE(&viewProj[0][0], &models[i][0][0], &out[i].mvp[0][0]);
+        out[i].model = models[i];
+        out[i].normal = normalMatrixSSE(models[i]);
+    }
+}
+
+// per instance vertex attributes for Model::drawInstanced (locations 5 to 12 in sample.vert)
+struct InstanceData {
+    glm::mat4 model;
+    glm::mat3 normal;
+    int materialIndex;
+};
+
+// same pass for instanced draws, the mvp is left to the shader since viewProj is shared
+inline void computeInstanceData(const glm::mat4* models, const int* materials, std::size_t count,
+    InstanceData* out) {
+    for (std::size_t i = 0; i < count; i++) {
+        out[i].model = models[i];
+        out[i].normal = normalMatrixSSE(models[i]);
+        out[i].materialIndex = materials[i];
+    }
+}
+
+// per draw data read through gl_DrawIDARB by the MULTI_DRAW variant of sample.vert.
+// std430 layout, the normal matrix is stored as a mat4 to keep the columns 16 byte aligned
+struct MultiDrawData {
+    glm::mat4 mvp;
+    glm::mat4 model;
+    glm::mat4 normal;
+
+    MultiDrawData() {}
+
+    MultiDrawData(const DrawMatrices& matrices)
+        : mvp(matrices.mvp), model(matrices.model), normal(matrices.normal) {}
+};
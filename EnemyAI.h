@@ -0,0 +1,254 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtc/constants.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include "EntityStore.h"
+#include "FrustumCulling.h"
+#include "BVHCommon.h"
+#include "JobSystem.h"
+
+enum AiState {
+    AI_PATROL,
+    AI_PURSUE,
+    AI_EVADE,
+    AI_STATE_COUNT
+};
+
+// what an enemy sub is doing and where it's headed, only changes when the sub plans
+struct AiAgent {
+    //patrols waypoints around a circle about home
+    glm::vec3 home;
+    float patrolRadius;
+    float patrolAngle;
+    glm::vec3 destination;
+    float speed;
+    uint32_t state;
+};
+
+// what an enemy sub knows about its target, refreshed every tick
+struct AiPerception {
+    glm::vec3 lastSeenPosition = glm::vec3(0.0f);
+    //on the ai's clock, below zero when never seen
+    float lastSeenTime = -1.0f;
+    float distance = 0.0f;
+    //positive while the target heads towards the sub
+    float closingSpeed = 0.0f;
+    uint32_t visible = 0;
+};
+
+// the sub every agent is after
+struct AiTarget {
+    glm::vec3 position;
+    glm::vec3 velocity;
+};
+
+// counters add up from the start, agents, visible and states are as of the last tick
+struct AiStats {
+    unsigned ticks = 0;
+    size_t plans = 0;
+    double perceptionMs = 0.0;
+    double thinkingMs = 0.0;
+    size_t agents = 0;
+    //could see the target
+    size_t visible = 0;
+    size_t states[AI_STATE_COUNT] = {};
+};
+
+struct AiSettings {
+    float sightRange = 60.0f;
+    //pursuers hold this far off the target
+    float standoffDistance = 15.0f;
+    //a target closing in nearer than this is run from until it's twice as far
+    float evadeRange = 12.0f;
+    //how long a pursuer keeps heading for where it last saw the target
+    float memorySeconds = 3.0f;
+    float patrolSpeed = 4.0f;
+    float pursueSpeed = 8.0f;
+    float evadeSpeed = 10.0f;
+    //radians per second
+    float turnSpeed = glm::radians(90.0f);
+    //radians between patrol waypoints
+    float patrolStep = glm::radians(60.0f);
+    float arriveRadius = 3.0f;
+    //share of the agents that re-plan each tick
+    float planFraction = 1.0f / 8.0f;
+};
+
+// line of sight against a few boxes, a segment is blocked when it passes through any of them.
+// boxes around either end are the viewer's or the target's own and don't count
+struct BoxOccluders {
+    const BoundsSoA* boxes;
+
+    bool operator()(const glm::vec3& from, const glm::vec3& to) const {
+        glm::vec3 inverseDirection = 1.0f / (to - from);
+        for (size_t i = 0; i < boxes->size(); i++) {
+            glm::vec3 min = boxes->getMin(i), max = boxes->getMax(i);
+            if (BVH::contains(min, max, from) || BVH::contains(min, max, to))
+                continue;
+            //over the segment's own 0 to 1
+            float entry;
+            if (BVH::intersectBox(min, max, from, inverseDirection, 1.0f, entry))
+                return true;
+        }
+        return false;
+    }
+};
+
+// patrol, pursue and evade for enemy subs. a tick is two passes over every agent on the job
+// system: perception measures the distance to the target and casts a line of sight ray for
+// the ones in range, then thinking re-plans the next slice of agents (state and destination,
+// round robin so each tick plans a fixed share) and steers every agent towards its plan.
+// steering only sets velocities, integrating them is left to the caller
+class EnemyAI {
+public:
+    EnemyAI(const AiSettings& settings = AiSettings()) : settings(settings) {}
+
+    const AiSettings& getSettings() const {
+        return settings;
+    }
+
+    // one tick for every entity with TransformType, VelocityType, AiAgent and AiPerception.
+    // the transform needs position and rotation (+z is forward), the velocity linear and
+    // angular. occluded(from, to) is called from the job system's threads
+    template <typename TransformType, typename VelocityType, typename Occluded>
+    void update(EntityStore& entities, JobSystem& jobs, const AiTarget& target, float seconds, const Occluded& occluded) {
+        time += seconds;
+        size_t total = entities.count<TransformType, VelocityType, AiAgent, AiPerception>();
+        if (total == 0)
+            return;
+        size_t budget = std::min(total, std::max<size_t>((size_t)std::ceil(total * settings.planFraction), 1));
+        planCursor %= total;
+
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        std::atomic<size_t> visible(0);
+        entities.forEachArray<TransformType, AiPerception>([&](size_t count, const Entity*, TransformType* transforms,
+            AiPerception* perceptions) {
+            jobs.parallelFor(count, 256, [&](size_t begin, size_t end, unsigned) {
+                size_t seen = 0;
+                for (size_t i = begin; i < end; i++)
+                    seen += perceive(transforms[i].position, target, occluded, perceptions[i]);
+                visible += seen;
+            });
+        });
+        std::chrono::high_resolution_clock::time_point perceived = std::chrono::high_resolution_clock::now();
+
+        std::atomic<size_t> states[AI_STATE_COUNT];
+        for (std::atomic<size_t>& state : states)
+            state = 0;
+        size_t base = 0;
+        entities.forEachArray<TransformType, VelocityType, AiAgent, AiPerception>([&](size_t count, const Entity*,
+            TransformType* transforms, VelocityType* velocities, AiAgent* agents, AiPerception* perceptions) {
+            jobs.parallelFor(count, 256, [&](size_t begin, size_t end, unsigned) {
+                size_t counts[AI_STATE_COUNT] = {};
+                for (size_t i = begin; i < end; i++) {
+                    //distance into this tick's window of the round robin
+                    if ((base + i + total - planCursor) % total < budget)
+                        plan(transforms[i].position, perceptions[i], agents[i]);
+                    steer(transforms[i].position, transforms[i].rotation, agents[i], velocities[i].linear,
+                        velocities[i].angular);
+                    counts[agents[i].state]++;
+                }
+                for (int state = 0; state < AI_STATE_COUNT; state++)
+                    states[state] += counts[state];
+            });
+            base += count;
+        });
+        std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+
+        planCursor = (planCursor + budget) % total;
+        for (int state = 0; state < AI_STATE_COUNT; state++)
+            stats.states[state] = states[state];
+        stats.visible = visible;
+        stats.agents = total;
+        stats.plans += budget;
+        stats.ticks++;
+        stats.perceptionMs += std::chrono::duration<double, std::milli>(perceived - start).count();
+        stats.thinkingMs += std::chrono::duration<double, std::milli>(end - perceived).count();
+    }
+
+    const AiStats& getStats() const {
+        return stats;
+    }
+
+private:
+    template <typename Occluded>
+    bool perceive(const glm::vec3& position, const AiTarget& target, const Occluded& occluded,
+        AiPerception& perception) const {
+        glm::vec3 away = position - target.position;
+        perception.distance = glm::length(away);
+        perception.closingSpeed = perception.distance > 0.0f ? glm::dot(target.velocity, away) / perception.distance : 0.0f;
+        //the ray is the expensive part, only cast it for targets in range
+        perception.visible = perception.distance <= settings.sightRange && !occluded(position, target.position);
+        if (perception.visible) {
+            perception.lastSeenPosition = target.position;
+            perception.lastSeenTime = time;
+        }
+        return perception.visible != 0;
+    }
+
+    void plan(const glm::vec3& position, const AiPerception& perception, AiAgent& agent) const {
+        bool remembered = perception.lastSeenTime >= 0.0f && time - perception.lastSeenTime <= settings.memorySeconds;
+        bool threatened = perception.visible && perception.distance < settings.evadeRange && perception.closingSpeed > 0.0f;
+        bool stillThreatened = agent.state == AI_EVADE && perception.distance < settings.evadeRange * 2.0f;
+
+        glm::vec3 away = position - perception.lastSeenPosition;
+        away.y = 0.0f;
+        float awayLength = glm::length(away);
+        away = awayLength > 1e-4f ? away / awayLength : glm::vec3(0.0f, 0.0f, 1.0f);
+
+        if (threatened || stillThreatened) {
+            agent.state = AI_EVADE;
+            agent.destination = perception.lastSeenPosition + away * settings.evadeRange * 2.0f;
+            agent.speed = settings.evadeSpeed;
+            return;
+        }
+        if (perception.visible || remembered) {
+            //close in to the standoff distance from where the sub is now, so pursuers spread around the target
+            agent.state = AI_PURSUE;
+            agent.destination = perception.lastSeenPosition + away * settings.standoffDistance;
+            agent.speed = settings.pursueSpeed;
+            return;
+        }
+
+        if (agent.state != AI_PATROL) {
+            //rejoin the circuit at the next waypoint round from where the sub ended up
+            glm::vec3 fromHome = position - agent.home;
+            agent.patrolAngle = std::ceil(std::atan2(fromHome.z, fromHome.x) / settings.patrolStep) * settings.patrolStep;
+            agent.state = AI_PATROL;
+        }
+        else if (glm::length(agent.destination - position) < settings.arriveRadius)
+            agent.patrolAngle += settings.patrolStep;
+        agent.destination = agent.home + glm::vec3(std::cos(agent.patrolAngle), 0.0f, std::sin(agent.patrolAngle)) *
+            agent.patrolRadius;
+        agent.speed = settings.patrolSpeed;
+    }
+
+    // subs only yaw: turn towards the destination and move ahead, slower while facing away
+    // and over the last stretch so they settle instead of overshooting
+    void steer(const glm::vec3& position, const glm::quat& rotation, const AiAgent& agent, glm::vec3& linear,
+        glm::vec3& angular) const {
+        glm::vec3 toDestination = agent.destination - position;
+        glm::vec3 forward = rotation * glm::vec3(0.0f, 0.0f, 1.0f);
+        float heading = std::atan2(forward.x, forward.z);
+        float turn = std::atan2(toDestination.x, toDestination.z) - heading;
+        turn = std::remainder(turn, glm::two_pi<float>());
+
+        float settle = std::min(glm::length(toDestination) / settings.arriveRadius, 1.0f);
+        float speed = agent.speed * settle;
+        linear = glm::vec3(forward.x, 0.0f, forward.z) * speed * std::max(std::cos(turn), 0.0f);
+        linear.y = glm::clamp(toDestination.y, -speed * 0.5f, speed * 0.5f);
+        //the heading to a destination right underneath is noise, stop turning near it too
+        angular = glm::vec3(0.0f, glm::clamp(turn * 4.0f, -settings.turnSpeed, settings.turnSpeed) * settle, 0.0f);
+    }
+
+    AiSettings settings;
+    float time = 0.0f;
+    size_t planCursor = 0;
+    AiStats stats;
+};
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <vector>
+#include <unordered_map>
+#include <initializer_list>
+#include <type_traits>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cassert>
+
+// handle to an entity, the generation tells a destroyed entity's handle apart from the next
+// entity that reuses its slot
+struct Entity {
+    uint32_t index;
+    uint32_t generation;
+};
+
+// entities grouped by archetype, the exact set of components they have. an archetype keeps
+// every component in its own packed array and row i of all of them belongs to one entity, so
+// systems walk plain contiguous arrays of just the components they read. adding or removing a
+// component moves the entity's row to the matching archetype, destroying one fills its row
+// with the archetype's last. components are plain data (trivially copyable), rows move with memcpy
+class EntityStore {
+public:
+    static const unsigned MAX_COMPONENTS = 32;
+    static const uint32_t INVALID = 0xFFFFFFFFu;
+    //one bit per component id
+    typedef uint32_t Signature;
+
+    // ids are handed out the first time a component type is used
+    template <typename T>
+    static unsigned componentId() {
+        static_assert(std::is_trivially_copyable<T>::value, "components are moved with memcpy");
+        static_assert(alignof(T) <= alignof(std::max_align_t), "column storage is only max_align_t aligned");
+        static const unsigned id = registerComponent(sizeof(T));
+        return id;
+    }
+
+    template <typename... Components>
+    static Signature signatureOf() {
+        Signature signature = 0;
+        (void)std::initializer_list<int>{ (signature |= 1u << componentId<Components>(), 0)... };
+        return signature;
+    }
+
+    template <typename... Components>
+    Entity create(const Components&... components) {
+        uint32_t archetype = findOrAddArchetype(signatureOf<Components...>());
+        Entity entity = allocateEntity();
+        uint32_t row = appendRow(archetype, entity);
+        (void)std::initializer_list<int>{ (*element<Components>(archetype, row) = components, 0)... };
+        return entity;
+    }
+
+    void destroy(Entity entity) {
+        if (!isAlive(entity))
+            return;
+        Record& record = records[entity.index];
+        removeRow(record.archetype, record.row);
+        record.archetype = INVALID;
+        record.generation++;
+        freeIndices.push_back(entity.index);
+        entityCount--;
+    }
+
+    bool isAlive(Entity entity) const {
+        return entity.index < records.size() && records[entity.index].generation == entity.generation &&
+            records[entity.index].archetype != INVALID;
+    }
+
+    template <typename T>
+    bool has(Entity entity) const {
+        return (archetypes[records[entity.index].archetype].signature & (1u << componentId<T>())) != 0;
+    }
+
+    template <typename T>
+    T& get(Entity entity) {
+        assert(isAlive(entity) && has<T>(entity));
+        const Record& record = records[entity.index];
+        return *element<T>(record.archetype, record.row);
+    }
+
+    template <typename T>
+    const T& get(Entity entity) const {
+        const Record& record = records[entity.index];
+        return *const_cast<EntityStore*>(this)->element<T>(record.archetype, record.row);
+    }
+
+    // sets the component, moving the entity to a new archetype when it didn't have one
+    template <typename T>
+    void add(Entity entity, const T& component) {
+        if (!has<T>(entity))
+            moveEntity(entity, archetypes[records[entity.index].archetype].signature | (1u << componentId<T>()));
+        get<T>(entity) = component;
+    }
+
+    template <typename T>
+    void remove(Entity entity) {
+        if (has<T>(entity))
+            moveEntity(entity, archetypes[records[entity.index].archetype].signature & ~(1u << componentId<T>()));
+    }
+
+    // fn(count, entities, components...) once per archetype holding all of Components, with
+    // one array per component. the arrays are the storage, writes go straight into it
+    template <typename... Components, typename Function>
+    void forEachArray(Function fn) {
+        Signature required = signatureOf<Components...>();
+        for (uint32_t i = 0; i < archetypes.size(); i++) {
+            Archetype& archetype = archetypes[i];
+            if ((archetype.signature & required) != required || archetype.entities.empty())
+                continue;
+            fn(archetype.entities.size(), archetype.entities.data(), column<Components>(i)...);
+        }
+    }
+
+    // fn(entity, components...) for every entity holding all of Components
+    template <typename... Components, typename Function>
+    void forEach(Function fn) {
+        forEachArray<Components...>([&](size_t count, const Entity* entities, Components*... columns) {
+            for (size_t row = 0; row < count; row++)
+                fn(entities[row], columns[row]...);
+        });
+    }
+
+    // entities holding all of Components
+    template <typename... Components>
+    size_t count() const {
+        Signature required = signatureOf<Components...>();
+        size_t total = 0;
+        for (const Archetype& archetype : archetypes) {
+            if ((archetype.signature & required) == required)
+                total += archetype.entities.size();
+        }
+        return total;
+    }
+
+    size_t size() const {
+        return entityCount;
+    }
+
+    size_t getArchetypeCount() const {
+        return archetypes.size();
+    }
+
+private:
+    struct Column {
+        unsigned component;
+        size_t elementSize;
+        std::vector<uint8_t> data;
+    };
+
+    struct Archetype {
+        Signature signature;
+        std::vector<Entity> entities;
+        std::vector<Column> columns;
+        //column of each component id, -1 when the archetype doesn't have it
+        int8_t columnIndex[MAX_COMPONENTS];
+    };
+
+    struct Record {
+        uint32_t archetype;
+        uint32_t row;
+        uint32_t generation;
+    };
+
+    static unsigned registerComponent(size_t size) {
+        static std::atomic<unsigned> nextId(0);
+        unsigned id = nextId++;
+        assert(id < MAX_COMPONENTS);
+        componentSizes()[id] = size;
+        return id;
+    }
+
+    static size_t* componentSizes() {
+        static size_t sizes[MAX_COMPONENTS] = {};
+        return sizes;
+    }
+
+    template <typename T>
+    T* column(uint32_t archetype) {
+        Column& storage = archetypes[archetype].columns[archetypes[archetype].columnIndex[componentId<T>()]];
+        return reinterpret_cast<T*>(storage.data.data());
+    }
+
+    template <typename T>
+    T* element(uint32_t archetype, uint32_t row) {
+        return column<T>(archetype) + row;
+    }
+
+    uint32_t findOrAddArchetype(Signature signature) {
+        std::unordered_map<Signature, uint32_t>::const_iterator found = archetypeLookup.find(signature);
+        if (found != archetypeLookup.end())
+            return found->second;
+
+        Archetype archetype;
+        archetype.signature = signature;
+        std::memset(archetype.columnIndex, -1, sizeof(archetype.columnIndex));
+        for (unsigned component = 0; component < MAX_COMPONENTS; component++) {
+            if (!(signature & (1u << component)))
+                continue;
+            archetype.columnIndex[component] = (int8_t)archetype.columns.size();
+            archetype.columns.push_back(Column{ component, componentSizes()[component], std::vector<uint8_t>() });
+        }
+
+        uint32_t index = (uint32_t)archetypes.size();
+        archetypes.push_back(std::move(archetype));
+        archetypeLookup[signature] = index;
+        return index;
+    }
+
+    Entity allocateEntity() {
+        uint32_t index;
+        if (!freeIndices.empty()) {
+            index = freeIndices.back();
+            freeIndices.pop_back();
+        }
+        else {
+            index = (uint32_t)records.size();
+            records.push_back(Record{ INVALID, 0, 0 });
+        }
+        entityCount++;
+        return Entity{ index, records[index].generation };
+    }
+
+    // the new row's components are left uninitialized
+    uint32_t appendRow(uint32_t archetypeIndex, Entity entity) {
+        Archetype& archetype = archetypes[archetypeIndex];
+        uint32_t row = (uint32_t)archetype.entities.size();
+        archetype.entities.push_back(entity);
+        for (Column& storage : archetype.columns)
+            storage.data.resize(storage.data.size() + storage.elementSize);
+
+        records[entity.index].archetype = archetypeIndex;
+        records[entity.index].row = row;
+        return row;
+    }
+
+    // the last row takes the removed one's place
+    void removeRow(uint32_t archetypeIndex, uint32_t row) {
+        Archetype& archetype = archetypes[archetypeIndex];
+        uint32_t last = (uint32_t)archetype.entities.size() - 1;
+        if (row != last) {
+            for (Column& storage : archetype.columns) {
+                std::memcpy(&storage.data[row * storage.elementSize], &storage.data[last * storage.elementSize],
+                    storage.elementSize);
+            }
+            archetype.entities[row] = archetype.entities[last];
+            records[archetype.entities[row].index].row = row;
+        }
+        archetype.entities.pop_back();
+        for (Column& storage : archetype.columns)
+            storage.data.resize(storage.data.size() - storage.elementSize);
+    }
+
+    // copies the components both archetypes have, the rest of the new row is uninitialized
+    void moveEntity(Entity entity, Signature signature) {
+        uint32_t source = records[entity.index].archetype;
+        uint32_t sourceRow = records[entity.index].row;
+        uint32_t target = findOrAddArchetype(signature);
+        uint32_t targetRow = appendRow(target, entity);
+
+        for (Column& storage : archetypes[target].columns) {
+            int8_t sourceColumn = archetypes[source].columnIndex[storage.component];
+            if (sourceColumn < 0)
+                continue;
+            std::memcpy(&storage.data[targetRow * storage.elementSize],
+                &archetypes[source].columns[sourceColumn].data[sourceRow * storage.elementSize], storage.elementSize);
+        }
+        removeRow(source, sourceRow);
+    }
+
+    std::vector<Archetype> archetypes;
+    std::unordered_map<Signature, uint32_t> archetypeLookup;
+    std::vector<Record> records;
+    std::vector<uint32_t> freeIndices;
+    size_t entityCount = 0;
+};
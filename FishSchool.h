@@ -0,0 +1,574 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <xmmintrin.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+#include <vector>
+#include <random>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <algorithm>
+#include "GLState.h"
+#include "MeshArena.h"
+#include "JobSystem.h"
+
+struct FishSettings {
+    //fish further apart than this don't see each other, also the grid's cell size
+    float neighborRadius = 2.0f;
+    float separationRadius = 0.8f;
+    float separationWeight = 1.5f;
+    float alignmentWeight = 1.0f;
+    float cohesionWeight = 0.6f;
+    float avoidWeight = 12.0f;
+    //extra distance around an obstacle's sphere that fish start turning away at
+    float avoidMargin = 3.0f;
+    float boundsWeight = 2.0f;
+    float minSpeed = 2.0f;
+    float maxSpeed = 6.0f;
+};
+
+// a sphere the fish swim around
+struct FishObstacle {
+    glm::vec3 center;
+    float radius;
+};
+
+// one fish's instance attributes, see fish.vert
+struct FishInstance {
+    //xyz position, w how far the tail beat has got
+    glm::vec4 positionPhase;
+    glm::vec4 velocity;
+};
+
+// boids (separation, alignment, cohesion) kept inside a box and away from obstacles. fish
+// live in plain float arrays, one per component, and every step counting sorts them by the
+// grid cell they're in, hashed into a table of buckets. the fish of a bucket then sit next to
+// each other and a cell's x neighbours hash to the buckets beside it, so each fish reads the
+// 27 cells around it as 9 contiguous runs and compares itself to 8 neighbours per avx
+// instruction (4 with sse). the per-entity SpatialHash is the
+// wrong fit here: every fish moves every step and a rebuilt sort is cheaper than 100k moves
+class FishSchool {
+public:
+    FishSchool(size_t count, const glm::vec3& boundsCenter, const glm::vec3& boundsHalfSize,
+        const FishSettings& settings = FishSettings())
+        : settings(settings), boundsCenter(boundsCenter), boundsHalfSize(boundsHalfSize), count(count) {
+        size_t padded = (count + LANES - 1) / LANES * LANES + LANES;
+        for (std::vector<float>* component : { &x, &y, &z, &vx, &vy, &vz, &phase, &sortX, &sortY, &sortZ, &sortVX,
+            &sortVY, &sortVZ, &sortPhase, &steerX, &steerY, &steerZ })
+            component->assign(padded, 0.0f);
+        bucketOf.resize(count);
+        size_t tableSize = 64;
+        while (tableSize < count * 2)
+            tableSize *= 2;
+        bucketMask = (uint32_t)tableSize - 1;
+        bucketStarts.resize(tableSize + 1);
+
+        //start scattered through the box, heading off in random directions
+        std::mt19937 random(99);
+        std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+        for (size_t i = 0; i < count; i++) {
+            glm::vec3 position = boundsCenter + glm::vec3(unit(random), unit(random), unit(random)) * boundsHalfSize;
+            glm::vec3 velocity = glm::vec3(unit(random), unit(random) * 0.2f, unit(random));
+            velocity = glm::normalize(velocity + glm::vec3(0.0f, 0.0f, 1e-3f)) * settings.minSpeed;
+            x[i] = position.x;
+            y[i] = position.y;
+            z[i] = position.z;
+            vx[i] = velocity.x;
+            vy[i] = velocity.y;
+            vz[i] = velocity.z;
+            phase[i] = (unit(random) + 1.0f) * 3.14159265f;
+        }
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    // advances every fish by seconds, obstacles are only read during the call
+    void update(JobSystem& jobs, float seconds, const std::vector<FishObstacle>& obstacles) {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        sortIntoBuckets(jobs);
+        std::chrono::high_resolution_clock::time_point sorted = std::chrono::high_resolution_clock::now();
+
+        //obstacles nowhere near the box can't reach a fish
+        nearObstacles.clear();
+        for (const FishObstacle& obstacle : obstacles) {
+            glm::vec3 outside = glm::max(glm::abs(obstacle.center - boundsCenter) - boundsHalfSize, glm::vec3(0.0f));
+            float reach = obstacle.radius + settings.avoidMargin;
+            if (glm::dot(outside, outside) < reach * reach)
+                nearObstacles.push_back(obstacle);
+        }
+
+        std::atomic<size_t> neighbors(0);
+        jobs.parallelFor(count, 512, [&](size_t begin, size_t end, unsigned) {
+            size_t seen = 0;
+            NeighborRuns runs;
+            for (size_t i = begin; i < end; i++)
+                seen += steer(i, runs);
+            neighbors += seen;
+        });
+        std::chrono::high_resolution_clock::time_point steered = std::chrono::high_resolution_clock::now();
+
+        jobs.parallelFor((count + LANES - 1) / LANES, 64, [&](size_t begin, size_t end, unsigned) {
+            integrate(begin * LANES, std::min(end * LANES, count), seconds);
+        });
+        std::chrono::high_resolution_clock::time_point integrated = std::chrono::high_resolution_clock::now();
+
+        stats.steps++;
+        stats.neighbors += neighbors;
+        stats.sortMs += std::chrono::duration<double, std::milli>(sorted - start).count();
+        stats.steerMs += std::chrono::duration<double, std::milli>(steered - sorted).count();
+        stats.integrateMs += std::chrono::duration<double, std::milli>(integrated - steered).count();
+    }
+
+    // writes every fish's instance attributes, out needs room for size() of them
+    void fillInstances(JobSystem& jobs, FishInstance* out) const {
+        jobs.parallelFor(count, 4096, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; i++) {
+                out[i].positionPhase = glm::vec4(x[i], y[i], z[i], phase[i]);
+                out[i].velocity = glm::vec4(vx[i], vy[i], vz[i], 0.0f);
+            }
+        });
+    }
+
+    struct Stats {
+        unsigned steps = 0;
+        //neighbours found, summed over fish and steps
+        size_t neighbors = 0;
+        double sortMs = 0.0;
+        double steerMs = 0.0;
+        double integrateMs = 0.0;
+    };
+
+    // since the last resetStats
+    const Stats& getStats() const {
+        return stats;
+    }
+
+    void resetStats() {
+        stats = Stats();
+    }
+
+private:
+    //the kernels are written once against these, 8 floats per register with avx and 4 with sse
+#ifdef __AVX__
+    static const size_t LANES = 8;
+    typedef __m256 Lanes;
+
+    static Lanes load(const float* values) {
+        return _mm256_loadu_ps(values);
+    }
+
+    static Lanes splat(float value) {
+        return _mm256_set1_ps(value);
+    }
+
+    static Lanes add(Lanes a, Lanes b) {
+        return _mm256_add_ps(a, b);
+    }
+
+    static Lanes sub(Lanes a, Lanes b) {
+        return _mm256_sub_ps(a, b);
+    }
+
+    static Lanes mul(Lanes a, Lanes b) {
+        return _mm256_mul_ps(a, b);
+    }
+
+    //about 12 bits, plenty for a weight
+    static Lanes reciprocal(Lanes a) {
+        return _mm256_rcp_ps(a);
+    }
+
+    static Lanes select(Lanes mask, Lanes a) {
+        return _mm256_and_ps(mask, a);
+    }
+
+    static Lanes both(Lanes a, Lanes b) {
+        return _mm256_and_ps(a, b);
+    }
+
+    static Lanes less(Lanes a, Lanes b) {
+        return _mm256_cmp_ps(a, b, _CMP_LT_OQ);
+    }
+
+    static Lanes laneIndexes() {
+        return _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f);
+    }
+
+    static void store(float* values, Lanes a) {
+        _mm256_storeu_ps(values, a);
+    }
+
+    static float sum(Lanes a) {
+        __m128 half = _mm_add_ps(_mm256_castps256_ps128(a), _mm256_extractf128_ps(a, 1));
+        half = _mm_add_ps(half, _mm_movehl_ps(half, half));
+        return _mm_cvtss_f32(_mm_add_ss(half, _mm_shuffle_ps(half, half, 1)));
+    }
+#else
+    static const size_t LANES = 4;
+    typedef __m128 Lanes;
+
+    static Lanes load(const float* values) {
+        return _mm_loadu_ps(values);
+    }
+
+    static Lanes splat(float value) {
+        return _mm_set1_ps(value);
+    }
+
+    static Lanes add(Lanes a, Lanes b) {
+        return _mm_add_ps(a, b);
+    }
+
+    static Lanes sub(Lanes a, Lanes b) {
+        return _mm_sub_ps(a, b);
+    }
+
+    static Lanes mul(Lanes a, Lanes b) {
+        return _mm_mul_ps(a, b);
+    }
+
+    //about 12 bits, plenty for a weight
+    static Lanes reciprocal(Lanes a) {
+        return _mm_rcp_ps(a);
+    }
+
+    static Lanes select(Lanes mask, Lanes a) {
+        return _mm_and_ps(mask, a);
+    }
+
+    static Lanes both(Lanes a, Lanes b) {
+        return _mm_and_ps(a, b);
+    }
+
+    static Lanes less(Lanes a, Lanes b) {
+        return _mm_cmplt_ps(a, b);
+    }
+
+    static Lanes laneIndexes() {
+        return _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    }
+
+    static void store(float* values, Lanes a) {
+        _mm_storeu_ps(values, a);
+    }
+
+    static float sum(Lanes a) {
+        a = _mm_add_ps(a, _mm_movehl_ps(a, a));
+        return _mm_cvtss_f32(_mm_add_ss(a, _mm_shuffle_ps(a, a, 1)));
+    }
+#endif
+
+    // buckets first to last inclusive
+    struct BucketRun {
+        uint32_t first;
+        uint32_t last;
+    };
+
+    // the merged runs around one cell
+    struct NeighborRuns {
+        glm::ivec3 cell;
+        BucketRun runs[18];
+        int count = 0;
+    };
+
+    glm::ivec3 cellOf(float px, float py, float pz) const {
+        return glm::ivec3(glm::floor(glm::vec3(px, py, pz) / settings.neighborRadius));
+    }
+
+    // linear in x, so a cell's x neighbours land in the buckets either side of its own
+    uint32_t bucket(const glm::ivec3& cell) const {
+        return ((uint32_t)cell.x + (uint32_t)cell.y * 7919u + (uint32_t)cell.z * 1000003u) & bucketMask;
+    }
+
+    // counting sort by bucket: hashes in parallel, counts and scatters on the calling thread
+    void sortIntoBuckets(JobSystem& jobs) {
+        jobs.parallelFor(count, 4096, [&](size_t begin, size_t end, unsigned) {
+            for (size_t i = begin; i < end; i++)
+                bucketOf[i] = bucket(cellOf(x[i], y[i], z[i]));
+        });
+
+        std::fill(bucketStarts.begin(), bucketStarts.end(), 0u);
+        for (size_t i = 0; i < count; i++)
+            bucketStarts[bucketOf[i] + 1]++;
+        for (size_t b = 1; b < bucketStarts.size(); b++)
+            bucketStarts[b] += bucketStarts[b - 1];
+
+        //next free slot of each bucket, the starts are kept for the lookups
+        cursors.assign(bucketStarts.begin(), bucketStarts.end() - 1);
+        for (size_t i = 0; i < count; i++) {
+            uint32_t slot = cursors[bucketOf[i]]++;
+            sortX[slot] = x[i];
+            sortY[slot] = y[i];
+            sortZ[slot] = z[i];
+            sortVX[slot] = vx[i];
+            sortVY[slot] = vy[i];
+            sortVZ[slot] = vz[i];
+            sortPhase[slot] = phase[i];
+        }
+        x.swap(sortX);
+        y.swap(sortY);
+        z.swap(sortZ);
+        vx.swap(sortVX);
+        vy.swap(sortVY);
+        vz.swap(sortVZ);
+        phase.swap(sortPhase);
+    }
+
+    // the 27 cells around cell are 9 rows of 3 consecutive buckets. rows wrapping round the
+    // table are split and overlapping ones merged, so no fish is read twice
+    void findNeighborRuns(const glm::ivec3& cell, NeighborRuns& runs) const {
+        BucketRun rows[18];
+        int rowCount = 0;
+        for (int row = 0; row < 9; row++) {
+            uint32_t middle = bucket(cell + glm::ivec3(0, row % 3 - 1, row / 3 - 1));
+            uint32_t first = (middle - 1) & bucketMask, last = (middle + 1) & bucketMask;
+            if (first <= last)
+                rows[rowCount++] = BucketRun{ first, last };
+            else {
+                rows[rowCount++] = BucketRun{ first, bucketMask };
+                rows[rowCount++] = BucketRun{ 0, last };
+            }
+        }
+        std::sort(rows, rows + rowCount, [](const BucketRun& a, const BucketRun& b) {
+            return a.first < b.first;
+        });
+
+        runs.cell = cell;
+        runs.count = 0;
+        for (int row = 0; row < rowCount; row++) {
+            if (runs.count > 0 && rows[row].first <= runs.runs[runs.count - 1].last + 1)
+                runs.runs[runs.count - 1].last = std::max(runs.runs[runs.count - 1].last, rows[row].last);
+            else
+                runs.runs[runs.count++] = rows[row];
+        }
+    }
+
+    // the three rules from the neighbours in the 27 cells around fish i, plus obstacles and
+    // the box. the new velocity goes to steer* so other fish still read the old one
+    size_t steer(size_t i, NeighborRuns& runs) {
+        glm::vec3 position(x[i], y[i], z[i]);
+        glm::vec3 velocity(vx[i], vy[i], vz[i]);
+        glm::ivec3 cell = cellOf(x[i], y[i], z[i]);
+
+        Lanes px = splat(position.x), py = splat(position.y), pz = splat(position.z);
+        Lanes radiusSquared = splat(settings.neighborRadius * settings.neighborRadius);
+        Lanes separationSquared = splat(settings.separationRadius * settings.separationRadius);
+        Lanes zero = splat(0.0f), one = splat(1.0f), lanes = laneIndexes();
+        Lanes found = zero, sumX = zero, sumY = zero, sumZ = zero, sumVX = zero, sumVY = zero, sumVZ = zero;
+        Lanes awayX = zero, awayY = zero, awayZ = zero;
+
+        //fish sit in bucket order, the one before was often in the same cell
+        if (runs.count == 0 || runs.cell != cell)
+            findNeighborRuns(cell, runs);
+        for (int run = 0; run < runs.count; run++) {
+            uint32_t end = bucketStarts[runs.runs[run].last + 1];
+            for (uint32_t j = bucketStarts[runs.runs[run].first]; j < end; j += LANES) {
+                Lanes dx = sub(load(&x[j]), px), dy = sub(load(&y[j]), py), dz = sub(load(&z[j]), pz);
+                Lanes distanceSquared = add(add(mul(dx, dx), mul(dy, dy)), mul(dz, dz));
+                //past the run's end, out of range, or the fish itself
+                Lanes near = both(both(less(lanes, splat((float)(end - j))), less(distanceSquared, radiusSquared)),
+                    less(zero, distanceSquared));
+                found = add(found, select(near, one));
+                sumX = add(sumX, select(near, dx));
+                sumY = add(sumY, select(near, dy));
+                sumZ = add(sumZ, select(near, dz));
+                sumVX = add(sumVX, select(near, load(&vx[j])));
+                sumVY = add(sumVY, select(near, load(&vy[j])));
+                sumVZ = add(sumVZ, select(near, load(&vz[j])));
+
+                //pushed away from the close ones, harder the closer they are
+                Lanes crowded = both(near, less(distanceSquared, separationSquared));
+                Lanes weight = select(crowded, reciprocal(add(distanceSquared, splat(1e-4f))));
+                awayX = sub(awayX, mul(dx, weight));
+                awayY = sub(awayY, mul(dy, weight));
+                awayZ = sub(awayZ, mul(dz, weight));
+            }
+        }
+
+        glm::vec3 acceleration(0.0f);
+        float neighbors = sum(found);
+        if (neighbors > 0.0f) {
+            glm::vec3 toCenter = glm::vec3(sum(sumX), sum(sumY), sum(sumZ)) / neighbors;
+            glm::vec3 averageVelocity = glm::vec3(sum(sumVX), sum(sumVY), sum(sumVZ)) / neighbors;
+            acceleration += toCenter * settings.cohesionWeight;
+            acceleration += (averageVelocity - velocity) * settings.alignmentWeight;
+            acceleration += glm::vec3(sum(awayX), sum(awayY), sum(awayZ)) * settings.separationWeight;
+        }
+
+        for (const FishObstacle& obstacle : nearObstacles) {
+            glm::vec3 away = position - obstacle.center;
+            float distance = glm::length(away);
+            float reach = obstacle.radius + settings.avoidMargin;
+            if (distance < reach && distance > 0.0f)
+                acceleration += away / distance * (1.0f - distance / reach) * settings.avoidWeight * settings.maxSpeed;
+        }
+
+        //turned back in by however far they've strayed out of the box
+        glm::vec3 local = position - boundsCenter;
+        glm::vec3 outside = glm::max(glm::abs(local) - boundsHalfSize, glm::vec3(0.0f));
+        acceleration -= glm::sign(local) * outside * settings.boundsWeight;
+
+        steerX[i] = acceleration.x;
+        steerY[i] = acceleration.y;
+        steerZ[i] = acceleration.z;
+        return (size_t)neighbors;
+    }
+
+    // fish [begin, end), begin a multiple of LANES. past count only padding is touched
+    void integrate(size_t begin, size_t end, float seconds) {
+        Lanes dt = splat(seconds);
+        for (size_t i = begin; i < end; i += LANES) {
+            Lanes velocityX = add(load(&vx[i]), mul(load(&steerX[i]), dt));
+            Lanes velocityY = add(load(&vy[i]), mul(load(&steerY[i]), dt));
+            Lanes velocityZ = add(load(&vz[i]), mul(load(&steerZ[i]), dt));
+
+            //speed clamped to min..max, scaled in place
+            float speeds[LANES], scales[LANES];
+            store(speeds, add(add(mul(velocityX, velocityX), mul(velocityY, velocityY)), mul(velocityZ, velocityZ)));
+            for (size_t lane = 0; lane < LANES; lane++) {
+                float speed = std::sqrt(speeds[lane]);
+                speeds[lane] = glm::clamp(speed, settings.minSpeed, settings.maxSpeed);
+                scales[lane] = speed > 0.0f ? speeds[lane] / speed : 1.0f;
+            }
+            Lanes scale = load(scales);
+            velocityX = mul(velocityX, scale);
+            velocityY = mul(velocityY, scale);
+            velocityZ = mul(velocityZ, scale);
+
+            store(&vx[i], velocityX);
+            store(&vy[i], velocityY);
+            store(&vz[i], velocityZ);
+            store(&x[i], add(load(&x[i]), mul(velocityX, dt)));
+            store(&y[i], add(load(&y[i]), mul(velocityY, dt)));
+            store(&z[i], add(load(&z[i]), mul(velocityZ, dt)));
+
+            //the tail beats about once per body length swum
+            store(&phase[i], add(load(&phase[i]), mul(mul(load(speeds), dt), splat(6.0f))));
+        }
+    }
+
+    FishSettings settings;
+    glm::vec3 boundsCenter;
+    glm::vec3 boundsHalfSize;
+    size_t count;
+
+    //per fish in bucket order, padded past count to a whole register plus one
+    std::vector<float> x, y, z, vx, vy, vz, phase;
+    std::vector<float> steerX, steerY, steerZ;
+    //scatter targets of the sort
+    std::vector<float> sortX, sortY, sortZ, sortVX, sortVY, sortVZ, sortPhase;
+
+    std::vector<uint32_t> bucketOf;
+    uint32_t bucketMask;
+    //first fish of each bucket, plus one past the end
+    std::vector<uint32_t> bucketStarts;
+    std::vector<uint32_t> cursors;
+    std::vector<FishObstacle> nearObstacles;
+    Stats stats;
+};
+
+// the fish's gl side: a small procedural mesh in its own vao, drawn once per fish from a
+// FishInstance buffer that's refilled every frame
+class FishMesh {
+public:
+    FishMesh() {
+        //nose at +z, a diamond body and a vertical tail fin, flat shaded
+        const glm::vec3 nose(0.0f, 0.0f, 0.5f), tail(0.0f, 0.0f, -0.3f);
+        const glm::vec3 left(-0.1f, 0.0f, 0.05f), right(0.1f, 0.0f, 0.05f);
+        const glm::vec3 top(0.0f, 0.16f, 0.05f), bottom(0.0f, -0.12f, 0.05f);
+        const glm::vec3 finTop(0.0f, 0.18f, -0.6f), finBottom(0.0f, -0.18f, -0.6f);
+        const glm::vec3 triangles[] = {
+            nose, right, top, nose, top, left, nose, left, bottom, nose, bottom, right,
+            tail, top, right, tail, left, top, tail, bottom, left, tail, right, bottom,
+            tail, finTop, finBottom
+        };
+
+        std::vector<GLfloat> vertices;
+        for (size_t i = 0; i < sizeof(triangles) / sizeof(triangles[0]); i += 3) {
+            glm::vec3 normal = glm::normalize(glm::cross(triangles[i + 1] - triangles[i], triangles[i + 2] - triangles[i]));
+            for (size_t corner = 0; corner < 3; corner++) {
+                vertices.insert(vertices.end(), { triangles[i + corner].x, triangles[i + corner].y, triangles[i + corner].z,
+                    normal.x, normal.y, normal.z });
+            }
+        }
+        vertexCount = (GLsizei)(vertices.size() / 6);
+        //unshared corners, the indices only let the draw go through the command buffer's element draws
+        std::vector<GLuint> indices(vertexCount);
+        for (GLsizei i = 0; i < vertexCount; i++)
+            indices[i] = (GLuint)i;
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glGenBuffers(1, &instanceVBO);
+        GLState::get().bindVertexArray(VAO);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(GLfloat), vertices.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (void*)(3 * sizeof(GLfloat)));
+        glEnableVertexAttribArray(1);
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(FishInstance), (void*)offsetof(FishInstance, positionPhase));
+        glEnableVertexAttribArray(2);
+        glVertexAttribDivisor(2, 1);
+        glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(FishInstance), (void*)offsetof(FishInstance, velocity));
+        glEnableVertexAttribArray(3);
+        glVertexAttribDivisor(3, 1);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        GLState::get().bindVertexArray(0);
+    }
+
+    ~FishMesh() {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &instanceVBO);
+    }
+
+    // one upload per frame into orphaned storage. too big for the ring buffer's frame region
+    // at full school sizes, and the attributes live in this vao rather than the arena's
+    void setInstances(const FishInstance* instances, size_t count) {
+        instanceCount = (GLsizei)count;
+        if (count > instanceCapacity)
+            instanceCapacity = count;
+        glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(FishInstance) * instanceCapacity, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(FishInstance) * count, instances);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    GLuint getVertexArray() const {
+        return VAO;
+    }
+
+    GLsizei getInstanceCount() const {
+        return instanceCount;
+    }
+
+    // every instance from setInstances, for CommandBuffer::drawElementsInstanced with this vao bound
+    DrawElementsIndirectCommand getDrawCommand() const {
+        return { (GLuint)vertexCount, (GLuint)instanceCount, 0, 0, 0 };
+    }
+
+private:
+    GLuint VAO = 0;
+    GLuint VBO = 0;
+    GLuint EBO = 0;
+    GLuint instanceVBO = 0;
+    GLsizei vertexCount = 0;
+    size_t instanceCapacity = 0;
+    GLsizei instanceCount = 0;
+};
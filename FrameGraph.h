@@ -0,0 +1,424 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <functional>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "GLState.h"
+
+// size and format of a render target texture
+struct RenderTargetDesc {
+    GLsizei width;
+    GLsizei height;
+    GLenum internalFormat;
+
+    bool operator==(const RenderTargetDesc& other) const {
+        return width == other.width && height == other.height && internalFormat == other.internalFormat;
+    }
+};
+
+// passes declare which render targets they read and write, compile() orders them, drops
+// the ones nothing downstream uses and gives transient targets real textures, letting
+// targets with the same desc and non-overlapping lifetimes share one texture.
+// the graph is static between compiles, execute() just walks the compiled pass list
+class FrameGraph {
+public:
+    typedef int ResourceHandle;
+    typedef int PassHandle;
+    typedef std::function<void()> ExecuteFunction;
+
+    ~FrameGraph() {
+        releaseGLObjects();
+    }
+
+    // a target that only lives inside the frame, the graph owns its texture
+    ResourceHandle createTransient(const std::string& name, const RenderTargetDesc& desc) {
+        Resource resource;
+        resource.name = name;
+        resource.desc = desc;
+        resources.push_back(resource);
+        dirty = true;
+        return (ResourceHandle)resources.size() - 1;
+    }
+
+    // the window's default framebuffer (or an offscreen one standing in for it when there is
+    // no window), writing to it is what keeps passes alive
+    ResourceHandle importBackbuffer(const std::string& name, GLuint framebuffer = 0) {
+        Resource resource;
+        resource.name = name;
+        resource.imported = true;
+        resource.framebuffer = framebuffer;
+        resources.push_back(resource);
+        dirty = true;
+        return (ResourceHandle)resources.size() - 1;
+    }
+
+    PassHandle addPass(const std::string& name, const std::vector<ResourceHandle>& reads,
+        const std::vector<ResourceHandle>& writes, const ExecuteFunction& execute) {
+        Pass pass;
+        pass.name = name;
+        pass.reads = reads;
+        pass.writes = writes;
+        pass.execute = execute;
+        passes.push_back(pass);
+        dirty = true;
+        return (PassHandle)passes.size() - 1;
+    }
+
+    // disabled passes are left out of the next compile as if they were never added
+    void setPassEnabled(PassHandle pass, bool enabled) {
+        if (passes[pass].enabled == enabled)
+            return;
+        passes[pass].enabled = enabled;
+        dirty = true;
+    }
+
+    bool isPassEnabled(PassHandle pass) const {
+        return passes[pass].enabled;
+    }
+
+    void compile() {
+        releaseGLObjects();
+
+        order.clear();
+        std::vector<PassHandle> sorted = sortPasses();
+        std::vector<bool> needed = findNeededPasses(sorted);
+        for (PassHandle pass : sorted) {
+            if (needed[pass])
+                order.push_back(pass);
+        }
+        culledPassCount = 0;
+        for (const Pass& pass : passes) {
+            if (pass.enabled)
+                culledPassCount++;
+        }
+        culledPassCount -= (unsigned)order.size();
+
+        allocateTextures();
+        createFramebuffers();
+        dirty = false;
+    }
+
+    void execute() {
+        if (dirty)
+            compile();
+
+        for (PassHandle handle : order) {
+            Pass& pass = passes[handle];
+            glBindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+            //backbuffer passes keep whatever viewport the window set
+            if (pass.width != 0)
+                glViewport(0, 0, pass.width, pass.height);
+
+            //transients start undefined (and may hold another target's data when aliased),
+            //so the first pass writing one clears it
+            if (pass.clearMask != 0) {
+                GLState::get().setDepthMask(true);
+                glClear(pass.clearMask);
+            }
+
+            pass.execute();
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // copies one target into another, e.g. the post pass resolving into the backbuffer
+    void blit(ResourceHandle from, ResourceHandle to, GLbitfield mask) {
+        const Resource& source = resources[from];
+        const Resource& destination = resources[to];
+
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, readFramebuffer);
+        GLenum attachment = isDepthFormat(source.desc.internalFormat) ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0;
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, attachment, GL_TEXTURE_2D, getTexture(from), 0);
+
+        GLuint drawFramebuffer = 0;
+        for (PassHandle handle : order) {
+            if (std::find(passes[handle].writes.begin(), passes[handle].writes.end(), to) != passes[handle].writes.end())
+                drawFramebuffer = passes[handle].framebuffer;
+        }
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, destination.imported ? destination.framebuffer : drawFramebuffer);
+
+        GLsizei width = source.desc.width;
+        GLsizei height = source.desc.height;
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, mask, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    GLuint getTexture(ResourceHandle resource) const {
+        int physical = resources[resource].physical;
+        return physical < 0 ? 0 : textures[physical].id;
+    }
+
+    unsigned getCulledPassCount() const {
+        return culledPassCount;
+    }
+
+    size_t getTransientCount() const {
+        size_t count = 0;
+        for (const Resource& resource : resources) {
+            if (!resource.imported && resource.physical >= 0)
+                count++;
+        }
+        return count;
+    }
+
+    size_t getTextureCount() const {
+        return textures.size();
+    }
+
+    const std::vector<PassHandle>& getOrder() const {
+        return order;
+    }
+
+    const std::string& getPassName(PassHandle pass) const {
+        return passes[pass].name;
+    }
+
+private:
+    struct Resource {
+        std::string name;
+        RenderTargetDesc desc = { 0, 0, 0 };
+        bool imported = false;
+        GLuint framebuffer = 0;
+        int physical = -1;
+    };
+
+    struct Pass {
+        std::string name;
+        std::vector<ResourceHandle> reads;
+        std::vector<ResourceHandle> writes;
+        ExecuteFunction execute;
+        bool enabled = true;
+        GLuint framebuffer = 0;
+        bool ownsFramebuffer = false;
+        GLbitfield clearMask = 0;
+        GLsizei width = 0;
+        GLsizei height = 0;
+    };
+
+    struct PhysicalTexture {
+        RenderTargetDesc desc;
+        GLuint id;
+        //compiled order index after which the texture is free again
+        int freeAfter;
+    };
+
+    static bool isDepthFormat(GLenum format) {
+        return format == GL_DEPTH_COMPONENT16 || format == GL_DEPTH_COMPONENT24 ||
+            format == GL_DEPTH_COMPONENT32F || format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH_COMPONENT;
+    }
+
+    static bool contains(const std::vector<ResourceHandle>& list, ResourceHandle resource) {
+        return std::find(list.begin(), list.end(), resource) != list.end();
+    }
+
+    // kahn's algorithm over read-after-write and write-after-write edges, lowest declaration
+    // index first so independent passes keep the order they were added in
+    std::vector<PassHandle> sortPasses() const {
+        size_t count = passes.size();
+        std::vector<std::vector<PassHandle>> edges(count);
+        std::vector<int> incoming(count, 0);
+
+        for (size_t reader = 0; reader < count; reader++) {
+            if (!passes[reader].enabled)
+                continue;
+            std::vector<ResourceHandle> used = passes[reader].reads;
+            used.insert(used.end(), passes[reader].writes.begin(), passes[reader].writes.end());
+            for (ResourceHandle resource : used) {
+                //depend on the closest earlier writer
+                for (int writer = (int)reader - 1; writer >= 0; writer--) {
+                    if (passes[writer].enabled && contains(passes[writer].writes, resource)) {
+                        edges[writer].push_back((PassHandle)reader);
+                        incoming[reader]++;
+                        break;
+                    }
+                }
+            }
+        }
+
+        std::vector<PassHandle> ready;
+        for (size_t i = 0; i < count; i++) {
+            if (passes[i].enabled && incoming[i] == 0)
+                ready.push_back((PassHandle)i);
+        }
+
+        std::vector<PassHandle> sorted;
+        while (!ready.empty()) {
+            std::vector<PassHandle>::iterator lowest = std::min_element(ready.begin(), ready.end());
+            PassHandle pass = *lowest;
+            ready.erase(lowest);
+            sorted.push_back(pass);
+
+            for (PassHandle next : edges[pass]) {
+                if (--incoming[next] == 0)
+                    ready.push_back(next);
+            }
+        }
+        return sorted;
+    }
+
+    // walks backwards from passes writing imported targets, a pass is needed when a
+    // needed later pass reads something it writes
+    std::vector<bool> findNeededPasses(const std::vector<PassHandle>& sorted) const {
+        std::vector<bool> needed(passes.size(), false);
+        std::vector<bool> resourceNeeded(resources.size(), false);
+
+        for (int i = (int)sorted.size() - 1; i >= 0; i--) {
+            const Pass& pass = passes[sorted[i]];
+            bool keep = false;
+            for (ResourceHandle resource : pass.writes) {
+                if (resources[resource].imported || resourceNeeded[resource])
+                    keep = true;
+            }
+            if (!keep)
+                continue;
+
+            needed[sorted[i]] = true;
+            for (ResourceHandle resource : pass.reads)
+                resourceNeeded[resource] = true;
+            //read-modify-write, whoever wrote it before still has to run
+            for (ResourceHandle resource : pass.writes)
+                resourceNeeded[resource] = true;
+        }
+        return needed;
+    }
+
+    // first and last compiled pass touching each transient decide its lifetime, targets whose
+    // lifetimes don't overlap and whose descs match end up on the same texture
+    void allocateTextures() {
+        std::vector<int> firstUse(resources.size(), -1);
+        std::vector<int> lastUse(resources.size(), -1);
+        for (int i = 0; i < (int)order.size(); i++) {
+            const Pass& pass = passes[order[i]];
+            for (const std::vector<ResourceHandle>* list : { &pass.reads, &pass.writes }) {
+                for (ResourceHandle resource : *list) {
+                    if (firstUse[resource] < 0)
+                        firstUse[resource] = i;
+                    lastUse[resource] = i;
+                }
+            }
+        }
+
+        for (Resource& resource : resources)
+            resource.physical = -1;
+        for (PhysicalTexture& texture : textures)
+            texture.freeAfter = -1;
+
+        for (int i = 0; i < (int)order.size(); i++) {
+            for (size_t r = 0; r < resources.size(); r++) {
+                Resource& resource = resources[r];
+                if (resource.imported || firstUse[r] != i)
+                    continue;
+
+                for (size_t t = 0; t < textures.size(); t++) {
+                    if (textures[t].desc == resource.desc && textures[t].freeAfter < i) {
+                        resource.physical = (int)t;
+                        break;
+                    }
+                }
+
+                if (resource.physical < 0) {
+                    PhysicalTexture texture = { resource.desc, createTexture(resource.desc), -1 };
+                    textures.push_back(texture);
+                    resource.physical = (int)textures.size() - 1;
+                }
+                textures[resource.physical].freeAfter = lastUse[r];
+            }
+        }
+    }
+
+    GLuint createTexture(const RenderTargetDesc& desc) {
+        bool depth = isDepthFormat(desc.internalFormat);
+        GLuint texture;
+        glGenTextures(1, &texture);
+        //through the tracker, so its idea of what unit 0 holds stays true
+        GLState::get().bindTexture(0, GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, desc.internalFormat, desc.width, desc.height, 0,
+            depth ? GL_DEPTH_COMPONENT : GL_RGBA, depth ? GL_FLOAT : GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+
+    void createFramebuffers() {
+        glGenFramebuffers(1, &readFramebuffer);
+
+        std::vector<bool> written(resources.size(), false);
+        for (PassHandle handle : order) {
+            Pass& pass = passes[handle];
+            pass.framebuffer = 0;
+            pass.ownsFramebuffer = false;
+            pass.clearMask = 0;
+            pass.width = 0;
+            pass.height = 0;
+
+            bool backbuffer = false;
+            for (ResourceHandle resource : pass.writes) {
+                if (resources[resource].imported) {
+                    backbuffer = true;
+                    pass.framebuffer = resources[resource].framebuffer;
+                }
+            }
+            if (backbuffer)
+                continue;
+
+            glGenFramebuffers(1, &pass.framebuffer);
+            pass.ownsFramebuffer = true;
+            glBindFramebuffer(GL_FRAMEBUFFER, pass.framebuffer);
+
+            bool hasColor = false;
+            for (ResourceHandle resource : pass.writes) {
+                bool depth = isDepthFormat(resources[resource].desc.internalFormat);
+                glFramebufferTexture2D(GL_FRAMEBUFFER, depth ? GL_DEPTH_ATTACHMENT : GL_COLOR_ATTACHMENT0,
+                    GL_TEXTURE_2D, getTexture(resource), 0);
+                hasColor = hasColor || !depth;
+                pass.width = resources[resource].desc.width;
+                pass.height = resources[resource].desc.height;
+
+                if (!written[resource])
+                    pass.clearMask |= depth ? GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT;
+                written[resource] = true;
+            }
+
+            //depth is also an input for passes that test against it without writing it
+            for (ResourceHandle resource : pass.reads) {
+                if (!resources[resource].imported && isDepthFormat(resources[resource].desc.internalFormat))
+                    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, getTexture(resource), 0);
+            }
+
+            if (!hasColor) {
+                glDrawBuffer(GL_NONE);
+                glReadBuffer(GL_NONE);
+            }
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void releaseGLObjects() {
+        for (Pass& pass : passes) {
+            if (pass.ownsFramebuffer)
+                glDeleteFramebuffers(1, &pass.framebuffer);
+            pass.framebuffer = 0;
+            pass.ownsFramebuffer = false;
+        }
+        //framebuffers aren't cached by GLState, textures bound through it are
+        for (PhysicalTexture& texture : textures)
+            GLState::get().deleteTextures(1, &texture.id);
+        textures.clear();
+        if (readFramebuffer != 0)
+            glDeleteFramebuffers(1, &readFramebuffer);
+        readFramebuffer = 0;
+    }
+
+    std::vector<Resource> resources;
+    std::vector<Pass> passes;
+    std::vector<PassHandle> order;
+    std::vector<PhysicalTexture> textures;
+    GLuint readFramebuffer = 0;
+    unsigned culledPassCount = 0;
+    bool dirty = true;
+};
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <xmmintrin.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+// axis aligned boxes stored as one array per component, so 8 boxes load straight into
+// simd registers. the arrays are padded to a multiple of 8, padding lanes are never reported
+class BoundsSoA {
+public:
+    void clear() {
+        count = 0;
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    size_t add(const glm::vec3& min, const glm::vec3& max) {
+        size_t padded = (count + 8) / 8 * 8;
+        if (minX.size() < padded) {
+            for (std::vector<float>* component : { &minX, &minY, &minZ, &maxX, &maxY, &maxZ })
+                component->resize(padded, 0.0f);
+        }
+
+        minX[count] = min.x;
+        minY[count] = min.y;
+        minZ[count] = min.z;
+        maxX[count] = max.x;
+        maxY[count] = max.y;
+        maxZ[count] = max.z;
+        return count++;
+    }
+
+    glm::vec3 getMin(size_t index) const {
+        return glm::vec3(minX[index], minY[index], minZ[index]);
+    }
+
+    glm::vec3 getMax(size_t index) const {
+        return glm::vec3(maxX[index], maxY[index], maxZ[index]);
+    }
+
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+
+private:
+    size_t count = 0;
+};
+
+// box around a transformed box, center and extent form (arvo) so it's one matrix multiply
+// instead of transforming all 8 corners
+inline void transformBounds(const glm::vec3& min, const glm::vec3& max, const glm::mat4& transform,
+    glm::vec3& outMin, glm::vec3& outMax) {
+    glm::vec3 center = (min + max) * 0.5f;
+    glm::vec3 extent = (max - min) * 0.5f;
+
+    glm::vec3 worldCenter = glm::vec3(transform * glm::vec4(center, 1.0f));
+    glm::vec3 worldExtent;
+    for (int row = 0; row < 3; row++) {
+        worldExtent[row] = std::abs(transform[0][row]) * extent.x + std::abs(transform[1][row]) * extent.y +
+            std::abs(transform[2][row]) * extent.z;
+    }
+
+    outMin = worldCenter - worldExtent;
+    outMax = worldCenter + worldExtent;
+}
+
+// screen size thresholds, sizes are the projected diameter in pixels of the sphere around a box.
+// below cullPixels an object isn't drawn, below impostorPixels it's drawn as an impostor
+struct ScreenSizeLod {
+    glm::vec3 eye;
+    //projection[1][1] times half the viewport height
+    float pixelScale;
+    float cullPixels;
+    float impostorPixels;
+};
+
+// a box around the eye counts as filling the screen
+inline float projectedSize(const glm::vec3& min, const glm::vec3& max, const ScreenSizeLod& lod) {
+    glm::vec3 center = (min + max) * 0.5f;
+    float radius = glm::length(max - min) * 0.5f;
+    float distance = glm::length(center - lod.eye);
+    if (distance <= radius)
+        return FLT_MAX;
+    return radius * 2.0f * lod.pixelScale / distance;
+}
+
+// inward facing planes, xyz is the normal and w the distance
+struct Frustum {
+    glm::vec4 planes[6];
+};
+
+// gribb/hartmann, every plane is the last row of viewProj plus or minus one of the others
+inline Frustum extractFrustum(const glm::mat4& viewProj) {
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+        rows[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+
+    Frustum frustum;
+    frustum.planes[0] = rows[3] + rows[0];
+    frustum.planes[1] = rows[3] - rows[0];
+    frustum.planes[2] = rows[3] + rows[1];
+    frustum.planes[3] = rows[3] - rows[1];
+    frustum.planes[4] = rows[3] + rows[2];
+    frustum.planes[5] = rows[3] - rows[2];
+    for (glm::vec4& plane : frustum.planes)
+        plane /= glm::length(glm::vec3(plane));
+    return frustum;
+}
+
+// a box is outside when its corner furthest along a plane's normal is still behind that plane.
+// the corner's components come from min or max depending on the normal's signs, the same for
+// every box, so each plane is just a multiply-add over whole arrays. one bit per box outside
+inline unsigned outsideMaskSSE(const BoundsSoA& bounds, size_t base, const Frustum& frustum) {
+    __m128 outside = _mm_setzero_ps();
+    for (const glm::vec4& plane : frustum.planes) {
+        const float* x = plane.x >= 0.0f ? &bounds.maxX[base] : &bounds.minX[base];
+        const float* y = plane.y >= 0.0f ? &bounds.maxY[base] : &bounds.minY[base];
+        const float* z = plane.z >= 0.0f ? &bounds.maxZ[base] : &bounds.minZ[base];
+
+        __m128 distance = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(x), _mm_set1_ps(plane.x)), _mm_set1_ps(plane.w));
+        distance = _mm_add_ps(distance, _mm_mul_ps(_mm_loadu_ps(y), _mm_set1_ps(plane.y)));
+        distance = _mm_add_ps(distance, _mm_mul_ps(_mm_loadu_ps(z), _mm_set1_ps(plane.z)));
+        outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, _mm_setzero_ps()));
+    }
+    return (unsigned)_mm_movemask_ps(outside);
+}
+
+#ifdef __AVX__
+inline unsigned outsideMaskAVX(const BoundsSoA& bounds, size_t base, const Frustum& frustum) {
+    __m256 outside = _mm256_setzero_ps();
+    for (const glm::vec4& plane : frustum.planes) {
+        const float* x = plane.x >= 0.0f ? &bounds.maxX[base] : &bounds.minX[base];
+        const float* y = plane.y >= 0.0f ? &bounds.maxY[base] : &bounds.minY[base];
+        const float* z = plane.z >= 0.0f ? &bounds.maxZ[base] : &bounds.minZ[base];
+
+        __m256 distance = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(x), _mm256_set1_ps(plane.x)),
+            _mm256_set1_ps(plane.w));
+        distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_loadu_ps(y), _mm256_set1_ps(plane.y)));
+        distance = _mm256_add_ps(distance, _mm256_mul_ps(_mm256_loadu_ps(z), _mm256_set1_ps(plane.z)));
+        outside = _mm256_or_ps(outside, _mm256_cmp_ps(distance, _mm256_setzero_ps(), _CMP_LT_OQ));
+    }
+    return (unsigned)_mm256_movemask_ps(outside);
+}
+#endif
+
+// tests 8 boxes per iteration (one avx register when built with avx, two sse ones otherwise),
+// visible[i] is 1 for boxes at least partly inside. conservative, a box near a frustum corner
+// can pass without being on screen. returns how many passed
+inline size_t cullBounds(const BoundsSoA& bounds, const Frustum& frustum, std::vector<uint8_t>& visible) {
+    visible.resize(bounds.size());
+    size_t visibleCount = 0;
+
+    for (size_t base = 0; base < bounds.size(); base += 8) {
+#ifdef __AVX__
+        unsigned outside = outsideMaskAVX(bounds, base, frustum);
+#else
+        unsigned outside = outsideMaskSSE(bounds, base, frustum) | (outsideMaskSSE(bounds, base + 4, frustum) << 4);
+#endif
+        size_t end = std::min(base + 8, bounds.size());
+        for (size_t i = base; i < end; i++) {
+            visible[i] = ((outside >> (i - base)) & 1u) == 0;
+            visibleCount += visible[i];
+        }
+    }
+    return visibleCount;
+}
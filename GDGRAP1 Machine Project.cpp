@@ -1,45 +1,124 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/quaternion.hpp>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
+#include "DrawMatrices.h"
+#include "GLState.h"
+#include "RenderQueue.h"
+#include "MeshArena.h"
+#include "JobSystem.h"
+#include "CommandBuffer.h"
+#include "FrameGraph.h"
+#include "GpuTimer.h"
+#include "RingBuffer.h"
+#include "HeadlessContext.h"
+#include "FrustumCulling.h"
+#include "SceneBVH.h"
+#include "OcclusionBuffer.h"
+#include "OcclusionQueries.h"
+#include "GpuCulling.h"
+#include "Impostor.h"
+#include "SpatialHash.h"
+#include "EntityStore.h"
+#include "TransformHierarchy.h"
+#include "SimulationClock.h"
+#include "EnemyAI.h"
+#include "FishSchool.h"
+#include "Collision.h"
+#include "MeshBVH.h"
 #include <string>
 #include <iostream>
+#include <cstring>
+#include <array>
+#include <algorithm>
+#include <unordered_map>
+#include <chrono>
+#include <random>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <cfloat>
 
-float translate_x_mod = 0.f;
-float translate_y_mod = 0.f;
-float rotate_x_mod = 0.f;
-float rotate_y_mod = 1.f;
-float scale_mod = 1.f;
-float zoom_mod = -5.f;
 int activeModelIndex = 0;
 
+// keys that steer the Controlled entities
+enum ControlKey {
+    CONTROL_UP,
+    CONTROL_DOWN,
+    CONTROL_LEFT,
+    CONTROL_RIGHT,
+    CONTROL_FORWARD,
+    CONTROL_BACK,
+    CONTROL_YAW_LEFT,
+    CONTROL_YAW_RIGHT,
+    CONTROL_PITCH_UP,
+    CONTROL_PITCH_DOWN,
+    CONTROL_SHRINK,
+    CONTROL_GROW,
+    CONTROL_KEY_COUNT
+};
+//held down right now, set by Key_Callback and read every simulation step (maybe on its own thread)
+std::atomic<bool> control_held[CONTROL_KEY_COUNT];
+//toggled with T, the simulation steps on a thread of its own instead of between frames
+bool sim_thread_enabled = false;
+//toggled with P, depth only prepass followed by a GL_EQUAL shading pass
+bool depth_prepass_enabled = false;
+//toggled with O, fleet subs hidden behind the scene models are never submitted
+bool occlusion_culling_enabled = true;
+//toggled with G, the fleet is culled and compacted by compute shaders when the gl has them
+bool gpu_culling_enabled = true;
+//toggled with I, fleet subs small on screen are drawn as octahedral impostors
+bool impostors_enabled = true;
+
+// how a submesh's material has to be rendered
+enum MaterialClass {
+    MATERIAL_OPAQUE,
+    //cut out with discard, still writes depth
+    MATERIAL_ALPHA_TESTED,
+    //drawn last with blending, back to front
+    MATERIAL_BLENDED,
+    MATERIAL_CLASS_COUNT
+};
+
+// blended when the mtl asks for transparency (dissolve, a glass illum model or a glass
+// material name), alpha tested when it has an alpha mask, opaque otherwise
+MaterialClass classifyMaterial(const tinyobj::material_t& material) {
+    std::string name = material.name;
+    std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+
+    bool glassIllum = material.illum == 4 || material.illum == 6 || material.illum == 7 || material.illum == 9;
+    if (material.dissolve < 1.0f || glassIllum || name.find("glass") != std::string::npos)
+        return MATERIAL_BLENDED;
+    if (!material.alpha_texname.empty())
+        return MATERIAL_ALPHA_TESTED;
+    return MATERIAL_OPAQUE;
+}
+
 class Model {
 public:
-    Model(const std::string& path) {
+    // faces sharing a material, one arena mesh each
+    struct Submesh {
+        MeshArena::MeshHandle mesh;
+        GLsizei indexCount;
+        MaterialClass materialClass;
+        float opacity;
+    };
+
+    // geometry is sub-allocated from the shared arena instead of a private vao/vbo
+    Model(const std::string& path, MeshArena& arena) : arena(arena), instanceUpload(arena) {
         loadModel(path);
         initializeBuffers();
     }
 
-    void setPosition(float posX, float posY, float posZ) {
-        position = glm::vec3(posX, posY, posZ);
-    }
-
-    void setRotation(float rotX, float rotY, float rotZ) {
-        rotation = glm::vec3(rotX, rotY, rotZ);
-    }
-
-    void setScale(float scaleX, float scaleY, float scaleZ) {
-        scale = glm::vec3(scaleX, scaleY, scaleZ);
-    }
-
-    void initializeVertexData() {
-        for (int i = 0; i < shapes[0].mesh.indices.size(); i++) {
-            tinyobj::index_t vData = shapes[0].mesh.indices[i];
+    void initializeVertexData(const std::vector<tinyobj::index_t>& corners) {
+        for (size_t i = 0; i < corners.size(); i++) {
+            tinyobj::index_t vData = corners[i];
 
             // Push x, y, z positions
             fullVertexData.push_back(attributes.vertices[vData.vertex_index * 3]);
@@ -66,9 +145,104 @@ public:
     }
 
     void draw() {
-        glBindVertexArray(VAO);
-        glDrawArrays(GL_TRIANGLES, 0, fullVertexData.size() / 14);
-        glBindVertexArray(0);
+        //every model shares the arena's vao, the state tracker skips the bind after the first draw
+        for (const Submesh& submesh : submeshes)
+            arena.draw(arena.getCommand(submesh.mesh));
+    }
+
+    // upload this frame's instances, see InstanceUpload
+    void setInstances(const InstanceData* instances, size_t count) {
+        instanceUpload.set(instances, count);
+    }
+
+    // draws every instance from setInstances in one call, needs a shader built with INSTANCED
+    void drawInstanced() {
+        if (instanceUpload.getCount() == 0)
+            return;
+        arena.bindInstanceBuffer(instanceUpload.getBuffer());
+        for (size_t i = 0; i < submeshes.size(); i++)
+            arena.drawInstanced(getInstancedDrawCommand(i));
+    }
+
+    const std::vector<Submesh>& getSubmeshes() const {
+        return submeshes;
+    }
+
+    // indirect command for batching a submesh into MeshArena::multiDraw or a command buffer
+    DrawElementsIndirectCommand getDrawCommand(size_t submesh, GLuint instances = 1) const {
+        return arena.getCommand(submeshes[submesh].mesh, instances);
+    }
+
+    // every instance from setInstances, for drawing with getInstanceBuffer bound
+    DrawElementsIndirectCommand getInstancedDrawCommand(size_t submesh) const {
+        DrawElementsIndirectCommand command = arena.getCommand(submeshes[submesh].mesh, instanceUpload.getCount());
+        command.baseInstance = instanceUpload.getBase();
+        return command;
+    }
+
+    // the instances were culled on the gpu after setInstances: draws read the survivors from
+    // buffer and their instance counts from indirect, one command per submesh
+    void setCulledInstances(GLuint buffer, GLuint indirect) {
+        instanceUpload.setCulled(buffer, indirect);
+    }
+
+    GLuint getInstanceBuffer() const {
+        return instanceUpload.getBuffer();
+    }
+
+    // where setInstances put the first instance in getInstanceBuffer
+    GLuint getInstanceBase() const {
+        return instanceUpload.getBase();
+    }
+
+    // 0 unless setCulledInstances was called since the last setInstances
+    GLuint getIndirectBuffer() const {
+        return instanceUpload.getIndirectBuffer();
+    }
+
+    GLuint getInstanceCount() const {
+        return instanceUpload.getCount();
+    }
+
+    // identifies the submesh in render queue sort keys
+    GLuint getMeshID(size_t submesh) const {
+        return submeshes[submesh].mesh;
+    }
+
+    GLsizei getIndexCount() const {
+        GLsizei count = 0;
+        for (const Submesh& submesh : submeshes)
+            count += submesh.indexCount;
+        return count;
+    }
+
+    // object space box of every submesh, in submesh order
+    const BoundsSoA& getSubmeshBounds() const {
+        return submeshBounds;
+    }
+
+    // object space box around the whole model
+    const glm::vec3& getBoundsMin() const {
+        return boundsMin;
+    }
+
+    const glm::vec3& getBoundsMax() const {
+        return boundsMax;
+    }
+
+    // cpu copy of the opaque submeshes for the occlusion rasterizer, glass and alpha tested
+    // parts don't hide anything
+    const std::vector<glm::vec3>& getOccluderPositions() const {
+        return occluderPositions;
+    }
+
+    const std::vector<uint32_t>& getOccluderIndices() const {
+        return occluderIndices;
+    }
+
+    // every submesh's triangles, in submesh order, for raycasts
+    const MeshBVH& getBVH() const {
+        return bvh;
     }
 
 
@@ -91,13 +265,13 @@ private:
         }
     }
 
-    void extractTangentsAndBitangents() {
+    void extractTangentsAndBitangents(const std::vector<tinyobj::index_t>& corners) {
 
-        for (int i = 0; i < shapes[0].mesh.indices.size(); i += 3) {
+        for (size_t i = 0; i < corners.size(); i += 3) {
             //get vertex data for triangle
-            tinyobj::index_t vData1 = shapes[0].mesh.indices[i];
-            tinyobj::index_t vData2 = shapes[0].mesh.indices[i + 1];
-            tinyobj::index_t vData3 = shapes[0].mesh.indices[i + 2];
+            tinyobj::index_t vData1 = corners[i];
+            tinyobj::index_t vData2 = corners[i + 1];
+            tinyobj::index_t vData3 = corners[i + 2];
 
             //position of vertex 1
             glm::vec3 v1 = glm::vec3(
@@ -163,107 +337,125 @@ private:
         }
     }
 
-    void initializeBuffers() {
-        // Call extractTangentsAndBitangents to populate tangents and bitangents
-        extractTangentsAndBitangents();
-        // Initialize vertex data
-        initializeVertexData();
-        // Generate VAO and VBO IDs
-        glGenVertexArrays(1, &VAO);
-        glGenBuffers(1, &VBO);
-
-        // Bind the VAO
-        glBindVertexArray(VAO);
-
-        // Bind the VBO and send vertex data to the GPU
-        glBindBuffer(GL_ARRAY_BUFFER, VBO);
-        glBufferData(GL_ARRAY_BUFFER, sizeof(GLfloat) * fullVertexData.size(), fullVertexData.data(), GL_DYNAMIC_DRAW);
-
-        // Specify vertex attributes layout
-        glVertexAttribPointer(
-            0, //vertex position
-            3, // x y z
-            GL_FLOAT, //data type of array
-            GL_FALSE,
-            //vertex data has 8 floats
-            //X,Y,Z,3 normals, U,V
-            14 * sizeof(float), //size of vertex data in bytes
-            (void*)0
-        );
-        //enable vertices, this time for skybox
-        glEnableVertexAttribArray(0);
-
-        //normal starts at index 3
-        GLintptr normalPtr = 3 * sizeof(float);
-
-        glVertexAttribPointer(
-            1, //normals
-            3, // x y z
-            GL_FLOAT, //data type of array
-            GL_FALSE,
-            //vertex data has 8 floats
-            //X,Y,Z,3 normals, U,V
-            14 * sizeof(float), //size of vertex data in bytes
-            (void*)normalPtr
-        );
-        //enable normals
-        glEnableVertexAttribArray(1);
-
-        //uv starts at index 6
-        GLintptr uvPtr = 6 * sizeof(float);
-
-        //get uv data from array
-        glVertexAttribPointer(
-            2, //uv coords
-            2, // u v
-            GL_FLOAT, //data type of array
-            GL_FALSE,
-            //vertex data has 8 floats
-            //X,Y,Z,3 normals, U,V
-            14 * sizeof(float), //size of vertex data in bytes
-            //offset
-            (void*)uvPtr
-        );
+    struct VertexHash {
+        size_t operator()(const std::array<GLfloat, 14>& vertex) const {
+            //fnv-1a over the raw bytes
+            const unsigned char* bytes = reinterpret_cast<const unsigned char*>(vertex.data());
+            size_t hash = 2166136261u;
+            for (size_t i = 0; i < sizeof(GLfloat) * 14; i++) {
+                hash ^= bytes[i];
+                hash *= 16777619u;
+            }
+            return hash;
+        }
+    };
 
-        //enable textures
-        glEnableVertexAttribArray(2);
+    // weld identical vertices and build the index buffer, needed for glDrawElementsInstanced
+    void buildIndices() {
+        std::vector<GLfloat> welded;
+        std::unordered_map<std::array<GLfloat, 14>, GLuint, VertexHash> lookup;
+        size_t vertexCount = fullVertexData.size() / 14;
+        indices.reserve(vertexCount);
+
+        for (size_t i = 0; i < vertexCount; i++) {
+            std::array<GLfloat, 14> vertex;
+            std::copy(fullVertexData.begin() + i * 14, fullVertexData.begin() + (i + 1) * 14, vertex.begin());
+
+            auto found = lookup.find(vertex);
+            if (found != lookup.end()) {
+                indices.push_back(found->second);
+                continue;
+            }
+
+            GLuint index = (GLuint)(welded.size() / 14);
+            welded.insert(welded.end(), vertex.begin(), vertex.end());
+            lookup.emplace(vertex, index);
+            indices.push_back(index);
+        }
 
-        //tangent starts at index 8
-        GLintptr tangentPtr = 8 * sizeof(float);
+        fullVertexData.swap(welded);
+    }
 
-        glVertexAttribPointer(
-            3, //tangent
-            3, // T (xyz)
-            GL_FLOAT, //data type of array
-            GL_FALSE,
-            14 * sizeof(float), //size of vertex data in bytes
-            //offset
-            (void*)tangentPtr
-        );
-        //enable tangent
-        glEnableVertexAttribArray(3);
-
-        //bitangent starts at index 11
-        GLintptr bitangentPtr = 11 * sizeof(float);
-
-        glVertexAttribPointer(
-            4, //bitangent
-            3, // T (xyz)
-            GL_FLOAT, //data type of array
-            GL_FALSE,
-            14 * sizeof(float), //size of vertex data in bytes
-            //offset
-            (void*)bitangentPtr
-        );
-        //enable bitangent
-        glEnableVertexAttribArray(4);
+    // box around the welded vertices of the submesh just built
+    void addSubmeshBounds() {
+        glm::vec3 min(FLT_MAX), max(-FLT_MAX);
+        for (size_t i = 0; i < fullVertexData.size(); i += 14) {
+            glm::vec3 position(fullVertexData[i], fullVertexData[i + 1], fullVertexData[i + 2]);
+            min = glm::min(min, position);
+            max = glm::max(max, position);
+        }
+        submeshBounds.add(min, max);
 
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
+        boundsMin = glm::min(boundsMin, min);
+        boundsMax = glm::max(boundsMax, max);
+    }
 
-        // Unbind the VBO and VAO
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
+    void initializeBuffers() {
+        std::vector<glm::vec3> rayPositions;
+        std::vector<uint32_t> rayIndices;
+        //triangle corners of every shape, grouped by material in order of first use
+        std::vector<int> groupMaterials;
+        std::vector<std::vector<tinyobj::index_t>> groups;
+        for (const tinyobj::shape_t& shape : shapes) {
+            for (size_t face = 0; face < shape.mesh.indices.size() / 3; face++) {
+                int materialID = face < shape.mesh.material_ids.size() ? shape.mesh.material_ids[face] : -1;
+
+                size_t group = std::find(groupMaterials.begin(), groupMaterials.end(), materialID) - groupMaterials.begin();
+                if (group == groupMaterials.size()) {
+                    groupMaterials.push_back(materialID);
+                    groups.emplace_back();
+                }
+                groups[group].insert(groups[group].end(), shape.mesh.indices.begin() + face * 3,
+                    shape.mesh.indices.begin() + face * 3 + 3);
+            }
+        }
+
+        for (size_t group = 0; group < groups.size(); group++) {
+            tangents.clear();
+            bitangents.clear();
+            fullVertexData.clear();
+            indices.clear();
+
+            // Call extractTangentsAndBitangents to populate tangents and bitangents
+            extractTangentsAndBitangents(groups[group]);
+            // Initialize vertex data
+            initializeVertexData(groups[group]);
+            buildIndices();
+            addSubmeshBounds();
+
+            Submesh submesh;
+            // Sub-allocate from the arena and upload, the arena's vao already has the vertex layout
+            submesh.mesh = arena.add(fullVertexData.data(), (GLuint)(fullVertexData.size() / 14),
+                indices.data(), (GLuint)indices.size());
+            submesh.indexCount = (GLsizei)indices.size();
+            submesh.materialClass = MATERIAL_OPAQUE;
+            submesh.opacity = 1.0f;
+
+            int materialID = groupMaterials[group];
+            if (materialID >= 0 && materialID < (int)material.size()) {
+                submesh.materialClass = classifyMaterial(material[materialID]);
+                //glass that doesn't set its own dissolve still needs to be see through
+                float dissolve = material[materialID].dissolve;
+                if (submesh.materialClass == MATERIAL_BLENDED)
+                    submesh.opacity = dissolve < 1.0f ? dissolve : 0.4f;
+            }
+            submeshes.push_back(submesh);
+
+            if (submesh.materialClass == MATERIAL_OPAQUE) {
+                uint32_t base = (uint32_t)occluderPositions.size();
+                for (size_t i = 0; i < fullVertexData.size(); i += 14)
+                    occluderPositions.push_back(glm::vec3(fullVertexData[i], fullVertexData[i + 1], fullVertexData[i + 2]));
+                for (GLuint index : indices)
+                    occluderIndices.push_back(base + index);
+            }
+
+            uint32_t rayBase = (uint32_t)rayPositions.size();
+            for (size_t i = 0; i < fullVertexData.size(); i += 14)
+                rayPositions.push_back(glm::vec3(fullVertexData[i], fullVertexData[i + 1], fullVertexData[i + 2]));
+            for (GLuint index : indices)
+                rayIndices.push_back(rayBase + index);
+        }
+        bvh.build(rayPositions, rayIndices);
     }
 
 
@@ -271,22 +463,29 @@ private:
     std::vector<tinyobj::material_t> material;
     tinyobj::attrib_t attributes;
     std::vector<GLfloat> fullVertexData;
+    std::vector<GLuint> indices;
     std::vector<glm::vec3> tangents;
     std::vector<glm::vec3> bitangents;
 
-    glm::vec3 position;
-    glm::vec3 rotation;
-    glm::vec3 scale;
+    MeshArena& arena;
+    std::vector<Submesh> submeshes;
+    BoundsSoA submeshBounds;
+    std::vector<glm::vec3> occluderPositions;
+    std::vector<uint32_t> occluderIndices;
+    MeshBVH bvh;
+    glm::vec3 boundsMin = glm::vec3(FLT_MAX);
+    glm::vec3 boundsMax = glm::vec3(-FLT_MAX);
 
-    GLuint VAO, VBO;
+    InstanceUpload instanceUpload;
     
 };
 
 class Shader {
 public:
-    Shader(const std::string& vertexPath, const std::string& fragmentPath) {
-        vertexCode = readFile(vertexPath);
-        fragmentCode = readFile(fragmentPath);
+    // defines are injected right after the #version line, e.g. "#define PER_VERTEX_MATRICES\n"
+    Shader(const std::string& vertexPath, const std::string& fragmentPath, const std::string& defines = "") {
+        vertexCode = injectDefines(readFile(vertexPath), defines);
+        fragmentCode = injectDefines(readFile(fragmentPath), defines);
 
         const char* vShaderCode = vertexCode.c_str();
         const char* fShaderCode = fragmentCode.c_str();
@@ -330,11 +529,38 @@ public:
         // Delete the shaders as they're linked into our program now and no longer necessary
         //glDeleteShader(vertex);
         //glDeleteShader(fragment);
+
+        // Look the uniforms up once, command buffers are recorded off the gl thread
+        uniforms.mvp = glGetUniformLocation(ID, "mvp");
+        uniforms.transform = glGetUniformLocation(ID, "transform");
+        uniforms.normalMatrix = glGetUniformLocation(ID, "normalMatrix");
+        uniforms.viewProj = glGetUniformLocation(ID, "viewProj");
+        uniforms.lightPos = glGetUniformLocation(ID, "lightPos");
+        uniforms.lightColor = glGetUniformLocation(ID, "lightColor");
+        uniforms.ambientStr = glGetUniformLocation(ID, "ambientStr");
+        uniforms.ambientColor = glGetUniformLocation(ID, "ambientColor");
+        uniforms.cameraPos = glGetUniformLocation(ID, "cameraPos");
+        uniforms.specStr = glGetUniformLocation(ID, "specStr");
+        uniforms.specPhong = glGetUniformLocation(ID, "specPhong");
+        uniforms.opacity = glGetUniformLocation(ID, "opacity");
+    }
+
+    // uniform locations, -1 when the variant doesn't use them
+    struct UniformLocations {
+        GLint mvp, transform, normalMatrix, viewProj;
+        GLint lightPos, lightColor, ambientStr, ambientColor, cameraPos, specStr, specPhong;
+        GLint opacity;
+    };
+
+    UniformLocations uniforms;
+
+    GLuint getID() const {
+        return ID;
     }
 
-    // Use the shader
+    // Use the shader, skipped by the state tracker when it is already bound
     void use() {
-        glUseProgram(ID);
+        GLState::get().useProgram(ID);
     }
 
     // Set projection matrix uniform
@@ -352,14 +578,43 @@ public:
         glUniformMatrix4fv(glGetUniformLocation(ID, "transform"), 1, GL_FALSE, glm::value_ptr(transformation_matrix));
     }
 
-    // Set texture uniforms
-    void setTextureUniforms(GLuint texture, GLuint norm_tex) const {
+    // Set mvp, model and normal matrix uniforms computed on the cpu
+    void setDrawMatrices(const DrawMatrices& matrices) const {
+        glUniformMatrix4fv(glGetUniformLocation(ID, "mvp"), 1, GL_FALSE, glm::value_ptr(matrices.mvp));
+        glUniformMatrix4fv(glGetUniformLocation(ID, "transform"), 1, GL_FALSE, glm::value_ptr(matrices.model));
+        glUniformMatrix3fv(glGetUniformLocation(ID, "normalMatrix"), 1, GL_FALSE, glm::value_ptr(matrices.normal));
+    }
+
+    // Set projection * view for the instanced path, the instance supplies the model matrix
+    void setViewProjMatrix(const glm::mat4& viewProjMatrix) const {
+        glUniformMatrix4fv(glGetUniformLocation(ID, "viewProj"), 1, GL_FALSE, glm::value_ptr(viewProjMatrix));
+    }
+
+    // Set the tint per instance material index (instanced path only)
+    void setMaterialTints(const std::vector<glm::vec3>& tints) {
+        use();
+        glUniform3fv(glGetUniformLocation(ID, "materialTint"), (GLsizei)tints.size(), glm::value_ptr(tints[0]));
+    }
+
+    // Set the sphere and atlas layout the impostor was baked with (impostor shader only)
+    void setImpostor(const Impostor& impostor) {
+        use();
+        glUniform3fv(glGetUniformLocation(ID, "impostorCenter"), 1, glm::value_ptr(impostor.getCenter()));
+        glUniform1f(glGetUniformLocation(ID, "impostorRadius"), impostor.getRadius());
+        glUniform1i(glGetUniformLocation(ID, "impostorFrames"), Impostor::FRAMES);
+    }
+
+    // Set sampler units, they live in the program so once after creation is enough
+    void setSamplerUnits() {
+        use();
         glUniform1i(glGetUniformLocation(ID, "tex0"), 0);
         glUniform1i(glGetUniformLocation(ID, "norm_tex"), 1);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, texture);
-        glActiveTexture(GL_TEXTURE1);
-        glBindTexture(GL_TEXTURE_2D, norm_tex);
+    }
+
+    // Bind diffuse and normal textures to the units set in setSamplerUnits
+    void setTextureUniforms(GLuint texture, GLuint norm_tex) const {
+        GLState::get().bindTexture(0, GL_TEXTURE_2D, texture);
+        GLState::get().bindTexture(1, GL_TEXTURE_2D, norm_tex);
     }
 
     // Set lighting uniforms
@@ -387,6 +642,17 @@ private:
         file.close();
         return stream.str();
     }
+
+    std::string injectDefines(const std::string& source, const std::string& defines) {
+        if (defines.empty())
+            return source;
+
+        //#version has to stay the first line
+        size_t lineEnd = source.find('\n');
+        if (lineEnd == std::string::npos)
+            return source + "\n" + defines;
+        return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+    }
 };
 
 class Camera {
@@ -488,6 +754,137 @@ private:
     float zoom;
 };
 
+// components of the scene's entities, see EntityStore
+// relative to the parent for entities in the hierarchy
+struct Transform {
+    glm::vec3 position;
+    glm::quat rotation;
+    glm::vec3 scale;
+};
+
+// the entity's node in the TransformHierarchy, which holds its world matrix
+struct HierarchyNode {
+    uint32_t node;
+};
+
+struct Velocity {
+    glm::vec3 linear;
+    //radians per second about each axis
+    glm::vec3 angular;
+};
+
+// drawn with model's submeshes. instanced ones are gathered into one instanced draw per model
+struct Renderable {
+    Model* model;
+    int material;
+    bool instanced;
+};
+
+// a point light, the shaders take the first one
+struct Light {
+    glm::vec3 color;
+    float ambientStr;
+    glm::vec3 ambientColor;
+    float specStr;
+    float specPhong;
+};
+
+// moved by the keyboard
+struct Controlled {
+};
+
+// the hierarchy's transforms after one simulation step, rendering blends the last two
+struct TransformSnapshot {
+    std::vector<uint32_t> nodes;
+    std::vector<Transform> transforms;
+    //wall clock seconds when it was taken
+    double time = 0.0;
+};
+
+// held keys become the controlled entities' velocities, the scale keys act on the scale directly
+void applyControls(EntityStore& entities, float seconds) {
+    auto axis = [](ControlKey negative, ControlKey positive) {
+        return (control_held[positive] ? 1.0f : 0.0f) - (control_held[negative] ? 1.0f : 0.0f);
+    };
+    //roughly what the old fixed nudges per key repeat added up to
+    const float moveSpeed = 7.5f;
+    const float turnSpeed = glm::radians(180.0f);
+    const float scaleSpeed = 2.0f;
+
+    glm::vec3 move = glm::vec3(axis(CONTROL_LEFT, CONTROL_RIGHT), axis(CONTROL_DOWN, CONTROL_UP),
+        axis(CONTROL_BACK, CONTROL_FORWARD)) * moveSpeed;
+    float yaw = axis(CONTROL_YAW_LEFT, CONTROL_YAW_RIGHT) * turnSpeed;
+    float pitch = axis(CONTROL_PITCH_DOWN, CONTROL_PITCH_UP) * turnSpeed;
+    float grow = axis(CONTROL_SHRINK, CONTROL_GROW) * scaleSpeed * seconds;
+
+    entities.forEachArray<Transform, Velocity, Controlled>([&](size_t count, const Entity*, Transform* transforms,
+        Velocity* velocities, Controlled*) {
+        for (size_t i = 0; i < count; i++) {
+            velocities[i].linear = move;
+            //yaw about world up, pitch about the entity's own x axis
+            velocities[i].angular = glm::vec3(0.0f, yaw, 0.0f) + transforms[i].rotation * glm::vec3(pitch, 0.0f, 0.0f);
+            //the hull has always been stretched in x and y only
+            transforms[i].scale += glm::vec3(grow, grow, 0.0f);
+        }
+    });
+}
+
+void integrateVelocities(EntityStore& entities, float seconds) {
+    entities.forEachArray<Transform, Velocity>([&](size_t count, const Entity*, Transform* transforms, Velocity* velocities) {
+        for (size_t i = 0; i < count; i++) {
+            transforms[i].position += velocities[i].linear * seconds;
+            float angle = glm::length(velocities[i].angular) * seconds;
+            if (angle > 0.0f) {
+                glm::quat spin = glm::angleAxis(angle, glm::normalize(velocities[i].angular));
+                transforms[i].rotation = glm::normalize(spin * transforms[i].rotation);
+            }
+        }
+    });
+}
+
+// pushes overlapping entities apart along their contacts' normals, evenly when both move.
+// positions only, the controls and the ai set velocities afresh every step anyway
+void separateContacts(EntityStore& entities, const std::vector<Contact>& contacts) {
+    for (const Contact& contact : contacts) {
+        bool movesA = entities.has<Velocity>(contact.a), movesB = entities.has<Velocity>(contact.b);
+        if (!movesA && !movesB)
+            continue;
+        float shareA = movesA ? (movesB ? 0.5f : 1.0f) : 0.0f;
+        entities.get<Transform>(contact.a).position -= contact.normal * contact.depth * shareA;
+        entities.get<Transform>(contact.b).position += contact.normal * contact.depth * (1.0f - shareA);
+    }
+}
+
+void captureSnapshot(EntityStore& entities, TransformSnapshot& snapshot, double time) {
+    snapshot.nodes.clear();
+    snapshot.transforms.clear();
+    entities.forEachArray<Transform, HierarchyNode>([&](size_t count, const Entity*, Transform* transforms,
+        HierarchyNode* nodes) {
+        for (size_t i = 0; i < count; i++) {
+            snapshot.nodes.push_back(nodes[i].node);
+            snapshot.transforms.push_back(transforms[i]);
+        }
+    });
+    snapshot.time = time;
+}
+
+// hands the blend alpha of the way from previous to current to the hierarchy, which only
+// recomputes what moved and its children on its next update
+void syncHierarchy(const TransformSnapshot& previous, const TransformSnapshot& current, float alpha,
+    TransformHierarchy& hierarchy) {
+    //entities came or went between the two, nothing to blend from
+    bool blend = previous.nodes == current.nodes;
+    for (size_t i = 0; i < current.nodes.size(); i++) {
+        const Transform& to = current.transforms[i];
+        if (!blend) {
+            hierarchy.setLocal(current.nodes[i], to.position, to.rotation, to.scale);
+            continue;
+        }
+        const Transform& from = previous.transforms[i];
+        hierarchy.setLocal(current.nodes[i], glm::mix(from.position, to.position, alpha),
+            glm::slerp(from.rotation, to.rotation, alpha), glm::mix(from.scale, to.scale, alpha));
+    }
+}
 
 void Key_Callback(GLFWwindow * window,
     int key, //keycode of press
@@ -496,96 +893,903 @@ void Key_Callback(GLFWwindow * window,
     int mods) //modifier keys
 {
 
-    if (key == GLFW_KEY_W &&
-        (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-        //move bunny up
-        translate_y_mod += 0.25f;
+    if (key == GLFW_KEY_W && action != GLFW_REPEAT) {
+        //move bunny up while held
+        control_held[CONTROL_UP] = action == GLFW_PRESS;
     }
 
-    if (key == GLFW_KEY_S &&
-        (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-        //move bunny down
-        translate_y_mod -= 0.25f;
+    if (key == GLFW_KEY_S && action != GLFW_REPEAT) {
+        //move bunny down while held
+        control_held[CONTROL_DOWN] = action == GLFW_PRESS;
     }
 
-    if (key == GLFW_KEY_D &&
-        (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-        //move bunny right
-        translate_x_mod += 0.25f;
+    if (key == GLFW_KEY_D && action != GLFW_REPEAT) {
+        //move bunny right while held
+        control_held[CONTROL_RIGHT] = action == GLFW_PRESS;
     }
 
-    if (key == GLFW_KEY_A &&
-        (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-        //move bunny left
-        translate_x_mod -= 0.25f;
+    if (key == GLFW_KEY_A && action != GLFW_REPEAT) {
+        //move bunny left while held
+        control_held[CONTROL_LEFT] = action == GLFW_PRESS;
     }
 
-    if (key == GLFW_KEY_RIGHT &&
-        (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-        //rotate bunny to right
-        rotate_x_mod += 15.f;
+    if (key == GLFW_KEY_RIGHT && action != GLFW_REPEAT) {
+        //rotate bunny to right while held
+        control_held[CONTROL_YAW_RIGHT] = action == GLFW_PRESS;
     }
-    if (key == GLFW_KEY_LEFT &&
-        (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-        //rotate bunny to left
-        rotate_x_mod -= 15.f;
+    if (key == GLFW_KEY_LEFT && action != GLFW_REPEAT) {
+        //rotate bunny to left while held
+        control_held[CONTROL_YAW_LEFT] = action == GLFW_PRESS;
     }
-    if (key == GLFW_KEY_UP &&
-        (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-        //rotate bunny up
-        rotate_y_mod += 15.f;
+    if (key == GLFW_KEY_UP && action != GLFW_REPEAT) {
+        //rotate bunny up while held
+        control_held[CONTROL_PITCH_UP] = action == GLFW_PRESS;
     }
 
-    if (key == GLFW_KEY_DOWN &&
-        (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-        //rotate bunny down
-        rotate_y_mod -= 15.f;
+    if (key == GLFW_KEY_DOWN && action != GLFW_REPEAT) {
+        //rotate bunny down while held
+        control_held[CONTROL_PITCH_DOWN] = action == GLFW_PRESS;
     }
-    if (key == GLFW_KEY_Q &&
-        (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-        //decrease scale
-        scale_mod -= 0.5f;
+    if (key == GLFW_KEY_Q && action != GLFW_REPEAT) {
+        //decrease scale while held
+        control_held[CONTROL_SHRINK] = action == GLFW_PRESS;
     }
-    if (key == GLFW_KEY_E &&
-        (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-        //increase scale
-        scale_mod += 0.5f;
+    if (key == GLFW_KEY_E && action != GLFW_REPEAT) {
+        //increase scale while held
+        control_held[CONTROL_GROW] = action == GLFW_PRESS;
     }
-    if (key == GLFW_KEY_Z &&
-        (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-        //zoom bunny in
-        zoom_mod += 0.30f;
+    if (key == GLFW_KEY_Z && action != GLFW_REPEAT) {
+        //zoom bunny in while held
+        control_held[CONTROL_FORWARD] = action == GLFW_PRESS;
     }
 
-    if (key == GLFW_KEY_X &&
-        (action == GLFW_PRESS || action == GLFW_REPEAT)) {
-        //zoom bunny out
-        zoom_mod -= 0.30f;
+    if (key == GLFW_KEY_X && action != GLFW_REPEAT) {
+        //zoom bunny out while held
+        control_held[CONTROL_BACK] = action == GLFW_PRESS;
+    }
+
+    if (key == GLFW_KEY_P && action == GLFW_PRESS) {
+        //toggle depth prepass
+        depth_prepass_enabled = !depth_prepass_enabled;
+    }
+
+    if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+        //toggle software occlusion culling
+        occlusion_culling_enabled = !occlusion_culling_enabled;
+    }
+
+    if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+        //toggle gpu culling of the fleet
+        gpu_culling_enabled = !gpu_culling_enabled;
+    }
+
+    if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+        //toggle impostors for distant fleet subs
+        impostors_enabled = !impostors_enabled;
+    }
+
+    if (key == GLFW_KEY_T && action == GLFW_PRESS) {
+        //toggle the simulation thread
+        sim_thread_enabled = !sim_thread_enabled;
+    }
+}
+
+// one entry per draw submitted to the render queue
+struct DrawItem {
+    enum Kind {
+        SKYBOX,
+        MESH,
+        //blended submeshes are drawn one at a time, never merged into a multi draw
+        BLENDED_MESH,
+        INSTANCED,
+        //every impostor instance in one draw, model is null
+        IMPOSTOR,
+        //every fish in one draw from the fish mesh's own vao, model is null
+        FISH
+    };
+
+    Kind kind;
+    Model* model;
+    unsigned submesh;
+    Shader* shader;
+    GLuint texture;
+    GLuint normalTexture;
+    float opacity;
+    DrawMatrices matrices;
+    //OcclusionQueries query the draw is conditioned on, 0 draws unconditionally
+    GLuint condition;
+    const Impostor* impostor;
+    const FishMesh* fish;
+};
+
+// view space distance of the object's origin divided by the far plane, for sort keys
+float viewDepth01(const glm::mat4& view, const glm::mat4& model, float farPlane) {
+    glm::vec4 viewPos = view * model[3];
+    return -viewPos.z / farPlane;
+}
+
+// everything recordDraws needs for one frame, read only while the workers record
+struct FrameContext {
+    const std::vector<DrawItem>* drawItems;
+    MeshArena* arena;
+    bool multiDraw;
+
+    //position only variants for the depth prepass
+    const Shader* depthShader;
+    const Shader* depthInstancedShader;
+
+    glm::mat4 viewProj;
+    glm::mat4 projection;
+    glm::mat4 skyView;
+    GLuint skyProgram;
+    GLuint skyVAO;
+    GLint skyViewLoc;
+    GLint skyProjLoc;
+
+    glm::vec3 lightPos;
+    glm::vec3 lightColor;
+    float ambientStr;
+    glm::vec3 ambientColor;
+    glm::vec3 cameraPos;
+    float specStr;
+    float specPhong;
+};
+
+// records the sorted draws [begin, end) into commands. no gl calls, so any thread can run it;
+// per frame uniforms are recorded again at every program change within the slice
+void recordDraws(const FrameContext& frame, const std::vector<RenderQueue::Item>& queued,
+    size_t begin, size_t end, CommandBuffer& commands) {
+    const std::vector<DrawItem>& drawItems = *frame.drawItems;
+    const Shader* currentShader = nullptr;
+    std::vector<DrawElementsIndirectCommand> multiDrawCommands;
+    std::vector<MultiDrawData> multiDrawData;
+
+    for (size_t i = begin; i < end; i++) {
+        const DrawItem& draw = drawItems[queued[i].index];
+
+        if (draw.kind == DrawItem::SKYBOX) {
+            //drawn after the opaques: no depth writes and <= so the far plane skybox
+            //only lands on pixels nothing else covered
+            commands.setDepthMask(false);
+            commands.setDepthFunc(GL_LEQUAL);
+            commands.bindProgram(frame.skyProgram);
+            currentShader = nullptr;
+
+            commands.uniformMatrix4(frame.skyViewLoc, frame.skyView);
+            commands.uniformMatrix4(frame.skyProjLoc, frame.projection);
+            commands.bindVertexArray(frame.skyVAO);
+            commands.bindTexture(0, GL_TEXTURE_CUBE_MAP, draw.texture);
+            commands.drawElements({ 36, 1, 0, 0, 0 });
+
+            commands.setDepthMask(true);
+            commands.setDepthFunc(GL_LESS);
+            continue;
+        }
+
+        if (draw.shader != currentShader) {
+            currentShader = draw.shader;
+            const Shader::UniformLocations& uniforms = currentShader->uniforms;
+            commands.bindProgram(currentShader->getID());
+            commands.uniformMatrix4(uniforms.viewProj, frame.viewProj);
+            commands.uniform3(uniforms.lightPos, frame.lightPos);
+            commands.uniform3(uniforms.lightColor, frame.lightColor);
+            commands.uniform1(uniforms.ambientStr, frame.ambientStr);
+            commands.uniform3(uniforms.ambientColor, frame.ambientColor);
+            commands.uniform3(uniforms.cameraPos, frame.cameraPos);
+            commands.uniform1(uniforms.specStr, frame.specStr);
+            commands.uniform1(uniforms.specPhong, frame.specPhong);
+        }
+        commands.bindTexture(0, GL_TEXTURE_2D, draw.texture);
+        commands.bindTexture(1, GL_TEXTURE_2D, draw.normalTexture);
+        //only the BLENDED variants have it
+        if (currentShader->uniforms.opacity >= 0)
+            commands.uniform1(currentShader->uniforms.opacity, draw.opacity);
+
+        //conditioned draws go out on their own, inside a conditional render on their query
+        if (draw.condition != 0)
+            commands.beginConditionalRender(draw.condition);
+
+        if (draw.kind == DrawItem::INSTANCED) {
+            commands.bindInstanceBuffer(draw.model->getInstanceBuffer());
+            if (draw.model->getIndirectBuffer() != 0)
+                commands.drawElementsIndirect(draw.model->getIndirectBuffer(), draw.submesh);
+            else
+                commands.drawElementsInstanced(draw.model->getInstancedDrawCommand(draw.submesh));
+        }
+        else if (draw.kind == DrawItem::IMPOSTOR) {
+            commands.bindInstanceBuffer(draw.impostor->getInstanceBuffer());
+            if (draw.impostor->getIndirectBuffer() != 0)
+                commands.drawElementsIndirect(draw.impostor->getIndirectBuffer(), draw.impostor->getIndirectCommand());
+            else
+                commands.drawElementsInstanced(draw.impostor->getDrawCommand());
+        }
+        else if (draw.kind == DrawItem::FISH) {
+            commands.bindVertexArray(draw.fish->getVertexArray());
+            commands.drawElementsInstanced(draw.fish->getDrawCommand());
+        }
+        else if (frame.multiDraw && draw.kind == DrawItem::MESH) {
+            //the run of mesh draws sharing program and textures goes out as one multi draw
+            multiDrawCommands.clear();
+            multiDrawData.clear();
+
+            size_t run = i;
+            for (; run < end; run++) {
+                const DrawItem& next = drawItems[queued[run].index];
+                if (next.kind != DrawItem::MESH || next.shader != draw.shader ||
+                    next.texture != draw.texture || next.normalTexture != draw.normalTexture)
+                    break;
+                if (run > i && (draw.condition != 0 || next.condition != 0))
+                    break;
+                multiDrawCommands.push_back(next.model->getDrawCommand(next.submesh));
+                multiDrawData.push_back(MultiDrawData(next.matrices));
+            }
+
+            commands.multiDraw(multiDrawCommands.data(), multiDrawData.data(), multiDrawCommands.size());
+            i = run - 1;
+        }
+        else {
+            //plain loop fallback, per draw uniforms instead of gl_DrawIDARB
+            const Shader::UniformLocations& uniforms = currentShader->uniforms;
+            commands.uniformMatrix4(uniforms.mvp, draw.matrices.mvp);
+            commands.uniformMatrix4(uniforms.transform, draw.matrices.model);
+            commands.uniformMatrix3(uniforms.normalMatrix, draw.matrices.normal);
+            commands.bindVertexArray(frame.arena->getVertexArray());
+            commands.drawElements(draw.model->getDrawCommand(draw.submesh));
+        }
+
+        if (draw.condition != 0)
+            commands.endConditionalRender();
+    }
+}
+
+// records the depth prepass for the opaque draws [begin, end): position only stream and
+// depth shaders, no textures or lighting. batches the same way recordDraws does
+void recordDepthDraws(const FrameContext& frame, const std::vector<RenderQueue::Item>& queued,
+    size_t begin, size_t end, CommandBuffer& commands) {
+    const std::vector<DrawItem>& drawItems = *frame.drawItems;
+    const Shader* currentShader = nullptr;
+    std::vector<DrawElementsIndirectCommand> multiDrawCommands;
+    std::vector<MultiDrawData> multiDrawData;
+
+    for (size_t i = begin; i < end; i++) {
+        const DrawItem& draw = drawItems[queued[i].index];
+        bool instanced = draw.kind == DrawItem::INSTANCED;
+
+        const Shader* depthShader = instanced ? frame.depthInstancedShader : frame.depthShader;
+        if (depthShader != currentShader) {
+            currentShader = depthShader;
+            commands.bindProgram(currentShader->getID());
+            commands.uniformMatrix4(currentShader->uniforms.viewProj, frame.viewProj);
+        }
+
+        if (draw.condition != 0)
+            commands.beginConditionalRender(draw.condition);
+
+        if (instanced) {
+            commands.bindInstanceBuffer(draw.model->getInstanceBuffer(), MeshArena::POSITION_STREAM);
+            if (draw.model->getIndirectBuffer() != 0)
+                commands.drawElementsIndirect(draw.model->getIndirectBuffer(), draw.submesh);
+            else
+                commands.drawElementsInstanced(draw.model->getInstancedDrawCommand(draw.submesh));
+        }
+        else if (frame.multiDraw) {
+            //no textures to split on, every consecutive mesh goes into one multi draw
+            multiDrawCommands.clear();
+            multiDrawData.clear();
+
+            size_t run = i;
+            for (; run < end; run++) {
+                const DrawItem& next = drawItems[queued[run].index];
+                if (next.kind != DrawItem::MESH || (run > i && (draw.condition != 0 || next.condition != 0)))
+                    break;
+                multiDrawCommands.push_back(next.model->getDrawCommand(next.submesh));
+                multiDrawData.push_back(MultiDrawData(next.matrices));
+            }
+
+            commands.multiDraw(multiDrawCommands.data(), multiDrawData.data(), multiDrawCommands.size(),
+                MeshArena::POSITION_STREAM);
+            i = run - 1;
+        }
+        else {
+            commands.uniformMatrix4(currentShader->uniforms.mvp, draw.matrices.mvp);
+            commands.bindVertexArray(frame.arena->getVertexArray(MeshArena::POSITION_STREAM));
+            commands.drawElements(draw.model->getDrawCommand(draw.submesh));
+        }
+
+        if (draw.condition != 0)
+            commands.endConditionalRender();
     }
 }
 
-int main(void)
+// sorts 50k random submissions the way the frame loop does and reports the time per sort
+void runRenderQueueBenchmark() {
+    const int submissions = 50000;
+    const int frames = 100;
+
+    RenderQueue queue;
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> depth(0.0f, 1.0f);
+    double totalMs = 0.0;
+
+    for (int frame = 0; frame < frames; frame++) {
+        queue.clear();
+        for (int i = 0; i < submissions; i++) {
+            uint32_t program = random() % 4;
+            uint32_t material = random() % 64;
+            uint32_t mesh = random() % 256;
+            if (i % 8 == 0)
+                queue.submit(RenderKey::transparent(PASS_TRANSPARENT, program, material, mesh, depth(random)), i);
+            else
+                queue.submit(RenderKey::opaque(PASS_OPAQUE, program, material, mesh, depth(random)), i);
+        }
+
+        auto start = std::chrono::high_resolution_clock::now();
+        queue.sort();
+        auto end = std::chrono::high_resolution_clock::now();
+        totalMs += std::chrono::duration<double, std::milli>(end - start).count();
+    }
+
+    std::cout << "render queue: " << submissions << " submissions sorted in "
+        << totalMs / frames << " ms" << std::endl;
+}
+
+// vertex throughput of the hull: the old shader (matrices rebuilt per vertex) against
+// the per-object matrices from computeDrawMatrices. rasterizer discard keeps fragment
+// cost out of the numbers
+void runVertexBenchmark(Model& model, const glm::mat4& projection, const glm::mat4& view) {
+    const int frames = 200;
+    const int drawsPerFrame = 64;
+
+    Shader perVertexShader("Shaders/sample.vert", "Shaders/sample.frag", "#define PER_VERTEX_MATRICES\n");
+    Shader perObjectShader("Shaders/sample.vert", "Shaders/sample.frag");
+    glm::mat4 viewProj = projection * view;
+
+    GLuint query;
+    glGenQueries(1, &query);
+    glEnable(GL_RASTERIZER_DISCARD);
+
+    for (int pass = 0; pass < 2; pass++) {
+        bool perVertex = pass == 0;
+        Shader& shader = perVertex ? perVertexShader : perObjectShader;
+        shader.use();
+
+        GLuint64 gpuTime = 0;
+        double cpuStart = glfwGetTime();
+
+        for (int frame = 0; frame < frames; frame++) {
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            for (int i = 0; i < drawsPerFrame; i++) {
+                glm::mat4 transform = glm::translate(glm::mat4(1.0f),
+                    glm::vec3((i % 8) - 4.0f, (i / 8) - 4.0f, -20.0f));
+
+                if (perVertex) {
+                    shader.setProjectionMatrix(projection);
+                    shader.setViewMatrix(view);
+                    shader.setTransformMatrix(transform);
+                }
+                else {
+                    DrawMatrices matrices;
+                    computeDrawMatrices(&transform, 1, viewProj, &matrices);
+                    shader.setDrawMatrices(matrices);
+                }
+                model.draw();
+            }
+            glEndQuery(GL_TIME_ELAPSED);
+
+            GLuint64 elapsed = 0;
+            glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+            gpuTime += elapsed;
+        }
+
+        double cpuMs = (glfwGetTime() - cpuStart) * 1000.0;
+        double vertices = (double)model.getIndexCount() * drawsPerFrame * frames;
+        double gpuSeconds = gpuTime * 1e-9;
+
+        std::cout << (perVertex ? "per-vertex matrices: " : "per-object matrices: ")
+            << vertices / gpuSeconds / 1e6 << " Mverts/s, "
+            << gpuSeconds * 1000.0 / frames << " ms gpu/frame, "
+            << cpuMs / frames << " ms cpu/frame" << std::endl;
+    }
+
+    glDisable(GL_RASTERIZER_DISCARD);
+    glDeleteQueries(1, &query);
+}
+
+// meshes streaming in and out of an arena: 256 live meshes of 32 to 2048 vertices, one
+// removed at random and replaced 5k times, which leaves enough holes for remove() to
+// compact. every live mesh's indices are read back at the end and checked against what went in
+void runMeshArenaBenchmark() {
+    const int liveCount = 256;
+    const int replacements = 5000;
+
+    MeshArena arena(1 << 18, 1 << 19);
+    std::mt19937 random(1234);
+    std::vector<GLfloat> vertices;
+    std::vector<GLuint> indices;
+    std::vector<MeshArena::MeshHandle> live(liveCount);
+    //each mesh's indices are a pattern only it has, for the read back
+    auto addMesh = [&](GLuint seed) {
+        GLuint vertexCount = 32 + random() % 2017;
+        vertices.assign((size_t)vertexCount * MeshArena::VERTEX_FLOATS, 0.0f);
+        indices.resize((size_t)vertexCount * 3);
+        for (size_t i = 0; i < indices.size(); i++)
+            indices[i] = (GLuint)((seed * 7 + i) % vertexCount);
+        return arena.add(vertices.data(), vertexCount, indices.data(), (GLuint)indices.size());
+    };
+
+    std::vector<GLuint> seeds(liveCount);
+    for (int i = 0; i < liveCount; i++) {
+        seeds[i] = (GLuint)i;
+        live[i] = addMesh(seeds[i]);
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < replacements; i++) {
+        int slot = random() % liveCount;
+        arena.remove(live[slot]);
+        seeds[slot] = (GLuint)(liveCount + i);
+        live[slot] = addMesh(seeds[slot]);
+    }
+    glFinish();
+    double churnMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    arena.bind();
+    GLint indexBuffer = 0;
+    glGetIntegerv(GL_ELEMENT_ARRAY_BUFFER_BINDING, &indexBuffer);
+    glBindBuffer(GL_COPY_READ_BUFFER, (GLuint)indexBuffer);
+    int corrupt = 0;
+    std::vector<GLuint> readBack;
+    for (int i = 0; i < liveCount; i++) {
+        DrawElementsIndirectCommand command = arena.getCommand(live[i]);
+        readBack.resize(command.count);
+        glGetBufferSubData(GL_COPY_READ_BUFFER, (GLintptr)command.firstIndex * sizeof(GLuint),
+            (GLsizeiptr)command.count * sizeof(GLuint), readBack.data());
+        GLuint vertexCount = command.count / 3;
+        for (size_t j = 0; j < readBack.size(); j++) {
+            if (readBack[j] != (GLuint)((seeds[i] * 7 + j) % vertexCount)) {
+                corrupt++;
+                break;
+            }
+        }
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+    std::cout << "mesh arena: " << replacements << " meshes replaced in " << churnMs << " ms ("
+        << churnMs * 1000.0 / replacements << " us each), " << arena.getCompactionCount() << " compactions, "
+        << corrupt << " of " << liveCount << " live meshes corrupt" << std::endl;
+}
+
+// 100k entities wandering an ocean sized box: every one moves and looks for its neighbours
+// each frame, a tenth also ask for their 8 nearest. a sample is checked against a brute force
+// scan, whose time is scaled up to what it would cost for everyone
+void runSpatialHashBenchmark() {
+    const int entityCount = 100000;
+    const int frames = 20;
+    const float queryRadius = 16.0f;
+    const size_t nearestCount = 8;
+    const int bruteForceSamples = 500;
+    const glm::vec3 worldSize(2000.0f, 200.0f, 2000.0f);
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<glm::vec3> positions(entityCount), velocities(entityCount);
+    for (int i = 0; i < entityCount; i++) {
+        positions[i] = glm::vec3(unit(random), unit(random), unit(random)) * worldSize;
+        velocities[i] = (glm::vec3(unit(random), unit(random), unit(random)) - 0.5f) * 4.0f;
+    }
+
+    SpatialHash grid(queryRadius * 2.0f);
+    auto start = std::chrono::high_resolution_clock::now();
+    for (int i = 0; i < entityCount; i++)
+        grid.insert((uint32_t)i, positions[i]);
+    double insertMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+    std::vector<uint32_t> found;
+    std::vector<SpatialHash::Neighbor> nearest;
+    double moveMs = 0.0, radiusMs = 0.0, nearestMs = 0.0;
+    size_t neighbours = 0;
+    for (int frame = 0; frame < frames; frame++) {
+        start = std::chrono::high_resolution_clock::now();
+        for (int i = 0; i < entityCount; i++) {
+            positions[i] += velocities[i];
+            //bounce off the walls
+            for (int axis = 0; axis < 3; axis++) {
+                if (positions[i][axis] < 0.0f || positions[i][axis] > worldSize[axis])
+                    velocities[i][axis] = -velocities[i][axis];
+            }
+            grid.move((uint32_t)i, positions[i]);
+        }
+        auto moved = std::chrono::high_resolution_clock::now();
+
+        for (int i = 0; i < entityCount; i++) {
+            grid.queryRadius(positions[i], queryRadius, found);
+            neighbours += found.size();
+        }
+        auto queried = std::chrono::high_resolution_clock::now();
+
+        for (int i = 0; i < entityCount; i += 10)
+            grid.queryNearest(positions[i], nearestCount, FLT_MAX, nearest);
+        auto end = std::chrono::high_resolution_clock::now();
+
+        moveMs += std::chrono::duration<double, std::milli>(moved - start).count();
+        radiusMs += std::chrono::duration<double, std::milli>(queried - moved).count();
+        nearestMs += std::chrono::duration<double, std::milli>(end - queried).count();
+    }
+
+    //the o(n^2) way, on a sample
+    int mismatches = 0;
+    float radiusSquared = queryRadius * queryRadius;
+    start = std::chrono::high_resolution_clock::now();
+    for (int sample = 0; sample < bruteForceSamples; sample++) {
+        int i = sample * (entityCount / bruteForceSamples);
+        size_t count = 0;
+        for (int j = 0; j < entityCount; j++) {
+            glm::vec3 offset = positions[j] - positions[i];
+            count += glm::dot(offset, offset) <= radiusSquared;
+        }
+        grid.queryRadius(positions[i], queryRadius, found);
+        mismatches += count != found.size();
+    }
+    double bruteForceMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count()
+        * entityCount / bruteForceSamples;
+
+    for (int sample = 0; sample < bruteForceSamples; sample++) {
+        int i = sample * (entityCount / bruteForceSamples);
+        std::vector<float> distances(entityCount);
+        for (int j = 0; j < entityCount; j++)
+            distances[j] = glm::dot(positions[j] - positions[i], positions[j] - positions[i]);
+        std::nth_element(distances.begin(), distances.begin() + nearestCount - 1, distances.end());
+        grid.queryNearest(positions[i], nearestCount, FLT_MAX, nearest);
+        mismatches += nearest.size() != nearestCount || nearest.back().distanceSquared != distances[nearestCount - 1];
+    }
+
+    std::cout << "spatial hash: " << entityCount << " entities in " << grid.getCellCount() << " cells of "
+        << grid.getCellSize() << ", " << grid.getChunkCount() << " chunks, inserted in " << insertMs << " ms" << std::endl;
+    std::cout << "spatial hash: per frame " << moveMs / frames << " ms moving everyone, " << radiusMs / frames
+        << " ms for " << entityCount << " radius queries (" << (double)neighbours / frames / entityCount
+        << " found each), " << nearestMs / frames << " ms for " << entityCount / 10 << " " << nearestCount
+        << "-nearest queries" << std::endl;
+    std::cout << "spatial hash: brute force radius queries would take " << bruteForceMs << " ms per frame, "
+        << mismatches << " of " << bruteForceSamples * 2 << " sampled queries disagree" << std::endl;
+}
+
+// 10k enemy subs patrolling a stretch of ocean with pillars in it while the target circles
+// through them, ten simulated seconds at 120 ticks a second. run once on the job system
+// and once on the calling thread alone
+void runEnemyAIBenchmark() {
+    const int agentCount = 10000;
+    const int ticks = 1200;
+    const float tickSeconds = 1.0f / 120.0f;
+    const int pillarCount = 32;
+    const glm::vec3 worldSize(600.0f, 60.0f, 600.0f);
+
+    std::mt19937 random(1234);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    BoundsSoA pillars;
+    for (int i = 0; i < pillarCount; i++) {
+        glm::vec3 base = (glm::vec3(unit(random), 0.0f, unit(random)) - 0.5f) * worldSize;
+        pillars.add(base + glm::vec3(-5.0f, -worldSize.y, -5.0f), base + glm::vec3(5.0f, worldSize.y, 5.0f));
+    }
+    std::vector<AiAgent> agents(agentCount);
+    for (AiAgent& agent : agents) {
+        agent.home = (glm::vec3(unit(random), unit(random), unit(random)) - 0.5f) * worldSize;
+        agent.patrolRadius = 20.0f + unit(random) * 40.0f;
+        agent.patrolAngle = unit(random) * glm::two_pi<float>();
+        agent.destination = agent.home;
+        agent.speed = 0.0f;
+        agent.state = AI_PATROL;
+    }
+
+    unsigned threadCounts[2] = { JobSystem::defaultWorkerCount() + 1, 1 };
+    for (int run = 0; run < 2 && (run == 0 || threadCounts[0] > 1); run++) {
+        unsigned threads = threadCounts[run];
+        JobSystem jobs(threads - 1);
+        EntityStore entities;
+        for (const AiAgent& agent : agents) {
+            glm::vec3 position = agent.home + glm::vec3(cos(agent.patrolAngle), 0.0f, sin(agent.patrolAngle)) *
+                agent.patrolRadius;
+            entities.create(Transform{ position, glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.0f) },
+                Velocity{ glm::vec3(0.0f), glm::vec3(0.0f) }, agent, AiPerception());
+        }
+
+        EnemyAI enemyAI;
+        double worstMs = 0.0;
+        for (int tick = 0; tick < ticks; tick++) {
+            float angle = tick * tickSeconds * 0.1f;
+            AiTarget target = { glm::vec3(cos(angle), 0.0f, sin(angle)) * 150.0f,
+                glm::vec3(-sin(angle), 0.0f, cos(angle)) * 15.0f };
+            auto start = std::chrono::high_resolution_clock::now();
+            enemyAI.update<Transform, Velocity>(entities, jobs, target, tickSeconds, BoxOccluders{ &pillars });
+            worstMs = std::max(worstMs, std::chrono::duration<double, std::milli>(
+                std::chrono::high_resolution_clock::now() - start).count());
+            integrateVelocities(entities, tickSeconds);
+        }
+
+        const AiStats& stats = enemyAI.getStats();
+        std::cout << "enemy ai: " << stats.agents << " agents on " << threads << " threads, "
+            << (stats.perceptionMs + stats.thinkingMs) / ticks << " ms per tick (" << stats.perceptionMs / ticks
+            << " perception, " << stats.thinkingMs / ticks << " planning and steering), worst " << worstMs << " ms, "
+            << stats.plans / ticks << " plans per tick" << std::endl;
+        std::cout << "enemy ai: after " << ticks * tickSeconds << " s " << stats.states[AI_PATROL] << " patrolling, "
+            << stats.states[AI_PURSUE] << " pursuing, " << stats.states[AI_EVADE] << " evading, " << stats.visible
+            << " can see the target" << std::endl;
+    }
+}
+
+// capsule subs cruising a flat stretch of ocean through static box pillars, two simulated
+// seconds at 120 steps a second for each count. the ocean grows with the count so the subs
+// stay as crowded and pairs and contacts grow linearly, but the sweep doesn't: a longer axis
+// puts more endpoints between neighbours, swaps grow about n^1.5 and the cost per sub with them
+// (0.15 ms for 1000 subs, 23 ms for 64000 here)
+void runCollisionBenchmark() {
+    const int steps = 240;
+    const float stepSeconds = 1.0f / 120.0f;
+    //ocean per sub
+    const float spacing = 12.0f;
+    const float depth = 20.0f;
+    const float speed = 5.0f;
+    const Collider hull = { COLLIDER_CAPSULE, glm::vec3(0.0f), 1.5f, 3.0f, glm::vec3(0.0f), 0, SweepAndPrune::INVALID };
+    const Collider pillar = { COLLIDER_BOX, glm::vec3(0.0f), 0.0f, 0.0f, glm::vec3(3.0f, depth, 3.0f), 1,
+        SweepAndPrune::INVALID };
+
+    JobSystem jobs;
+    for (int subCount = 1000; subCount <= 64000; subCount *= 2) {
+        std::mt19937 random(77);
+        std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+        glm::vec3 worldSize(spacing * std::sqrt((float)subCount), depth, spacing * std::sqrt((float)subCount));
+        EntityStore entities;
+        for (int i = 0; i < subCount; i++) {
+            glm::vec3 position = (glm::vec3(unit(random), unit(random), unit(random)) - 0.5f) * worldSize;
+            float heading = unit(random) * glm::two_pi<float>();
+            entities.create(Transform{ position, glm::angleAxis(heading, glm::vec3(0.0f, 1.0f, 0.0f)), glm::vec3(1.0f) },
+                Velocity{ glm::vec3(sin(heading), 0.0f, cos(heading)) * speed, glm::vec3(0.0f) }, hull);
+        }
+        int pillarCount = subCount / 50;
+        for (int i = 0; i < pillarCount; i++) {
+            glm::vec3 position = (glm::vec3(unit(random), 0.5f, unit(random)) - 0.5f) * worldSize;
+            float yaw = unit(random) * glm::two_pi<float>();
+            entities.create(Transform{ position, glm::angleAxis(yaw, glm::vec3(0.0f, 1.0f, 0.0f)), glm::vec3(1.0f) }, pillar);
+        }
+
+        CollisionWorld collisionWorld;
+        collisionWorld.update<Transform>(entities, jobs);
+        double buildMs = collisionWorld.getStats().broadphaseMs;
+        collisionWorld.resetStats();
+        size_t pairs = 0, contacts = 0;
+        for (int step = 0; step < steps; step++) {
+            integrateVelocities(entities, stepSeconds);
+            //turned back at the edges of the ocean
+            entities.forEachArray<Transform, Velocity>([&](size_t count, const Entity*, Transform* transforms,
+                Velocity* velocities) {
+                for (size_t i = 0; i < count; i++) {
+                    glm::vec3 outside = glm::abs(transforms[i].position) - worldSize * 0.5f;
+                    for (int axis = 0; axis < 3; axis++) {
+                        if (outside[axis] > 0.0f && velocities[i].linear[axis] * transforms[i].position[axis] > 0.0f)
+                            velocities[i].linear[axis] = -velocities[i].linear[axis];
+                    }
+                }
+            });
+            collisionWorld.update<Transform>(entities, jobs);
+            separateContacts(entities, collisionWorld.getContacts());
+            pairs += collisionWorld.getStats().pairs;
+            contacts += collisionWorld.getStats().contacts;
+        }
+
+        const CollisionStats& stats = collisionWorld.getStats();
+        std::cout << "collision: " << subCount << " subs + " << pillarCount << " pillars, "
+            << (stats.broadphaseMs + stats.narrowphaseMs) / steps << " ms per step (" << stats.broadphaseMs / steps
+            << " broadphase, " << stats.narrowphaseMs / steps << " narrowphase), " << stats.swaps / steps << " swaps, "
+            << pairs / steps << " pairs, " << contacts / steps << " contacts per step, first sort " << buildMs << " ms"
+            << std::endl;
+    }
+}
+
+// 100k fish in a box with a few subs in the way, 300 steps of a 60th of a second. run once
+// on the job system and once on the calling thread alone
+void runFishBenchmark() {
+    const size_t fishCount = 100000;
+    const int steps = 300;
+    const float stepSeconds = 1.0f / 60.0f;
+
+    std::vector<FishObstacle> obstacles;
+    for (int i = 0; i < 8; i++)
+        obstacles.push_back({ glm::vec3(cos(i * 0.8f), 0.0f, sin(i * 0.8f)) * 30.0f, 4.0f });
+
+    unsigned threadCounts[2] = { JobSystem::defaultWorkerCount() + 1, 1 };
+    for (int run = 0; run < 2 && (run == 0 || threadCounts[0] > 1); run++) {
+        JobSystem jobs(threadCounts[run] - 1);
+        FishSchool school(fishCount, glm::vec3(0.0f), glm::vec3(60.0f, 15.0f, 60.0f));
+        std::vector<FishInstance> instances(fishCount);
+
+        double instanceMs = 0.0;
+        for (int step = 0; step < steps; step++) {
+            school.update(jobs, stepSeconds, obstacles);
+            auto start = std::chrono::high_resolution_clock::now();
+            school.fillInstances(jobs, instances.data());
+            instanceMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+        }
+
+        const FishSchool::Stats& stats = school.getStats();
+        double stepMs = (stats.sortMs + stats.steerMs + stats.integrateMs) / steps;
+        std::cout << "fish: " << fishCount << " fish on " << threadCounts[run] << " threads, " << stepMs << " ms per step ("
+            << stats.sortMs / steps << " sorting, " << stats.steerMs / steps << " steering, " << stats.integrateMs / steps
+            << " integrating) + " << instanceMs / steps << " ms filling instances, "
+            << (double)stats.neighbors / steps / fishCount << " neighbours each" << std::endl;
+    }
+}
+
+// rays per second through one mesh. fans of 16x16 rays out of points all around it, each fan
+// aimed across its box, and as many rays between random points outside and inside the box.
+// both go through one ray at a time and in packets of four, the packets' hits are checked
+// against the single rays
+void runMeshBVHBenchmark(const char* name, const MeshBVH& bvh) {
+    const int fanCount = 256;
+    const int fanSide = 16;
+    const int passes = 8;
+
+    glm::vec3 center = (bvh.getBoundsMin() + bvh.getBoundsMax()) * 0.5f;
+    glm::vec3 extent = bvh.getBoundsMax() - bvh.getBoundsMin();
+    //from a box diagonal away, half a diagonal either side of the center covers the box
+    float distance = std::max(glm::length(extent), 1e-3f);
+    std::mt19937 random(5);
+    std::normal_distribution<float> normal;
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    auto aroundMesh = [&]() {
+        glm::vec3 direction(normal(random), normal(random), normal(random));
+        return center + glm::normalize(direction + glm::vec3(0.0f, 0.0f, 1e-6f)) * distance;
+    };
+
+    std::vector<MeshRay> rays[2];
+    for (int fan = 0; fan < fanCount; fan++) {
+        glm::vec3 eye = aroundMesh();
+        glm::vec3 forward = center - eye;
+        glm::vec3 side = std::abs(forward.y) < 0.9f * distance ? glm::vec3(0.0f, 1.0f, 0.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        glm::vec3 right = glm::normalize(glm::cross(forward, side)) * distance * 0.5f;
+        glm::vec3 up = glm::normalize(glm::cross(right, forward)) * distance * 0.5f;
+        for (int y = 0; y < fanSide; y++) {
+            for (int x = 0; x < fanSide; x++) {
+                glm::vec2 offset = (glm::vec2((float)x, (float)y) + 0.5f) / (float)fanSide * 2.0f - 1.0f;
+                rays[0].push_back({ eye, forward + right * offset.x + up * offset.y, 2.0f });
+            }
+        }
+    }
+    for (size_t i = 0; i < rays[0].size(); i++) {
+        glm::vec3 origin = aroundMesh();
+        glm::vec3 target = bvh.getBoundsMin() + glm::vec3(unit(random), unit(random), unit(random)) * extent;
+        rays[1].push_back({ origin, target - origin, 2.0f });
+    }
+
+    for (int set = 0; set < 2; set++) {
+        size_t count = rays[set].size();
+        std::vector<MeshHit> single(count), packed(count);
+        auto start = std::chrono::high_resolution_clock::now();
+        for (int pass = 0; pass < passes; pass++) {
+            for (size_t i = 0; i < count; i++)
+                bvh.raycast(rays[set][i], single[i]);
+        }
+        auto singleEnd = std::chrono::high_resolution_clock::now();
+        for (int pass = 0; pass < passes; pass++)
+            bvh.raycastBatch(rays[set].data(), count, packed.data());
+        auto packetEnd = std::chrono::high_resolution_clock::now();
+
+        //two triangles sharing the edge a ray goes through can come out either way, compare distances
+        size_t hits = 0, disagreements = 0;
+        for (size_t i = 0; i < count; i++) {
+            hits += single[i].triangle != MeshBVH::INVALID;
+            disagreements += (single[i].triangle != MeshBVH::INVALID) != (packed[i].triangle != MeshBVH::INVALID) ||
+                std::abs(single[i].distance - packed[i].distance) > 1e-4f;
+        }
+        double singleSeconds = std::chrono::duration<double>(singleEnd - start).count();
+        double packetSeconds = std::chrono::duration<double>(packetEnd - singleEnd).count();
+        std::cout << "mesh bvh: " << name << ", " << count << (set == 0 ? " rays in fans" : " random rays") << ", "
+            << hits * 100.0 / count << "% hit | " << count * passes / singleSeconds / 1e6 << " Mrays/s one at a time, "
+            << count * passes / packetSeconds / 1e6 << " Mrays/s in packets of 4, " << disagreements << " disagree"
+            << std::endl;
+    }
+}
+
+// terminates glfw once it goes out of scope
+struct GlfwSession {
+    ~GlfwSession() {
+        glfwTerminate();
+    }
+};
+
+int main(int argc, char** argv)
 {
-    GLFWwindow* window;
+    bool benchVertex = false;
+    bool benchBVH = false;
+    bool benchArena = false;
+    //enemy subs drawn through the instanced path, the readme asks for 6
+    int fleetSize = 6;
+    int fishCount = 2000;
+    //--headless renders that many frames offscreen and exits, --dump-png writes every
+    //dumpInterval-th of them to <prefix><frame>.png
+    int headlessFrames = 0;
+    std::string dumpPrefix;
+    int dumpInterval = 1;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench-vertex") == 0)
+            benchVertex = true;
+        else if (strcmp(argv[i], "--bench-bvh") == 0)
+            benchBVH = true;
+        else if (strcmp(argv[i], "--bench-arena") == 0)
+            benchArena = true;
+        else if (strcmp(argv[i], "--bench-queue") == 0) {
+            runRenderQueueBenchmark();
+            return 0;
+        }
+        else if (strcmp(argv[i], "--bench-spatial") == 0) {
+            runSpatialHashBenchmark();
+            return 0;
+        }
+        else if (strcmp(argv[i], "--bench-ai") == 0) {
+            runEnemyAIBenchmark();
+            return 0;
+        }
+        else if (strcmp(argv[i], "--bench-fish") == 0) {
+            runFishBenchmark();
+            return 0;
+        }
+        else if (strcmp(argv[i], "--bench-collision") == 0) {
+            runCollisionBenchmark();
+            return 0;
+        }
+        else if (strcmp(argv[i], "--fleet") == 0 && i + 1 < argc)
+            fleetSize = std::max(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--fish") == 0 && i + 1 < argc)
+            fishCount = std::max(0, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc)
+            headlessFrames = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--dump-png") == 0 && i + 1 < argc)
+            dumpPrefix = argv[++i];
+        else if (strcmp(argv[i], "--dump-every") == 0 && i + 1 < argc)
+            dumpInterval = std::max(1, atoi(argv[++i]));
+        else if (strcmp(argv[i], "--prepass") == 0)
+            depth_prepass_enabled = true;
+        else if (strcmp(argv[i], "--no-occlusion") == 0)
+            occlusion_culling_enabled = false;
+        else if (strcmp(argv[i], "--cpu-culling") == 0)
+            gpu_culling_enabled = false;
+        else if (strcmp(argv[i], "--no-impostors") == 0)
+            impostors_enabled = false;
+        else if (strcmp(argv[i], "--sim-thread") == 0)
+            sim_thread_enabled = true;
+    }
+    bool headless = headlessFrames > 0;
 
-    /* Initialize the library */
-    if (!glfwInit())
-        return -1;
+    GLFWwindow* window;
 
     float window_width = 800.0f;
     float window_height = 800.0f;
 
-    /* Create a windowed mode window and its OpenGL context */
-    window = glfwCreateWindow(window_width, window_height, "MachineProject", NULL, NULL);
-    if (!window)
-    {
-        glfwTerminate();
-        return -1;
-    }
+    //declared before anything owning gl objects, so every way out of main deletes those
+    //while the context is still alive and terminates glfw last
+    GlfwSession glfwSession;
 
-    /* Make the window's context current */
-    glfwMakeContextCurrent(window);
-    gladLoadGL();
+    //no display needed, the post pass resolves into an offscreen framebuffer instead
+    HeadlessContext headlessContext;
+    if (headless) {
+        if (!headlessContext.create((int)window_width, (int)window_height)) {
+            std::cerr << "headless: could not create a gl context" << std::endl;
+            return -1;
+        }
+        window = headlessContext.getWindow();
+    }
+    else {
+        /* Initialize the library */
+        if (!glfwInit())
+            return -1;
+
+        /* Create a windowed mode window and its OpenGL context */
+        window = glfwCreateWindow(window_width, window_height, "MachineProject", NULL, NULL);
+        if (!window)
+            return -1;
+
+        /* Make the window's context current */
+        glfwMakeContextCurrent(window);
+        gladLoadGL();
+    }
 
     int img_width, //texture width
         img_height, //texture height
@@ -718,18 +1922,62 @@ int main(void)
     //re-enable image flip
     stbi_set_flip_vertically_on_load(true);
 
-    glEnable(GL_DEPTH_TEST);
+    GLState::get().setDepthTest(true);
 
     Camera camera(window);
 
-    glfwSetKeyCallback(window, Key_Callback);
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-    glfwSetCursorPosCallback(window, camera.mouse_callback);
-    glfwSetScrollCallback(window, camera.scroll_callback);
-    glfwSetWindowUserPointer(window, &camera);
+    if (!headless) {
+        glfwSetKeyCallback(window, Key_Callback);
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+        glfwSetCursorPosCallback(window, camera.mouse_callback);
+        glfwSetScrollCallback(window, camera.scroll_callback);
+        glfwSetWindowUserPointer(window, &camera);
+    }
+
+    //shared vertex/index arena for every model, grows on demand
+    MeshArena meshArena(1 << 18, 1 << 19);
+    //opaque meshes go out through glMultiDrawElementsIndirect when the driver has it
+    bool multiDraw = MeshArena::supportsMultiDraw();
+
+    //one shader variant per MaterialClass for the scene meshes and for the fleet.
+    //blended draws are sorted and drawn one by one, so they skip the multi draw variant
+    const char* materialDefines[] = { "", "#define ALPHA_TEST\n", "#define BLENDED\n" };
+    std::vector<Shader> sceneShaders;
+    std::vector<Shader> fleetShaders;
+    sceneShaders.reserve(MATERIAL_CLASS_COUNT);
+    fleetShaders.reserve(MATERIAL_CLASS_COUNT);
+
+    const std::vector<glm::vec3> fleetTints = {
+        glm::vec3(1.0f, 1.0f, 1.0f),
+        glm::vec3(1.0f, 0.6f, 0.6f),
+        glm::vec3(0.6f, 1.0f, 0.6f),
+        glm::vec3(0.6f, 0.6f, 1.0f)
+    };
+
+    for (int materialClass = 0; materialClass < MATERIAL_CLASS_COUNT; materialClass++) {
+        bool batched = multiDraw && materialClass != MATERIAL_BLENDED;
+        sceneShaders.emplace_back("Shaders/sample.vert", "Shaders/sample.frag",
+            std::string(batched ? "#define MULTI_DRAW\n" : "") + materialDefines[materialClass]);
+        sceneShaders.back().setSamplerUnits();
+
+        fleetShaders.emplace_back("Shaders/sample.vert", "Shaders/sample.frag",
+            std::string("#define INSTANCED\n") + materialDefines[materialClass]);
+        fleetShaders.back().setSamplerUnits();
+        fleetShaders.back().setMaterialTints(fleetTints);
+    }
+
+    //distant fleet subs, and the frames they show rendered once at load
+    Shader impostorShader("Shaders/impostor.vert", "Shaders/impostor.frag");
+    Shader fishShader("Shaders/fish.vert", "Shaders/fish.frag");
+    impostorShader.setSamplerUnits();
+    impostorShader.setMaterialTints(fleetTints);
+    Shader impostorBakeShader("Shaders/sample.vert", "Shaders/bake.frag");
+    impostorBakeShader.setSamplerUnits();
 
-    Shader shader("Shaders/sample.vert", "Shaders/sample.frag");
-    shader.use();
+    Shader depthShader("Shaders/depth.vert", "Shaders/depth.frag", multiDraw ? "#define MULTI_DRAW\n" : "");
+    Shader depthFleetShader("Shaders/depth.vert", "Shaders/depth.frag", "#define INSTANCED\n");
+    //plain mvp variant, draws the occlusion query boxes
+    Shader occlusionBoxShader("Shaders/depth.vert", "Shaders/depth.frag");
 
     //load sky vert shader
     std::fstream skyVertSrc("Shaders/skybox.vert");
@@ -824,17 +2072,12 @@ int main(void)
         6,2,3
     };
 
-    GLuint VAO, VBO;
-    //Initialize VAO and VBO
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-
     unsigned int skyVAO, skyVBO, skyEBO;
     glGenVertexArrays(1, &skyVAO);
     glGenBuffers(1, &skyVBO);
     glGenBuffers(1, &skyEBO);
 
-    glBindVertexArray(skyVAO);
+    GLState::get().bindVertexArray(skyVAO);
     glBindBuffer(GL_ARRAY_BUFFER, skyVBO);
 
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
@@ -847,19 +2090,9 @@ int main(void)
     //enable vertices
     glEnableVertexAttribArray(0);
 
-    float x, y, z;
-    x = y = z = 0.0f;
-    z = -20.0f;
     glm::mat3 identity_matrix3 = glm::mat3(1.0f);
     glm::mat4 identity_matrix4 = glm::mat4(1.0f);
 
-    float scale_x, scale_y, scale_z = 1.f;
-    scale_x = scale_y = scale_z = 1.f;
-
-    float axis_x, axis_y, axis_z, theta = 0.f;
-    axis_x = axis_y = axis_z = theta = 0.f;
-    axis_y = 1.f;
-
     /*glm::mat4 projectionMatrix = glm::ortho(
         -1.f, //left
         1.f, //right
@@ -869,15 +2102,16 @@ int main(void)
         1.f //zfar
     );*/
 
+    float farPlane = 200.0f;
     glm::mat4 projectionMatrix = glm::perspective(
         glm::radians(90.f), //fov
         window_height / window_width, //aspect ratio
         0.1f, //znear > 0
-        200.0f //zfar
+        farPlane //zfar
     );
 
     //set camera position
-    glm::vec3 cameraPos = glm::vec3(rotate_x_mod, 0, 100.f);
+    glm::vec3 cameraPos = glm::vec3(0, 0, 100.f);
 
     glm::mat4 cameraPositionMatrix = glm::translate(glm::mat4(1.0f),
         cameraPos * -1.0f);
@@ -925,132 +2159,930 @@ int main(void)
     //spec phong
     float specPhong = 16;
 
-    //enable blending
-    glEnable(GL_BLEND);
+    //blending stays off outside the transparent pass, only its function is set up here
+    GLState::get().setBlend(false);
 
     //blending function
-    glBlendFunc(GL_SRC_ALPHA, //source factor
+    GLState::get().setBlendFunc(GL_SRC_ALPHA, //source factor
         GL_ONE_MINUS_SRC_ALPHA //destination factor
     );
 
     glBlendEquation(GL_FUNC_ADD);
 
-    Model submarine("3D/Titan Submersible-1.obj");
-    Model brickwall("3D/plane.obj");
+    Model submarine("3D/Titan Submersible-1.obj", meshArena);
+    Model brickwall("3D/plane.obj", meshArena);
+
+    //everything placed in the world is an entity, the ones drawn are nodes of the hierarchy.
+    //the wall has always moved with the player's sub, so it hangs off the hull
+    EntityStore entities;
+    TransformHierarchy hierarchy;
+    const glm::quat noRotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    //subs collide as a capsule along their length, as wide as the hull's box
+    glm::vec3 hullHalfSize = (submarine.getBoundsMax() - submarine.getBoundsMin()) * 0.5f;
+    float hullRadius = std::max(hullHalfSize.x, hullHalfSize.y);
+    const Collider hullCollider = { COLLIDER_CAPSULE, (submarine.getBoundsMin() + submarine.getBoundsMax()) * 0.5f,
+        hullRadius, std::max(hullHalfSize.z - hullRadius, 0.0f), hullHalfSize, 0, SweepAndPrune::INVALID };
+    uint32_t hullNode = hierarchy.add();
+    Entity player = entities.create(Transform{ glm::vec3(0.0f, 0.0f, -5.0f), noRotation, glm::vec3(2.0f, 2.0f, 1.0f) },
+        Velocity{ glm::vec3(0.0f), glm::vec3(0.0f) }, Renderable{ &submarine, 0, false }, Controlled(), hullCollider,
+        HierarchyNode{ hullNode });
+    entities.create(Transform{ glm::vec3(0.0f), noRotation, glm::vec3(1.0f) }, Renderable{ &brickwall, 0, false },
+        HierarchyNode{ hierarchy.add(hullNode) });
+    entities.create(Transform{ lightPos, noRotation, glm::vec3(1.0f) },
+        Light{ lightColor, ambientStr, ambientColor, specStr, specPhong });
+
+    std::cout << "static meshes: " << meshArena.getUploadedBytes() / 1024 << " KB uploaded into "
+        << (MeshArena::supportsImmutableStorage() ? "immutable" : "mutable") << " storage" << std::endl;
+
+    const std::pair<const char*, const Model*> rayMeshes[] = { { "sub", &submarine }, { "wall", &brickwall } };
+    for (const std::pair<const char*, const Model*>& mesh : rayMeshes) {
+        const MeshBVH& bvh = mesh.second->getBVH();
+        std::cout << "mesh bvh: " << mesh.first << ", " << bvh.getTriangleCount() << " triangles, " << bvh.getNodeCount()
+            << " nodes, built in " << bvh.getBuildMs() << " ms" << std::endl;
+    }
+
+    if (benchVertex) {
+        runVertexBenchmark(submarine, projectionMatrix, viewMatrix);
+        return 0;
+    }
+    if (benchBVH) {
+        for (const std::pair<const char*, const Model*>& mesh : rayMeshes)
+            runMeshBVHBenchmark(mesh.first, mesh.second->getBVH());
+        return 0;
+    }
+    if (benchArena) {
+        runMeshArenaBenchmark();
+        return 0;
+    }
+
+    //there's no asset pipeline to cook it in, baking takes one draw of the sub per frame
+    Impostor fleetImpostor(meshArena);
+    impostorBakeShader.use();
+    impostorBakeShader.setTextureUniforms(texture, norm_tex);
+    fleetImpostor.bake(submarine.getBoundsMin(), submarine.getBoundsMax(), [&](const glm::mat4& viewProj) {
+        DrawMatrices matrices;
+        computeDrawMatrices(&identity_matrix4, 1, viewProj, &matrices);
+        impostorBakeShader.setDrawMatrices(matrices);
+        submarine.draw();
+    });
+    impostorShader.setImpostor(fleetImpostor);
+
+    //per frame draw list and the queue that sorts it
+    std::vector<DrawItem> drawItems;
+    RenderQueue renderQueue;
+
+    //draw recording runs on the job system, one command buffer per thread slice of each pass
+    JobSystem jobs;
+    std::vector<CommandBuffer> commandBuffers[PASS_COUNT];
+    for (std::vector<CommandBuffer>& passBuffers : commandBuffers)
+        passBuffers.resize(jobs.getThreadCount());
+    std::vector<CommandBuffer> depthPrepassBuffers(jobs.getThreadCount());
+
+    FrameContext frame;
+    frame.drawItems = &drawItems;
+    frame.arena = &meshArena;
+    frame.multiDraw = multiDraw;
+    frame.depthShader = &depthShader;
+    frame.depthInstancedShader = &depthFleetShader;
+    frame.projection = projectionMatrix;
+    frame.skyProgram = skyShaderProg;
+    frame.skyVAO = skyVAO;
+    frame.skyViewLoc = glGetUniformLocation(skyShaderProg, "view");
+    frame.skyProjLoc = glGetUniformLocation(skyShaderProg, "projection");
+    frame.cameraPos = cameraPos;
+
+    //enemy subs patrol rings of 6 around the player's start, facing along the ring
+    for (int i = 0; i < fleetSize; i++) {
+        int ring = i / 6;
+        glm::vec3 home = glm::vec3(0.0f, (ring % 5) * 4.0f - 8.0f, -20.0f);
+        float radius = 30.0f + ring * 12.0f;
+        float angle = glm::radians(60.0f * (i % 6)) + ring * 0.5f;
+        glm::vec3 position = home + glm::vec3(cos(angle), 0.0f, sin(angle)) * radius;
+        entities.create(Transform{ position, glm::angleAxis(-angle, glm::vec3(0.0f, 1.0f, 0.0f)), glm::vec3(1.0f) },
+            Velocity{ glm::vec3(0.0f), glm::vec3(0.0f) }, Renderable{ &submarine, i % 4, true },
+            AiAgent{ home, radius, angle, position, 0.0f, AI_PATROL }, AiPerception(), hullCollider,
+            HierarchyNode{ hierarchy.add() });
+    }
+
+    //enemy fleet, transforms are gathered from the instanced renderables every frame and
+    //uploaded in one go
+    std::vector<glm::mat4> fleetTransforms(fleetSize);
+    std::vector<int> fleetMaterials(fleetSize);
+    std::vector<InstanceData> fleetInstances(fleetSize);
+    std::vector<int> visibleFleetMaterials(fleetSize);
+    //the scene models, drawn one at a time
+    std::vector<Model*> sceneModels;
+    std::vector<glm::mat4> sceneTransforms;
+    std::vector<DrawMatrices> sceneMatrices;
+    std::vector<glm::mat4> impostorTransforms;
+    std::vector<int> impostorMaterials;
+    std::vector<InstanceData> impostorInstances;
+
+    //world space boxes of every scene submesh and fleet instance, rebuilt and culled each frame
+    BoundsSoA worldBounds;
+    std::vector<uint8_t> visibility;
+    //refit every frame, answers the culling once the scene is big enough and the stats queries.
+    //below about a thousand boxes the flat simd pass is faster than walking the tree
+    SceneBVH sceneBVH;
+    const size_t bvhCullThreshold = 1024;
+    std::vector<uint32_t> nearbyObjects;
+    size_t lastVisibleCount = 0;
+    size_t lastCulledCount = 0;
+    glm::mat4 lastPlayerTransform = glm::mat4(1.0f);
+
+    //the scene models as triangle meshes. fleet subs only get placed (and inverted) once
+    //something is near enough to hit them
+    std::vector<MeshInstance> sceneInstances;
+    MeshRaycastScratch raycastScratch;
+    //the crosshair is cast on the first frame after each stats print, against the scene models
+    //and the fleet subs whose box the ray enters. printed at the next one
+    std::vector<MeshInstance> pickTargets;
+    std::vector<int> pickTargetSubs;
+    MeshHit lastPicked = { farPlane, MeshBVH::INVALID, MeshBVH::INVALID };
+    int lastPickedSub = -1;
+    //every frame the player's sub pings a band of rays around itself, 32 headings by 8
+    //elevations. its own hull and the wall hanging off it don't echo
+    const int sonarHeadings = 32;
+    const int sonarElevations = 8;
+    const float sonarRange = 80.0f;
+    std::vector<MeshRay> sonarRays(sonarHeadings * sonarElevations);
+    std::vector<MeshHit> sonarEchoes(sonarRays.size());
+    std::vector<uint32_t> sonarObjects;
+    std::vector<MeshInstance> sonarTargets;
+    size_t lastEchoCount = 0;
+    float lastNearestEcho = sonarRange;
+    double sonarMs = 0.0;
+
+    //the player (entity 0) and the fleet subs as points, for gameplay proximity queries
+    //that would otherwise scan every sub. cells twice the usual query radius
+    const float proximityRadius = 40.0f;
+    SpatialHash entityGrid(proximityRadius * 2.0f);
+    std::vector<uint32_t> nearbySubs;
+    std::vector<SpatialHash::Neighbor> nearestSubs;
+
+    //the scene renders into transient targets, post resolves them into the window
+    int framebufferWidth = headlessContext.getWidth();
+    int framebufferHeight = headlessContext.getHeight();
+    if (!headless)
+        glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+
+    //quarter resolution software depth, the scene models are the occluders
+    OcclusionBuffer occlusionBuffer(framebufferWidth / 4, framebufferHeight / 4);
+    size_t lastOccludedCount = 0;
+    double lastOcclusionMs = 0.0;
+
+    //hardware queries for the expensive scene submeshes, their draws are conditioned on
+    //whether their box showed last frame. cheap ones cost less to draw than to query
+    OcclusionQueries occlusionQueries;
+    const GLsizei conditionalRenderMinIndices = 1024;
+    std::vector<GLuint> drawConditions;
+    int statsFrames = 0;
+
+    //compute culling of the fleet against the frustum and last frame's depth pyramid, takes
+    //over from the cpu tests above when the gl has compute shaders
+    std::unique_ptr<GpuCulling> gpuCulling;
+    if (GpuCulling::supported())
+        gpuCulling.reset(new GpuCulling(framebufferWidth, framebufferHeight));
+    else
+        std::cout << "gpu culling: no compute shaders, the fleet is culled on the cpu" << std::endl;
+    std::vector<DrawElementsIndirectCommand> fleetCommands;
+    double lastFleetCullMs = 0.0;
+
+    //anything under 2 pixels across isn't drawn, fleet subs under 64 are impostors. the
+    //impostor frames are 128 texels, so they're never magnified much
+    ScreenSizeLod screenSizeLod;
+    screenSizeLod.pixelScale = projectionMatrix[1][1] * framebufferHeight * 0.5f;
+    screenSizeLod.cullPixels = 2.0f;
+    const float impostorPixels = 64.0f;
+    size_t lastSmallCount = 0;
+    size_t lastImpostorCount = 0;
+
+    //a school of fish between the camera and the fleet. scenery, so it steps once per frame
+    //on the frame's time instead of in the fixed step simulation, steering around every box
+    //the frame culls
+    FishSchool fishSchool(fishCount, glm::vec3(0.0f, 0.0f, 10.0f), glm::vec3(60.0f, 15.0f, 40.0f));
+    FishMesh fishMesh;
+    std::vector<FishInstance> fishInstances(fishCount);
+    std::vector<FishObstacle> fishObstacles;
+
+    FrameGraph frameGraph;
+    FrameGraph::ResourceHandle sceneColor = frameGraph.createTransient("scene color",
+        { framebufferWidth, framebufferHeight, GL_RGBA8 });
+    FrameGraph::ResourceHandle sceneDepth = frameGraph.createTransient("scene depth",
+        { framebufferWidth, framebufferHeight, GL_DEPTH_COMPONENT24 });
+    FrameGraph::ResourceHandle backbuffer = frameGraph.importBackbuffer("backbuffer",
+        headless ? headlessContext.getFramebuffer() : 0);
+
+    //gpu time per frame and for the passes the prepass toggle affects
+    enum GpuScope {
+        GPU_FRAME,
+        GPU_DEPTH_PREPASS,
+        GPU_OPAQUE,
+        GPU_SCOPE_COUNT
+    };
+    GpuTimer gpuTimer(GPU_SCOPE_COUNT);
+
+    auto executePass = [&](RenderPass pass) {
+        for (const CommandBuffer& commands : commandBuffers[pass])
+            commands.execute(meshArena);
+    };
 
-    // Set position, rotation, and scale
-    submarine.setPosition(0.0f, 0.0f, 0.0f);
-    submarine.setRotation(0.0f, 0.0f, 0.0f);
-    submarine.setScale(1.0f, 1.0f, 1.0f);
+    FrameGraph::PassHandle depthPrepassPass = frameGraph.addPass("depth prepass", {}, { sceneDepth }, [&] {
+        gpuTimer.begin(GPU_DEPTH_PREPASS);
+        for (const CommandBuffer& commands : depthPrepassBuffers)
+            commands.execute(meshArena);
+        gpuTimer.end(GPU_DEPTH_PREPASS);
+    });
+    frameGraph.setPassEnabled(depthPrepassPass, depth_prepass_enabled);
+
+    frameGraph.addPass("opaque", {}, { sceneColor, sceneDepth }, [&] {
+        //after a prepass depth is final, only the fragment that won gets shaded
+        bool prepass = frameGraph.isPassEnabled(depthPrepassPass);
+        GLState::get().setDepthFunc(prepass ? GL_EQUAL : GL_LESS);
+        GLState::get().setDepthMask(!prepass);
+
+        gpuTimer.begin(GPU_OPAQUE);
+        executePass(PASS_OPAQUE);
+        gpuTimer.end(GPU_OPAQUE);
+
+        GLState::get().setDepthFunc(GL_LESS);
+        GLState::get().setDepthMask(true);
+    });
+    //not in the prepass, the depth shaders can't see the alpha mask
+    frameGraph.addPass("alpha tested", {}, { sceneColor, sceneDepth }, [&] { executePass(PASS_ALPHA_TEST); });
+    //boxes against the finished opaque depth, next frame's draws of those submeshes wait on them
+    frameGraph.addPass("occlusion queries", { sceneDepth }, { sceneColor }, [&] {
+        occlusionQueries.execute(occlusionBoxShader.getID(), occlusionBoxShader.uniforms.mvp, skyVAO, frame.viewProj);
+    });
+    //next frame's gpu culling tests against this frame's opaque depth. built even while the
+    //cpu path is selected so switching over never finds a stale pyramid
+    frameGraph.addPass("hi-z", { sceneDepth }, { sceneColor }, [&] {
+        if (gpuCulling)
+            gpuCulling->buildHiZ(frameGraph.getTexture(sceneDepth), frame.viewProj);
+    });
+    frameGraph.addPass("skybox", { sceneDepth }, { sceneColor }, [&] { executePass(PASS_SKYBOX); });
+    frameGraph.addPass("transparent", { sceneDepth }, { sceneColor }, [&] {
+        //the only pass that blends, its draws come sorted back to front
+        GLState::get().setBlend(true);
+        GLState::get().setDepthMask(false);
+        executePass(PASS_TRANSPARENT);
+        GLState::get().setDepthMask(true);
+        GLState::get().setBlend(false);
+    });
+    frameGraph.addPass("post", { sceneColor }, { backbuffer }, [&] {
+        frameGraph.blit(sceneColor, backbuffer, GL_COLOR_BUFFER_BIT);
+    });
+
+    frameGraph.compile();
+    std::cout << "frame graph: " << frameGraph.getOrder().size() << " passes, "
+        << frameGraph.getCulledPassCount() << " culled, " << frameGraph.getTransientCount()
+        << " transients on " << frameGraph.getTextureCount() << " textures" << std::endl;
+
+    //instances, multi draw data and indirect commands stream through one persistently
+    //mapped buffer, 1 MB per frame to start with
+    std::unique_ptr<RingBuffer> ringBuffer;
+    if (RingBuffer::supported()) {
+        ringBuffer.reset(new RingBuffer(1 << 20));
+        meshArena.setRingBuffer(ringBuffer.get());
+    }
 
-    brickwall.setPosition(-10.0f, 3.0f, 0.0f);
-    brickwall.setRotation(0.0f, 0.0f, 0.0f);
-    brickwall.setScale(1.0f, 1.0f, 1.0f);
+    //textures were bound directly while loading, start the loop from a clean cache
+    GLState::get().invalidate();
+    //wall clock instead of glfwGetTime, glfw isn't initialized on the egl headless path
+    std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+    auto elapsedSeconds = [&]() {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    };
+    double lastStatsTime = elapsedSeconds();
+    double lastFrameTime = 0.0;
+    int frameIndex = 0;
+    //last reported gpu frame time with the prepass off and on
+    double gpuFrameMs[2] = { 0.0, 0.0 };
+
+    //the simulation steps at a fixed 120 Hz, between frames or on a thread of its own. every
+    //step leaves a snapshot of the hierarchy's transforms and frames blend the last two
+    FixedStepClock simulationClock(1.0 / 120.0);
+    std::mutex snapshotMutex;
+    TransformSnapshot previousSnapshot, currentSnapshot;
+    double simulationStepMs = 0.0;
+    int simulationSteps = 0;
+
+    //the fleet hunts the player. line of sight is checked against the scene models' triangles,
+    //frames hand the placed meshes over under the snapshot lock
+    EnemyAI enemyAI;
+    std::vector<MeshInstance> sceneOccluders, simulationOccluders;
+    AiStats aiStats, reportedAiStats;
+    //subs are kept from passing through each other. there's nothing static to hit yet, the wall
+    //hangs off the player's hull
+    CollisionWorld collisionWorld;
+    CollisionStats collisionStats, reportedCollisionStats;
+    auto simulate = [&](double seconds) {
+        std::chrono::high_resolution_clock::time_point stepStart = std::chrono::high_resolution_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(snapshotMutex);
+            simulationOccluders = sceneOccluders;
+        }
+        applyControls(entities, (float)seconds);
+        AiTarget target = { entities.get<Transform>(player).position, entities.get<Velocity>(player).linear };
+        //on the simulation thread this shares the workers with the frames, whichever batch
+        //starts second runs on its own thread alone (see JobSystem)
+        enemyAI.update<Transform, Velocity>(entities, jobs, target, (float)seconds, MeshOccluders{ &simulationOccluders });
+        integrateVelocities(entities, (float)seconds);
+        collisionWorld.update<Transform>(entities, jobs);
+        separateContacts(entities, collisionWorld.getContacts());
+        double stepMs = std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - stepStart).count();
+
+        //frames only read the snapshots, never the simulated components
+        std::lock_guard<std::mutex> lock(snapshotMutex);
+        std::swap(previousSnapshot, currentSnapshot);
+        captureSnapshot(entities, currentSnapshot, elapsedSeconds());
+        aiStats = enemyAI.getStats();
+        collisionStats = collisionWorld.getStats();
+        simulationStepMs += stepMs;
+        simulationSteps++;
+    };
+    captureSnapshot(entities, currentSnapshot, 0.0);
+    previousSnapshot = currentSnapshot;
+    SimulationThread simulationThread(simulationClock.getStepSeconds(), simulate);
 
     /* Loop until the user closes the window */
-    while (!glfwWindowShouldClose(window))
+    while (headless ? frameIndex < headlessFrames : !glfwWindowShouldClose(window))
     {  
         /* Poll for and process events */
-        glfwPollEvents();
-
-        /* Render here */
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        if (!headless)
+            glfwPollEvents();
+
+        GLState::get().beginFrame();
+        gpuTimer.collect();
+        occlusionQueries.beginFrame();
+        if (ringBuffer)
+            ringBuffer->beginFrame();
+
+        //report last frame's stats once a second
+        if (elapsedSeconds() - lastStatsTime >= 1.0) {
+            double statsSeconds = elapsedSeconds() - lastStatsTime;
+            lastStatsTime = elapsedSeconds();
+            std::cout << "gl calls: " << GLState::get().getIssuedCalls() << " issued, "
+                << GLState::get().getElidedCalls() << " elided" << std::endl;
+            std::cout << "frustum culling: " << lastVisibleCount << " visible, " << lastCulledCount
+                << " culled last frame" << std::endl;
+            if (gpuCulling && gpu_culling_enabled) {
+                GLuint visibleCount, impostorCount;
+                gpuCulling->readCounts(visibleCount, impostorCount);
+                std::cout << "gpu culling: " << visibleCount << " meshes and " << impostorCount << " impostors of "
+                    << fleetSize << " fleet instances, " << lastFleetCullMs << " ms cpu" << std::endl;
+            }
+            else {
+                if (occlusion_culling_enabled) {
+                    std::cout << "occlusion culling: " << lastOccludedCount << " occluded by "
+                        << occlusionBuffer.getTriangleCount() << " triangles at " << occlusionBuffer.getWidth() << "x"
+                        << occlusionBuffer.getHeight() << ", " << lastOcclusionMs << " ms" << std::endl;
+                }
+                std::cout << "cpu culling: fleet done in " << lastFleetCullMs << " ms, " << lastImpostorCount
+                    << " impostors" << std::endl;
+            }
+            {
+                std::lock_guard<std::mutex> lock(snapshotMutex);
+                std::cout << "simulation: " << simulationSteps << " steps of " << simulationClock.getStepSeconds() * 1000.0
+                    << " ms " << (simulationThread.isRunning() ? "on its own thread" : "between frames") << ", "
+                    << simulationStepMs / std::max(simulationSteps, 1) << " ms per step, "
+                    << simulationClock.getDroppedSeconds() << " s dropped after stalls, "
+                    << simulationThread.getSkipCount() << " thread skips" << std::endl;
+                simulationStepMs = 0.0;
+                simulationSteps = 0;
+
+                unsigned aiTicks = std::max(aiStats.ticks - reportedAiStats.ticks, 1u);
+                std::cout << "enemy ai: " << aiStats.agents << " subs, " << aiStats.states[AI_PATROL] << " patrolling, "
+                    << aiStats.states[AI_PURSUE] << " pursuing, " << aiStats.states[AI_EVADE] << " evading, "
+                    << aiStats.visible << " can see the player | " << (aiStats.perceptionMs - reportedAiStats.perceptionMs) / aiTicks
+                    << " ms perception + " << (aiStats.thinkingMs - reportedAiStats.thinkingMs) / aiTicks
+                    << " ms planning and steering per tick, " << (aiStats.plans - reportedAiStats.plans) / aiTicks
+                    << " plans per tick" << std::endl;
+                reportedAiStats = aiStats;
+
+                unsigned collisionSteps = std::max(collisionStats.steps - reportedCollisionStats.steps, 1u);
+                std::cout << "collision: " << collisionStats.colliders << " colliders, " << collisionStats.pairs
+                    << " broadphase pairs, " << collisionStats.contacts << " contacts | "
+                    << (collisionStats.broadphaseMs - reportedCollisionStats.broadphaseMs) / collisionSteps << " ms broadphase ("
+                    << (collisionStats.swaps - reportedCollisionStats.swaps) / collisionSteps << " swaps) + "
+                    << (collisionStats.narrowphaseMs - reportedCollisionStats.narrowphaseMs) / collisionSteps
+                    << " ms narrowphase per step" << std::endl;
+                reportedCollisionStats = collisionStats;
+            }
+            const FishSchool::Stats& fishStats = fishSchool.getStats();
+            if (fishStats.steps > 0) {
+                std::cout << "fish: " << fishSchool.size() << " fish, " << fishStats.sortMs / fishStats.steps << " ms sorting + "
+                    << fishStats.steerMs / fishStats.steps << " ms steering + " << fishStats.integrateMs / fishStats.steps
+                    << " ms integrating per step, " << (double)fishStats.neighbors / fishStats.steps / std::max<size_t>(fishSchool.size(), 1)
+                    << " neighbours each" << std::endl;
+                fishSchool.resetStats();
+            }
+            std::cout << "transform hierarchy: " << hierarchy.getNodeCount() << " nodes in " << hierarchy.getLevelCount()
+                << " levels, " << hierarchy.getChangedCount() << " world matrices recomputed last frame" << std::endl;
+            std::cout << "screen size: " << lastSmallCount << " objects under " << screenSizeLod.cullPixels
+                << " pixels culled on the cpu last frame" << std::endl;
+            std::cout << "occlusion queries: " << (double)occlusionQueries.getConditionalDraws() / std::max(statsFrames, 1)
+                << " conditional draws, " << (double)occlusionQueries.getSkippedDraws() / std::max(statsFrames, 1)
+                << " skipped per frame" << std::endl;
+            occlusionQueries.resetStats();
+
+            //what the camera looks at and how crowded it is around the player's sub
+            glm::mat4 cameraWorld = glm::inverse(viewMatrix);
+            float hitDistance;
+            int hitObject = sceneBVH.raycast(glm::vec3(cameraWorld[3]), -glm::vec3(cameraWorld[2]), farPlane, hitDistance);
+            sceneBVH.querySphere(glm::vec3(lastPlayerTransform[3]), 40.0f, nearbyObjects);
+            std::cout << "scene bvh: " << sceneBVH.getNodeCount() << " nodes, " << sceneBVH.getRefitCount()
+                << " refits, " << sceneBVH.getRebuildCount() << " rebuilds, cost " << sceneBVH.getCost()
+                << " (" << sceneBVH.getBuildCost() << " at build) | center ray hits ";
+            if (hitObject >= 0)
+                std::cout << "object " << hitObject << " at " << hitDistance;
+            else
+                std::cout << "nothing";
+            std::cout << ", " << nearbyObjects.size() << " objects within 40 of the player" << std::endl;
+            sceneBVH.resetStats();
+
+            std::cout << "mesh bvh: crosshair on ";
+            if (lastPicked.instance == MeshBVH::INVALID)
+                std::cout << "nothing";
+            else if (lastPickedSub < 0)
+                std::cout << "triangle " << lastPicked.triangle << " of scene model " << lastPicked.instance << " at "
+                    << lastPicked.distance;
+            else
+                std::cout << "triangle " << lastPicked.triangle << " of fleet sub " << lastPickedSub << " at "
+                    << lastPicked.distance;
+            std::cout << " | sonar: " << sonarRays.size() << " rays a ping, " << lastEchoCount << " echoes, nearest at "
+                << lastNearestEcho << ", " << sonarMs / std::max(statsFrames, 1) << " ms per ping ("
+                << sonarRays.size() * statsFrames / std::max(sonarMs, 1e-6) / 1000.0 << " Mrays/s)" << std::endl;
+            sonarMs = 0.0;
+            statsFrames = 0;
+
+            //the player is always one of its own two nearest
+            if (entityGrid.contains(0)) {
+                glm::vec3 playerPosition = entityGrid.getPosition(0);
+                entityGrid.queryRadius(playerPosition, proximityRadius, nearbySubs);
+                entityGrid.queryNearest(playerPosition, 2, FLT_MAX, nearestSubs);
+                std::cout << "spatial hash: " << nearbySubs.size() - 1 << " subs within " << proximityRadius
+                    << " of the player";
+                for (const SpatialHash::Neighbor& neighbor : nearestSubs) {
+                    if (neighbor.id != 0) {
+                        std::cout << ", nearest is sub " << neighbor.id - 1 << " at " << std::sqrt(neighbor.distanceSquared);
+                        break;
+                    }
+                }
+                std::cout << " | " << entityGrid.getCellCount() << " cells, " << entityGrid.getChunkCount()
+                    << " chunks" << std::endl;
+            }
+
+            if (ringBuffer) {
+                std::cout << "ring buffer: " << ringBuffer->getBytesWritten() / statsSeconds / (1024.0 * 1024.0)
+                    << " MB/s written, " << ringBuffer->getStallCount() << " stalls ("
+                    << ringBuffer->getStallMs() << " ms waiting on fences), "
+                    << ringBuffer->getFrameSize() / 1024 << " KB per frame" << std::endl;
+                ringBuffer->resetStats();
+            }
+
+            bool prepass = frameGraph.isPassEnabled(depthPrepassPass);
+            gpuFrameMs[prepass] = gpuTimer.getAverageMs(GPU_FRAME);
+            std::cout << "gpu (prepass " << (prepass ? "on" : "off") << "): frame "
+                << gpuTimer.getAverageMs(GPU_FRAME) << " ms, prepass "
+                << gpuTimer.getAverageMs(GPU_DEPTH_PREPASS) << " ms, opaque "
+                << gpuTimer.getAverageMs(GPU_OPAQUE) << " ms | last reported: prepass off "
+                << gpuFrameMs[0] << " ms, on " << gpuFrameMs[1] << " ms" << std::endl;
+            gpuTimer.reset();
+        }
 
-        x = translate_x_mod;
-        y = translate_y_mod;
-        z = zoom_mod;
-        theta = rotate_x_mod;
-        axis_y = rotate_y_mod;
+        if (depth_prepass_enabled != frameGraph.isPassEnabled(depthPrepassPass)) {
+            //recompiles the graph on the next execute, averages restart for the new setup
+            frameGraph.setPassEnabled(depthPrepassPass, depth_prepass_enabled);
+            gpuTimer.reset();
+        }
 
+        /* Render here */
         //camera.processInput(0.1f);
 
-        glm::mat4 transformation_matrix = glm::translate(
-            identity_matrix4,
-            glm::vec3(x, y, z)
-        );
+        if (sim_thread_enabled != simulationThread.isRunning()) {
+            if (sim_thread_enabled)
+                simulationThread.start();
+            else {
+                simulationThread.stop();
+                simulationClock.reset();
+            }
+        }
 
-        transformation_matrix = glm::scale(
-            transformation_matrix,
-            glm::vec3(scale_x + scale_mod, scale_y + scale_mod, scale_z)
-        );
+        //headless runs advance a fixed 60th of a second per frame so dumps are reproducible
+        double frameTime = headless ? frameIndex / 60.0 : elapsedSeconds();
+        //a long stall would fling the fish out of their box
+        float frameSeconds = (float)std::min(frameTime - lastFrameTime, 0.05);
+        float simulationAlpha = 0.0f;
+        if (!simulationThread.isRunning()) {
+            int steps = simulationClock.advance(frameTime - lastFrameTime);
+            for (int step = 0; step < steps; step++)
+                simulate(simulationClock.getStepSeconds());
+            simulationAlpha = simulationClock.getAlpha();
+        }
+        lastFrameTime = frameTime;
+        {
+            std::lock_guard<std::mutex> lock(snapshotMutex);
+            //the thread's steps land on the wall clock, frames show it up to a step behind
+            if (simulationThread.isRunning()) {
+                simulationAlpha = (float)glm::clamp((elapsedSeconds() - currentSnapshot.time) /
+                    simulationClock.getStepSeconds(), 0.0, 1.0);
+            }
+            syncHierarchy(previousSnapshot, currentSnapshot, simulationAlpha, hierarchy);
+        }
+        hierarchy.update(jobs);
+
+        //scene models draw one by one, the fleet's instanced subs in one upload and one draw call
+        sceneModels.clear();
+        sceneTransforms.clear();
+        size_t fleetCount = 0;
+        entities.forEachArray<Renderable, HierarchyNode>([&](size_t count, const Entity*, Renderable* renderables,
+            HierarchyNode* nodes) {
+            for (size_t i = 0; i < count; i++) {
+                if (!renderables[i].instanced) {
+                    sceneModels.push_back(renderables[i].model);
+                    sceneTransforms.push_back(hierarchy.getWorld(nodes[i].node));
+                    continue;
+                }
+                fleetTransforms[fleetCount] = hierarchy.getWorld(nodes[i].node);
+                fleetMaterials[fleetCount] = renderables[i].material;
+                fleetCount++;
+            }
+        });
+
+        //the shaders take the first light
+        entities.forEach<Transform, Light>([&](Entity, Transform& transform, Light& light) {
+            frame.lightPos = transform.position;
+            frame.lightColor = light.color;
+            frame.ambientStr = light.ambientStr;
+            frame.ambientColor = light.ambientColor;
+            frame.specStr = light.specStr;
+            frame.specPhong = light.specPhong;
+        });
+
+        //mvp and normal matrix once per object instead of once per vertex
+        glm::mat4 viewProjMatrix = projectionMatrix * viewMatrix;
+        sceneMatrices.resize(sceneTransforms.size());
+        computeDrawMatrices(sceneTransforms.data(), sceneTransforms.size(), viewProjMatrix, sceneMatrices.data());
+
+        //cull every submesh of the scene models and every fleet instance in one batch
+        worldBounds.clear();
+        glm::vec3 worldMin, worldMax;
+        for (size_t object = 0; object < sceneModels.size(); object++) {
+            const BoundsSoA& localBounds = sceneModels[object]->getSubmeshBounds();
+            for (size_t i = 0; i < localBounds.size(); i++) {
+                transformBounds(localBounds.getMin(i), localBounds.getMax(i), sceneTransforms[object], worldMin, worldMax);
+                worldBounds.add(worldMin, worldMax);
+            }
+        }
+        size_t fleetBoundsBase = worldBounds.size();
+        sceneInstances.clear();
+        for (size_t object = 0; object < sceneModels.size(); object++) {
+            transformBounds(sceneModels[object]->getBoundsMin(), sceneModels[object]->getBoundsMax(), sceneTransforms[object],
+                worldMin, worldMax);
+            sceneInstances.push_back({ &sceneModels[object]->getBVH(), glm::inverse(sceneTransforms[object]), worldMin, worldMax });
+        }
+        {
+            //the scene models block the fleet's line of sight from the next step on
+            std::lock_guard<std::mutex> lock(snapshotMutex);
+            sceneOccluders = sceneInstances;
+        }
+        for (int i = 0; i < fleetSize; i++) {
+            transformBounds(submarine.getBoundsMin(), submarine.getBoundsMax(), fleetTransforms[i], worldMin, worldMax);
+            worldBounds.add(worldMin, worldMax);
+        }
 
-        transformation_matrix = glm::rotate(
-            transformation_matrix,
-            glm::radians(theta),
-            glm::normalize(glm::vec3(axis_x, axis_y, axis_z))
-        );
+        Frustum frustum = extractFrustum(viewProjMatrix);
+        sceneBVH.update(worldBounds);
+        if (worldBounds.size() >= bvhCullThreshold)
+            lastVisibleCount = sceneBVH.cullFrustum(frustum, visibility);
+        else
+            lastVisibleCount = cullBounds(worldBounds, frustum, visibility);
+        lastPlayerTransform = hierarchy.getWorld(entities.get<HierarchyNode>(player).node);
+
+        //headings outer and elevations inner, so each packet of four fans out from one heading
+        std::chrono::high_resolution_clock::time_point sonarStart = std::chrono::high_resolution_clock::now();
+        glm::vec3 sonarOrigin = glm::vec3(lastPlayerTransform[3]);
+        for (int heading = 0; heading < sonarHeadings; heading++) {
+            float yaw = glm::two_pi<float>() * heading / sonarHeadings;
+            for (int elevation = 0; elevation < sonarElevations; elevation++) {
+                float pitch = glm::radians(-35.0f + 70.0f * elevation / (sonarElevations - 1));
+                sonarRays[heading * sonarElevations + elevation] = { sonarOrigin,
+                    glm::vec3(std::cos(pitch) * std::sin(yaw), std::sin(pitch), std::cos(pitch) * std::cos(yaw)), sonarRange };
+            }
+        }
+        //only the subs whose box comes within range are worth placing, the scene bvh finds those
+        sceneBVH.querySphere(sonarOrigin, sonarRange, sonarObjects);
+        sonarTargets.clear();
+        for (const MeshInstance& placed : sceneInstances) {
+            if (!BVH::contains(placed.min, placed.max, sonarOrigin))
+                sonarTargets.push_back(placed);
+        }
+        for (uint32_t object : sonarObjects) {
+            if (object < fleetBoundsBase)
+                continue;
+            glm::vec3 targetMin = worldBounds.getMin(object);
+            glm::vec3 targetMax = worldBounds.getMax(object);
+            if (!BVH::contains(targetMin, targetMax, sonarOrigin))
+                sonarTargets.push_back({ &submarine.getBVH(), glm::inverse(fleetTransforms[object - fleetBoundsBase]),
+                    targetMin, targetMax });
+        }
+        raycastInstances(sonarTargets, sonarRays.data(), sonarRays.size(), sonarEchoes.data(), raycastScratch);
+        lastEchoCount = 0;
+        lastNearestEcho = sonarRange;
+        for (const MeshHit& echo : sonarEchoes) {
+            if (echo.instance != MeshBVH::INVALID) {
+                lastEchoCount++;
+                lastNearestEcho = std::min(lastNearestEcho, echo.distance);
+            }
+        }
+        sonarMs += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - sonarStart).count();
+
+        //the cursor is captured for mouse look, so picking is whatever sits under the crosshair
+        if (statsFrames == 0) {
+            glm::mat4 cameraWorld = glm::inverse(viewMatrix);
+            MeshRay centerRay = { glm::vec3(cameraWorld[3]), -glm::vec3(cameraWorld[2]), farPlane };
+            glm::vec3 inverseDirection = 1.0f / centerRay.direction;
+            pickTargets = sceneInstances;
+            pickTargetSubs.assign(sceneInstances.size(), -1);
+            for (int i = 0; i < fleetSize; i++) {
+                glm::vec3 targetMin = worldBounds.getMin(fleetBoundsBase + i);
+                glm::vec3 targetMax = worldBounds.getMax(fleetBoundsBase + i);
+                float entry;
+                if (!BVH::intersectBox(targetMin, targetMax, centerRay.origin, inverseDirection, farPlane, entry))
+                    continue;
+                pickTargets.push_back({ &submarine.getBVH(), glm::inverse(fleetTransforms[i]), targetMin, targetMax });
+                pickTargetSubs.push_back(i);
+            }
+            raycastInstances(pickTargets, &centerRay, 1, &lastPicked, raycastScratch);
+            lastPickedSub = lastPicked.instance == MeshBVH::INVALID ? -1 : pickTargetSubs[lastPicked.instance];
+        }
 
-        transformation_matrix = glm::rotate(
-            transformation_matrix,
-            glm::radians(axis_y),
-            glm::normalize(glm::vec3(1.0f, 0.0f, axis_z))
-        );
+        entityGrid.insert(0, glm::vec3(lastPlayerTransform[3]));
+        for (int i = 0; i < fleetSize; i++)
+            entityGrid.insert((uint32_t)i + 1, glm::vec3(fleetTransforms[i][3]));
+
+        //with gpu culling the fleet's cpu results are ignored, every instance goes up and
+        //the compute pass decides
+        bool gpuCullingActive = gpuCulling && gpu_culling_enabled;
+
+        //objects too small to make out are dropped before the costlier tests look at them,
+        //the gpu path tests the fleet itself
+        glm::vec3 eye = glm::vec3(glm::inverse(viewMatrix)[3]);
+        screenSizeLod.eye = eye;
+        screenSizeLod.impostorPixels = impostors_enabled ? impostorPixels : 0.0f;
+        lastSmallCount = 0;
+        size_t sizeTestedCount = gpuCullingActive ? fleetBoundsBase : worldBounds.size();
+        for (size_t i = 0; i < sizeTestedCount; i++) {
+            if (visibility[i] && projectedSize(worldBounds.getMin(i), worldBounds.getMax(i), screenSizeLod) < screenSizeLod.cullPixels) {
+                visibility[i] = 0;
+                lastSmallCount++;
+            }
+        }
+        std::chrono::high_resolution_clock::time_point fleetCullStart = std::chrono::high_resolution_clock::now();
+
+        //fleet subs that survived the frustum test still have to show past the scene models.
+        //only the fleet is tested, the occluders would mostly just test against themselves
+        lastOccludedCount = 0;
+        if (occlusion_culling_enabled && !gpuCullingActive) {
+            std::chrono::high_resolution_clock::time_point occlusionStart = std::chrono::high_resolution_clock::now();
+            occlusionBuffer.clear();
+            for (size_t object = 0; object < sceneModels.size(); object++) {
+                const Model* model = sceneModels[object];
+                occlusionBuffer.addOccluder(model->getOccluderPositions().data(), model->getOccluderIndices().data(),
+                    model->getOccluderIndices().size(), sceneMatrices[object].mvp);
+            }
+            occlusionBuffer.rasterize(jobs);
+
+            size_t fleetVisibleBefore = std::count(visibility.begin() + fleetBoundsBase, visibility.end(), (uint8_t)1);
+            jobs.parallelFor(fleetSize, 64, [&](size_t begin, size_t end, unsigned) {
+                for (size_t i = fleetBoundsBase + begin; i < fleetBoundsBase + end; i++) {
+                    if (visibility[i] && !occlusionBuffer.isVisible(worldBounds.getMin(i), worldBounds.getMax(i), viewProjMatrix))
+                        visibility[i] = 0;
+                }
+            });
+            lastOccludedCount = fleetVisibleBefore - std::count(visibility.begin() + fleetBoundsBase, visibility.end(), (uint8_t)1);
+            lastOcclusionMs = std::chrono::duration<double, std::milli>(
+                std::chrono::high_resolution_clock::now() - occlusionStart).count();
+        }
+        lastCulledCount = worldBounds.size() - lastVisibleCount;
+
+        //expensive scene submeshes that passed the cpu tests draw only if last frame's query on
+        //their box saw samples, and get queried again. a box around the camera would be clipped
+        //by the near plane and fail, those draw unconditionally
+        occlusionQueries.resize(fleetBoundsBase);
+        drawConditions.assign(worldBounds.size(), 0);
+        size_t object = 0;
+        for (Model* model : sceneModels) {
+            for (const Model::Submesh& submesh : model->getSubmeshes()) {
+                glm::vec3 boxMin = worldBounds.getMin(object);
+                glm::vec3 boxMax = worldBounds.getMax(object);
+                bool cameraInside = glm::all(glm::greaterThan(eye, boxMin - 1.0f)) && glm::all(glm::lessThan(eye, boxMax + 1.0f));
+                if (visibility[object] && submesh.indexCount >= conditionalRenderMinIndices && !cameraInside) {
+                    drawConditions[object] = occlusionQueries.useCondition(object);
+                    occlusionQueries.queryBox(object, boxMin, boxMax);
+                }
+                object++;
+            }
+        }
 
-        shader.setProjectionMatrix(projectionMatrix);
-        shader.setViewMatrix(viewMatrix);
+        size_t visibleFleetSize = 0;
+        if (gpuCullingActive) {
+            //the whole fleet goes up every frame now, split the matrix work across the workers
+            jobs.parallelFor(fleetSize, 256, [&](size_t begin, size_t end, unsigned) {
+                computeInstanceData(fleetTransforms.data() + begin, fleetMaterials.data() + begin, end - begin,
+                    fleetInstances.data() + begin);
+            });
+            submarine.setInstances(fleetInstances.data(), fleetSize);
+
+            fleetCommands.clear();
+            for (size_t i = 0; i < submarine.getSubmeshes().size(); i++)
+                fleetCommands.push_back(submarine.getDrawCommand(i));
+            gpuCulling->cull(submarine.getInstanceBuffer(), submarine.getInstanceBase(), (GLuint)fleetSize,
+                fleetCommands.data(), fleetCommands.size(), fleetImpostor.getDrawCommand(0), submarine.getBoundsMin(),
+                submarine.getBoundsMax(), frustum, screenSizeLod);
+            submarine.setCulledInstances(gpuCulling->getInstanceBuffer(), gpuCulling->getIndirectBuffer());
+            fleetImpostor.setCulledInstances(gpuCulling->getImpostorBuffer(), gpuCulling->getIndirectBuffer(),
+                gpuCulling->getImpostorCommand());
+            visibleFleetSize = fleetSize;
+        }
+        else {
+            //only visible instances are uploaded, compacted to the front. the ones small on screen
+            //go to the impostor instead
+            impostorTransforms.clear();
+            impostorMaterials.clear();
+            for (int i = 0; i < fleetSize; i++) {
+                size_t bounds = fleetBoundsBase + i;
+                if (!visibility[bounds])
+                    continue;
+                if (projectedSize(worldBounds.getMin(bounds), worldBounds.getMax(bounds), screenSizeLod) < screenSizeLod.impostorPixels) {
+                    impostorTransforms.push_back(fleetTransforms[i]);
+                    impostorMaterials.push_back(fleetMaterials[i]);
+                    continue;
+                }
+                fleetTransforms[visibleFleetSize] = fleetTransforms[i];
+                visibleFleetMaterials[visibleFleetSize] = fleetMaterials[i];
+                visibleFleetSize++;
+            }
+            computeInstanceData(fleetTransforms.data(), visibleFleetMaterials.data(), visibleFleetSize, fleetInstances.data());
+            submarine.setInstances(fleetInstances.data(), visibleFleetSize);
+
+            impostorInstances.resize(impostorTransforms.size());
+            computeInstanceData(impostorTransforms.data(), impostorMaterials.data(), impostorTransforms.size(),
+                impostorInstances.data());
+            fleetImpostor.setInstances(impostorInstances.data(), impostorInstances.size());
+            lastImpostorCount = impostorInstances.size();
+        }
+        lastFleetCullMs = std::chrono::duration<double, std::milli>(
+            std::chrono::high_resolution_clock::now() - fleetCullStart).count();
+
+        //the sphere around every box of the frame is in the fish's way
+        fishObstacles.clear();
+        for (size_t i = 0; i < worldBounds.size(); i++) {
+            glm::vec3 boxMin = worldBounds.getMin(i), boxMax = worldBounds.getMax(i);
+            fishObstacles.push_back({ (boxMin + boxMax) * 0.5f, glm::length(boxMax - boxMin) * 0.5f });
+        }
+        if (fishSchool.size() > 0) {
+            fishSchool.update(jobs, frameSeconds, fishObstacles);
+            fishSchool.fillInstances(jobs, fishInstances.data());
+            fishMesh.setInstances(fishInstances.data(), fishInstances.size());
+        }
 
-        //disable mask
-        glDepthMask(GL_FALSE);
-        //change depth function into <=
-        glDepthFunc(GL_LEQUAL);
-        //use skybox texture
-        glUseProgram(skyShaderProg);
+        //build this frame's draw list, the queue decides the order
+        drawItems.clear();
+        renderQueue.clear();
+
+        drawItems.push_back({ DrawItem::SKYBOX, nullptr, 0, nullptr, skyboxTex, 0, 1.0f, DrawMatrices(), 0, nullptr, nullptr });
+        renderQueue.submit(RenderKey::opaque(PASS_SKYBOX, skyShaderProg, skyboxTex, skyVAO, 1.0f),
+            (uint32_t)drawItems.size() - 1);
+
+        //every submesh goes to the pass its material class asks for, blended ones get
+        //back to front keys. visible holds a flag per submesh, null submits all of them, and
+        //conditions a query per submesh (or null)
+        auto submitSubmeshes = [&](Model& model, bool instanced, std::vector<Shader>& shaders,
+            const DrawMatrices& matrices, float depth01, const uint8_t* visible, const GLuint* conditions) {
+            const std::vector<Model::Submesh>& submeshes = model.getSubmeshes();
+            for (unsigned i = 0; i < submeshes.size(); i++) {
+                if (visible != nullptr && !visible[i])
+                    continue;
+                const Model::Submesh& submesh = submeshes[i];
+                Shader& submeshShader = shaders[submesh.materialClass];
+                bool blended = submesh.materialClass == MATERIAL_BLENDED;
+
+                DrawItem::Kind kind = instanced ? DrawItem::INSTANCED : blended ? DrawItem::BLENDED_MESH : DrawItem::MESH;
+                drawItems.push_back({ kind, &model, i, &submeshShader, texture, norm_tex, submesh.opacity, matrices,
+                    conditions != nullptr ? conditions[i] : 0, nullptr, nullptr });
+
+                uint64_t key;
+                if (blended)
+                    key = RenderKey::transparent(PASS_TRANSPARENT, submeshShader.getID(), texture, model.getMeshID(i), depth01);
+                else
+                    key = RenderKey::opaque(submesh.materialClass == MATERIAL_ALPHA_TESTED ? PASS_ALPHA_TEST : PASS_OPAQUE,
+                        submeshShader.getID(), texture, model.getMeshID(i), depth01);
+                renderQueue.submit(key, (uint32_t)drawItems.size() - 1);
+            }
+        };
+
+        size_t modelBoundsBase = 0;
+        for (size_t object = 0; object < sceneModels.size(); object++) {
+            Model& model = *sceneModels[object];
+            submitSubmeshes(model, false, sceneShaders, sceneMatrices[object],
+                viewDepth01(viewMatrix, sceneMatrices[object].model, farPlane), visibility.data() + modelBoundsBase,
+                drawConditions.data() + modelBoundsBase);
+            modelBoundsBase += model.getSubmeshBounds().size();
+        }
 
-        glm::mat4 sky_view = glm::mat4(1.f);
-        sky_view = glm::mat4(
-            glm::mat3(viewMatrix)
-        );
+        //the fleet goes in as one instanced draw, keyed at the middle of all its boxes
+        glm::vec3 fleetCenter = glm::vec3(0.0f);
+        for (size_t i = fleetBoundsBase; i < worldBounds.size(); i++)
+            fleetCenter += (worldBounds.getMin(i) + worldBounds.getMax(i)) * 0.5f;
+        fleetCenter /= (float)std::max(worldBounds.size() - fleetBoundsBase, (size_t)1);
+        float fleetDepth01 = viewDepth01(viewMatrix, glm::translate(identity_matrix4, fleetCenter), farPlane);
+        if (visibleFleetSize > 0)
+            submitSubmeshes(submarine, true, fleetShaders, DrawMatrices(), fleetDepth01, nullptr, nullptr);
+
+        //the impostor cuts its silhouette out of the atlas, so it goes with the alpha tested draws.
+        //the gpu path only knows its impostor count on the gpu
+        bool drawImpostors = gpuCullingActive ? impostors_enabled : fleetImpostor.getInstanceCount() > 0;
+        if (drawImpostors) {
+            drawItems.push_back({ DrawItem::IMPOSTOR, nullptr, 0, &impostorShader, fleetImpostor.getAlbedoAtlas(),
+                fleetImpostor.getNormalAtlas(), 1.0f, DrawMatrices(), 0, &fleetImpostor, nullptr });
+            renderQueue.submit(RenderKey::opaque(PASS_ALPHA_TEST, impostorShader.getID(), fleetImpostor.getAlbedoAtlas(),
+                fleetImpostor.getMeshID(), fleetDepth01), (uint32_t)drawItems.size() - 1);
+        }
 
-        unsigned int skyViewLoc = glGetUniformLocation(skyShaderProg, "view");
-        glUniformMatrix4fv(skyViewLoc,
-            1,
-            GL_FALSE,
-            glm::value_ptr(sky_view)
-        );
+        //the fish stay out of the depth prepass with the alpha tested draws, thousands of tiny
+        //triangles would cost it more than the overdraw they'd save
+        if (fishMesh.getInstanceCount() > 0) {
+            drawItems.push_back({ DrawItem::FISH, nullptr, 0, &fishShader, 0, 0, 1.0f, DrawMatrices(), 0, nullptr, &fishMesh });
+            renderQueue.submit(RenderKey::opaque(PASS_ALPHA_TEST, fishShader.getID(), 0, fishMesh.getVertexArray(),
+                viewDepth01(viewMatrix, identity_matrix4, farPlane)), (uint32_t)drawItems.size() - 1);
+        }
 
-        unsigned int skyProjLoc = glGetUniformLocation(skyShaderProg, "projection");
-        glUniformMatrix4fv(skyProjLoc,
-            1,
-            GL_FALSE,
-            glm::value_ptr(projectionMatrix)
-        );
+        renderQueue.sort();
 
-        //bind skybox vao
-        glBindVertexArray(skyVAO);
-        //set texture index to use
-        glActiveTexture(GL_TEXTURE0);
-        //bind cubemap to texture index
-        glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTex);
-        //draw skybox
-        glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
-        //reset depth to true
-        glDepthMask(GL_TRUE);
-        //reset depth to normal
-        glDepthFunc(GL_LESS);
-
-        //draw other stuff below
-        shader.use();
+        //workers record each pass's sorted draws into one command buffer per slice,
+        //then the frame graph replays them on the gl thread pass by pass
+        frame.viewProj = viewProjMatrix;
+        frame.skyView = glm::mat4(glm::mat3(viewMatrix));
+
+        const std::vector<RenderQueue::Item>& queued = renderQueue.getItems();
+        for (unsigned pass = 0; pass < (unsigned)PASS_COUNT; pass++) {
+            std::vector<CommandBuffer>& passBuffers = commandBuffers[pass];
+            for (CommandBuffer& commands : passBuffers)
+                commands.clear();
 
-        glBindVertexArray(VAO);
+            size_t passBegin, passEnd;
+            renderQueue.getPassRange(pass, passBegin, passEnd);
+            size_t sliceSize = jobs.getSliceSize(passEnd - passBegin);
 
-        shader.setTransformMatrix(transformation_matrix);
-        shader.setTextureUniforms(texture, norm_tex);
-        shader.setLightingUniforms(lightPos, lightColor, ambientStr, ambientColor, cameraPos, specStr, specPhong);
+            jobs.parallelSlices(passEnd - passBegin, [&](size_t begin, size_t end, unsigned) {
+                recordDraws(frame, queued, passBegin + begin, passBegin + end, passBuffers[begin / sliceSize]);
+            });
+        }
 
-        
+        for (CommandBuffer& commands : depthPrepassBuffers)
+            commands.clear();
+        if (frameGraph.isPassEnabled(depthPrepassPass)) {
+            size_t opaqueBegin, opaqueEnd;
+            renderQueue.getPassRange(PASS_OPAQUE, opaqueBegin, opaqueEnd);
+            size_t sliceSize = jobs.getSliceSize(opaqueEnd - opaqueBegin);
+
+            jobs.parallelSlices(opaqueEnd - opaqueBegin, [&](size_t begin, size_t end, unsigned) {
+                recordDepthDraws(frame, queued, opaqueBegin + begin, opaqueBegin + end,
+                    depthPrepassBuffers[begin / sliceSize]);
+            });
+        }
 
-        //glDrawArrays(GL_TRIANGLES, 0, fullVertexData.size() / 14);
-        // Draw the model
-        submarine.draw();
-        brickwall.draw();
+        gpuTimer.begin(GPU_FRAME);
+        frameGraph.execute();
+        gpuTimer.end(GPU_FRAME);
+        if (ringBuffer)
+            ringBuffer->endFrame();
+
+        if (headless && !dumpPrefix.empty() && frameIndex % dumpInterval == 0) {
+            char frameName[16];
+            snprintf(frameName, sizeof(frameName), "%04d.png", frameIndex);
+            if (!headlessContext.savePNG(dumpPrefix + frameName))
+                std::cerr << "headless: could not write " << dumpPrefix + frameName << std::endl;
+        }
+        frameIndex++;
+        statsFrames++;
 
         /* Swap front and back buffers */
-        glfwSwapBuffers(window);
+        if (!headless)
+            glfwSwapBuffers(window);
     }
 
-    glDeleteVertexArrays(1, &VAO);
-    glDeleteBuffers(1, &VBO);
+    if (headless) {
+        glFinish();
+        gpuTimer.collect();
+        double seconds = elapsedSeconds();
+        std::cout << "headless: " << frameIndex << " frames in " << seconds * 1000.0 << " ms, "
+            << seconds * 1000.0 / std::max(frameIndex, 1) << " ms per frame, gpu frame "
+            << gpuTimer.getAverageMs(GPU_FRAME) << " ms (" << glGetString(GL_RENDERER) << ")" << std::endl;
+    }
 
-    glfwTerminate();
     return 0;
 }
\ No newline at end of file
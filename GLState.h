@@ -0,0 +1,172 @@
+#pragma once
+
+#include <glad/glad.h>
+
+// thin cache in front of the gl state the frame loop touches. every call compares
+// against what was last set and skips the gl call when it would not change anything,
+// counting issued and elided calls per frame
+class GLState {
+public:
+    static const GLuint MAX_TEXTURE_UNITS = 16;
+
+    static GLState& get() {
+        static GLState state;
+        return state;
+    }
+
+    // call once at the start of every frame, keeps last frame's numbers around for reporting
+    void beginFrame() {
+        lastFrameIssued = issued;
+        lastFrameElided = elided;
+        issued = 0;
+        elided = 0;
+    }
+
+    // forget everything, the next call of each kind always reaches gl
+    void invalidate() {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        activeUnit = UNKNOWN;
+        for (GLuint i = 0; i < MAX_TEXTURE_UNITS; i++) {
+            textures2D[i] = UNKNOWN;
+            texturesCube[i] = UNKNOWN;
+        }
+        blend = depthTest = cullFace = depthMask = UNKNOWN;
+        depthFunc = blendSrc = blendDst = UNKNOWN;
+    }
+
+    void useProgram(GLuint id) {
+        if (!changed(program, id))
+            return;
+        glUseProgram(id);
+    }
+
+    void bindVertexArray(GLuint id) {
+        if (!changed(vertexArray, id))
+            return;
+        glBindVertexArray(id);
+    }
+
+    void bindTexture(GLuint unit, GLenum target, GLuint id) {
+        GLuint* slot = textureSlot(unit, target);
+        if (slot == nullptr)
+            issued++;
+        else if (!changed(*slot, id))
+            return;
+
+        if (changed(activeUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, id);
+    }
+
+    // deletes the textures and forgets any unit still holding one of them, gl is free to
+    // hand the names out again and a bind of the new texture must not be elided
+    void deleteTextures(GLsizei count, const GLuint* ids) {
+        for (GLsizei i = 0; i < count; i++) {
+            for (GLuint unit = 0; unit < MAX_TEXTURE_UNITS; unit++) {
+                if (textures2D[unit] == ids[i])
+                    textures2D[unit] = UNKNOWN;
+                if (texturesCube[unit] == ids[i])
+                    texturesCube[unit] = UNKNOWN;
+            }
+        }
+        glDeleteTextures(count, ids);
+    }
+
+    void setBlend(bool enabled) {
+        setCapability(blend, GL_BLEND, enabled);
+    }
+
+    void setBlendFunc(GLenum src, GLenum dst) {
+        if (blendSrc == src && blendDst == dst) {
+            elided++;
+            return;
+        }
+        blendSrc = src;
+        blendDst = dst;
+        issued++;
+        glBlendFunc(src, dst);
+    }
+
+    void setDepthTest(bool enabled) {
+        setCapability(depthTest, GL_DEPTH_TEST, enabled);
+    }
+
+    void setDepthMask(bool enabled) {
+        if (!changed(depthMask, enabled ? 1u : 0u))
+            return;
+        glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+    }
+
+    void setDepthFunc(GLenum func) {
+        if (!changed(depthFunc, func))
+            return;
+        glDepthFunc(func);
+    }
+
+    void setCullFace(bool enabled) {
+        setCapability(cullFace, GL_CULL_FACE, enabled);
+    }
+
+    GLuint getProgram() const {
+        return program;
+    }
+
+    unsigned getIssuedCalls() const {
+        return lastFrameIssued;
+    }
+
+    unsigned getElidedCalls() const {
+        return lastFrameElided;
+    }
+
+private:
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+
+    GLState() {
+        invalidate();
+    }
+
+    // updates the cached value and counts the call as issued or elided
+    bool changed(GLuint& cached, GLuint value) {
+        if (cached == value) {
+            elided++;
+            return false;
+        }
+        cached = value;
+        issued++;
+        return true;
+    }
+
+    void setCapability(GLuint& cached, GLenum cap, bool enabled) {
+        if (!changed(cached, enabled ? 1u : 0u))
+            return;
+        if (enabled)
+            glEnable(cap);
+        else
+            glDisable(cap);
+    }
+
+    GLuint* textureSlot(GLuint unit, GLenum target) {
+        if (unit >= MAX_TEXTURE_UNITS)
+            return nullptr;
+        if (target == GL_TEXTURE_2D)
+            return &textures2D[unit];
+        if (target == GL_TEXTURE_CUBE_MAP)
+            return &texturesCube[unit];
+        return nullptr;
+    }
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint activeUnit;
+    GLuint textures2D[MAX_TEXTURE_UNITS];
+    GLuint texturesCube[MAX_TEXTURE_UNITS];
+    GLuint blend, depthTest, cullFace, depthMask;
+    GLuint depthFunc, blendSrc, blendDst;
+
+    unsigned issued = 0;
+    unsigned elided = 0;
+    unsigned lastFrameIssued = 0;
+    unsigned lastFrameElided = 0;
+};
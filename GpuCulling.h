@@ -0,0 +1,274 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "GLState.h"
+#include "MeshArena.h"
+#include "FrustumCulling.h"
+
+// instance culling in compute shaders. every instance is tested against the frustum, its size
+// on screen and a hi-z pyramid (max depth mip chain) built from last frame's depth, survivors
+// are compacted into an instance buffer (or the impostor buffer when they're small) and counted
+// straight into indirect draw commands, so the cpu cost is a couple of dispatches however many
+// instances there are. an instance coming out from behind an occluder shows up a frame late,
+// the pyramid is a frame old
+class GpuCulling {
+public:
+    // compute shaders, storage buffers and image load/store
+    static bool supported() {
+        return GLAD_GL_VERSION_4_3 != 0;
+    }
+
+    // the pyramid matches the depth buffer it's built from
+    GpuCulling(int width, int height) : width(width), height(height) {
+        cullProgram = createProgram("Shaders/cull.comp", "");
+        copyCountsProgram = createProgram("Shaders/cull.comp", "#define COPY_COUNTS\n");
+        depthCopyProgram = createProgram("Shaders/hiz.comp", "#define FROM_DEPTH\n");
+        reduceProgram = createProgram("Shaders/hiz.comp", "");
+
+        locations.instanceBase = glGetUniformLocation(cullProgram, "instanceBase");
+        locations.instanceCount = glGetUniformLocation(cullProgram, "instanceCount");
+        locations.boundsMin = glGetUniformLocation(cullProgram, "boundsMin");
+        locations.boundsMax = glGetUniformLocation(cullProgram, "boundsMax");
+        locations.frustumPlanes = glGetUniformLocation(cullProgram, "frustumPlanes");
+        locations.eye = glGetUniformLocation(cullProgram, "eye");
+        locations.pixelScale = glGetUniformLocation(cullProgram, "pixelScale");
+        locations.cullPixels = glGetUniformLocation(cullProgram, "cullPixels");
+        locations.impostorPixels = glGetUniformLocation(cullProgram, "impostorPixels");
+        locations.impostorCommand = glGetUniformLocation(cullProgram, "impostorCommand");
+        locations.useHiZ = glGetUniformLocation(cullProgram, "useHiZ");
+        locations.hiZViewProj = glGetUniformLocation(cullProgram, "hiZViewProj");
+        locations.hiZLevels = glGetUniformLocation(cullProgram, "hiZLevels");
+        locations.commandCount = glGetUniformLocation(copyCountsProgram, "commandCount");
+
+        levels = 1 + (int)std::floor(std::log2((float)std::max(width, height)));
+        glGenTextures(1, &hiZ);
+        GLState::get().bindTexture(0, GL_TEXTURE_2D, hiZ);
+        glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, width, height);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+        //the shader copies instances as 26 words each
+        static_assert(sizeof(InstanceData) == 26 * sizeof(GLuint), "cull.comp expects 104 byte instances");
+
+        glGenBuffers(1, &visibleBuffer);
+        glGenBuffers(1, &impostorBuffer);
+        glGenBuffers(1, &indirectBuffer);
+    }
+
+    ~GpuCulling() {
+        glDeleteProgram(cullProgram);
+        glDeleteProgram(copyCountsProgram);
+        glDeleteProgram(depthCopyProgram);
+        glDeleteProgram(reduceProgram);
+        glDeleteTextures(1, &hiZ);
+        glDeleteBuffers(1, &visibleBuffer);
+        glDeleteBuffers(1, &impostorBuffer);
+        glDeleteBuffers(1, &indirectBuffer);
+    }
+
+    // culls count InstanceData starting at index base of source. commands are the per submesh
+    // draws of the instanced mesh, their instance counts are replaced by the visible count.
+    // impostorCommand draws the mesh's impostor, it goes in after them and counts the instances
+    // below lod's impostor size. boundsMin/Max is the mesh's local box
+    void cull(GLuint source, GLuint base, GLuint count, const DrawElementsIndirectCommand* commands,
+        size_t commandCount, const DrawElementsIndirectCommand& impostorCommand, const glm::vec3& boundsMin,
+        const glm::vec3& boundsMax, const Frustum& frustum, const ScreenSizeLod& lod) {
+        if (count > capacity) {
+            capacity = count;
+            for (GLuint buffer : { visibleBuffer, impostorBuffer }) {
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+                glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(InstanceData) * capacity, NULL, GL_DYNAMIC_COPY);
+            }
+        }
+
+        //counts start at 0, the shader adds to the first command and copies it to the others
+        indirectCommands.assign(commands, commands + commandCount);
+        indirectCommands.push_back(impostorCommand);
+        for (DrawElementsIndirectCommand& command : indirectCommands) {
+            command.instanceCount = 0;
+            command.baseInstance = 0;
+        }
+        impostorCommandIndex = (GLuint)commandCount;
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, indirectBuffer);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(DrawElementsIndirectCommand) * indirectCommands.size(),
+            indirectCommands.data(), GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        if (count == 0 || commandCount == 0)
+            return;
+
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, source);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, visibleBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, indirectBuffer);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, impostorBuffer);
+
+        GLState& state = GLState::get();
+        state.useProgram(cullProgram);
+        glUniform1ui(locations.instanceBase, base);
+        glUniform1ui(locations.instanceCount, count);
+        glUniform3fv(locations.boundsMin, 1, glm::value_ptr(boundsMin));
+        glUniform3fv(locations.boundsMax, 1, glm::value_ptr(boundsMax));
+        glUniform4fv(locations.frustumPlanes, 6, glm::value_ptr(frustum.planes[0]));
+        glUniform3fv(locations.eye, 1, glm::value_ptr(lod.eye));
+        glUniform1f(locations.pixelScale, lod.pixelScale);
+        glUniform1f(locations.cullPixels, lod.cullPixels);
+        glUniform1f(locations.impostorPixels, lod.impostorPixels);
+        glUniform1ui(locations.impostorCommand, impostorCommandIndex);
+        glUniform1i(locations.useHiZ, hiZValid);
+        glUniformMatrix4fv(locations.hiZViewProj, 1, GL_FALSE, glm::value_ptr(hiZViewProj));
+        glUniform1i(locations.hiZLevels, levels);
+        //the pyramid is sampled from unit 0, the sampler uniform's default
+        state.bindTexture(0, GL_TEXTURE_2D, hiZ);
+        glDispatchCompute((count + 63) / 64, 1, 1);
+
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+        state.useProgram(copyCountsProgram);
+        glUniform1ui(locations.commandCount, (GLuint)commandCount);
+        glDispatchCompute(1, 1, 1);
+
+        //the draws read the counts as indirect commands and the instances as vertex attributes
+        glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+    }
+
+    // builds the pyramid from depthTexture, rendered with viewProj. the next cull tests
+    // against it
+    void buildHiZ(GLuint depthTexture, const glm::mat4& viewProj) {
+        GLState& state = GLState::get();
+        state.useProgram(depthCopyProgram);
+        state.bindTexture(0, GL_TEXTURE_2D, depthTexture);
+        glBindImageTexture(1, hiZ, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        glDispatchCompute((width + 7) / 8, (height + 7) / 8, 1);
+
+        state.useProgram(reduceProgram);
+        for (int level = 1; level < levels; level++) {
+            glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+            glBindImageTexture(0, hiZ, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+            glBindImageTexture(1, hiZ, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+            GLuint levelWidth = std::max(width >> level, 1);
+            GLuint levelHeight = std::max(height >> level, 1);
+            glDispatchCompute((levelWidth + 7) / 8, (levelHeight + 7) / 8, 1);
+        }
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+        hiZViewProj = viewProj;
+        hiZValid = true;
+    }
+
+    // compacted instances, bind as the instance buffer with baseInstance 0
+    GLuint getInstanceBuffer() const {
+        return visibleBuffer;
+    }
+
+    // the instances that went to the impostor, bind with baseInstance 0
+    GLuint getImpostorBuffer() const {
+        return impostorBuffer;
+    }
+
+    // one DrawElementsIndirectCommand per submesh, in the order they were passed to cull,
+    // followed by the impostor's
+    GLuint getIndirectBuffer() const {
+        return indirectBuffer;
+    }
+
+    GLuint getImpostorCommand() const {
+        return impostorCommandIndex;
+    }
+
+    // reads the last cull's mesh and impostor counts back. waits for the gpu, stats only
+    void readCounts(GLuint& visible, GLuint& impostors) const {
+        DrawElementsIndirectCommand meshCommand = {}, impostorCommand = {};
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, indirectBuffer);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(meshCommand), &meshCommand);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(impostorCommand) * impostorCommandIndex,
+            sizeof(impostorCommand), &impostorCommand);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        visible = meshCommand.instanceCount;
+        impostors = impostorCommand.instanceCount;
+    }
+
+    int getLevelCount() const {
+        return levels;
+    }
+
+private:
+    static GLuint createProgram(const std::string& path, const std::string& defines) {
+        std::ifstream file(path);
+        std::stringstream stream;
+        stream << file.rdbuf();
+        std::string code = stream.str();
+
+        //#version has to stay the first line
+        size_t lineEnd = code.find('\n');
+        if (!defines.empty() && lineEnd != std::string::npos)
+            code = code.substr(0, lineEnd + 1) + defines + code.substr(lineEnd + 1);
+        const char* source = code.c_str();
+
+        GLint success;
+        GLchar infoLog[512];
+        GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(shader, 1, &source, NULL);
+        glCompileShader(shader);
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success) {
+            glGetShaderInfoLog(shader, 512, NULL, infoLog);
+            std::cout << "Compute shader compilation failed (" << path << "):\n" << infoLog << std::endl;
+        }
+
+        GLuint program = glCreateProgram();
+        glAttachShader(program, shader);
+        glLinkProgram(program);
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success) {
+            glGetProgramInfoLog(program, 512, NULL, infoLog);
+            std::cout << "Compute program linking failed (" << path << "):\n" << infoLog << std::endl;
+        }
+        glDeleteShader(shader);
+        return program;
+    }
+
+    int width;
+    int height;
+    int levels = 1;
+
+    GLuint cullProgram = 0;
+    GLuint copyCountsProgram = 0;
+    GLuint depthCopyProgram = 0;
+    GLuint reduceProgram = 0;
+
+    struct {
+        GLint instanceBase;
+        GLint instanceCount;
+        GLint boundsMin;
+        GLint boundsMax;
+        GLint frustumPlanes;
+        GLint eye;
+        GLint pixelScale;
+        GLint cullPixels;
+        GLint impostorPixels;
+        GLint impostorCommand;
+        GLint useHiZ;
+        GLint hiZViewProj;
+        GLint hiZLevels;
+        GLint commandCount;
+    } locations;
+
+    GLuint hiZ = 0;
+    glm::mat4 hiZViewProj = glm::mat4(1.0f);
+    //nothing to test against until the first buildHiZ
+    bool hiZValid = false;
+
+    GLuint visibleBuffer = 0;
+    GLuint impostorBuffer = 0;
+    GLuint indirectBuffer = 0;
+    GLuint impostorCommandIndex = 0;
+    GLuint capacity = 0;
+    std::vector<DrawElementsIndirectCommand> indirectCommands;
+};
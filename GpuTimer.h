@@ -0,0 +1,102 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <vector>
+
+// gpu time of named scopes from GL_TIMESTAMP query pairs. every scope keeps a few frames of
+// queries in flight and results are only read once they are available, so timing never
+// stalls the pipeline. scopes may nest or overlap, unlike GL_TIME_ELAPSED queries
+class GpuTimer {
+public:
+    static const unsigned LATENCY = 4;
+
+    GpuTimer(unsigned scopeCount) : scopes(scopeCount) {
+        for (Scope& scope : scopes)
+            glGenQueries(LATENCY * 2, scope.queries);
+    }
+
+    ~GpuTimer() {
+        for (Scope& scope : scopes)
+            glDeleteQueries(LATENCY * 2, scope.queries);
+    }
+
+    void begin(unsigned scope) {
+        Scope& s = scopes[scope];
+        unsigned slot = s.next % LATENCY;
+        //still waiting on a result from LATENCY frames ago, skip this sample rather than wait
+        if (s.pending[slot]) {
+            s.skipped++;
+            s.active = false;
+            return;
+        }
+        glQueryCounter(s.queries[slot * 2], GL_TIMESTAMP);
+        s.active = true;
+    }
+
+    void end(unsigned scope) {
+        Scope& s = scopes[scope];
+        if (!s.active)
+            return;
+        unsigned slot = s.next % LATENCY;
+        glQueryCounter(s.queries[slot * 2 + 1], GL_TIMESTAMP);
+        s.pending[slot] = true;
+        s.active = false;
+        s.next++;
+    }
+
+    // reads back every finished query pair, call once per frame
+    void collect() {
+        for (Scope& s : scopes) {
+            for (unsigned slot = 0; slot < LATENCY; slot++) {
+                if (!s.pending[slot])
+                    continue;
+
+                GLint available = 0;
+                glGetQueryObjectiv(s.queries[slot * 2 + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    continue;
+
+                GLuint64 start = 0, end = 0;
+                glGetQueryObjectui64v(s.queries[slot * 2], GL_QUERY_RESULT, &start);
+                glGetQueryObjectui64v(s.queries[slot * 2 + 1], GL_QUERY_RESULT, &end);
+                s.totalNs += end - start;
+                s.samples++;
+                s.pending[slot] = false;
+            }
+        }
+    }
+
+    // average since the last reset, 0 when the scope produced nothing
+    double getAverageMs(unsigned scope) const {
+        const Scope& s = scopes[scope];
+        return s.samples == 0 ? 0.0 : (double)s.totalNs / s.samples * 1e-6;
+    }
+
+    unsigned getSkipped(unsigned scope) const {
+        return scopes[scope].skipped;
+    }
+
+    // drops accumulated samples, queries still in flight land in the next average
+    void reset() {
+        for (Scope& s : scopes) {
+            s.totalNs = 0;
+            s.samples = 0;
+            s.skipped = 0;
+        }
+    }
+
+private:
+    struct Scope {
+        //begin and end timestamp per slot
+        GLuint queries[LATENCY * 2];
+        bool pending[LATENCY] = {};
+        unsigned next = 0;
+        bool active = false;
+
+        GLuint64 totalNs = 0;
+        unsigned samples = 0;
+        unsigned skipped = 0;
+    };
+
+    std::vector<Scope> scopes;
+};
@@ -0,0 +1,221 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// build with HEADLESS_EGL (and link libEGL) to get the context from EGL's surfaceless
+// platform instead of glfw, for machines with no display server at all (mesa llvmpipe on ci).
+// without it the context comes from an invisible glfw window
+#ifdef HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+// gl context plus an offscreen framebuffer standing in for the window's backbuffer
+class HeadlessContext {
+public:
+    ~HeadlessContext() {
+        if (framebuffer != 0) {
+            glDeleteFramebuffers(1, &framebuffer);
+            glDeleteRenderbuffers(1, &colorBuffer);
+        }
+#ifdef HEADLESS_EGL
+        if (display != EGL_NO_DISPLAY) {
+            eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            eglDestroyContext(display, context);
+            eglTerminate(display);
+        }
+#endif
+    }
+
+    // makes the context current and loads gl, false when no context could be made
+    bool create(int contextWidth, int contextHeight) {
+        width = contextWidth;
+        height = contextHeight;
+
+#ifdef HEADLESS_EGL
+        PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+            (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+        if (getPlatformDisplay == nullptr)
+            return false;
+        display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL))
+            return false;
+        eglBindAPI(EGL_OPENGL_API);
+
+        //compatibility profile, the skybox and the fallback paths still use it
+        const EGLint contextAttributes[] = {
+            EGL_CONTEXT_MAJOR_VERSION, 4,
+            EGL_CONTEXT_MINOR_VERSION, 5,
+            EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_COMPATIBILITY_PROFILE_BIT,
+            EGL_NONE
+        };
+        context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttributes);
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+            return false;
+        if (!gladLoadGLLoader((GLADloadproc)eglGetProcAddress))
+            return false;
+#else
+        if (!glfwInit())
+            return false;
+        glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+        window = glfwCreateWindow(width, height, "MachineProject", NULL, NULL);
+        if (!window)
+            return false;
+        glfwMakeContextCurrent(window);
+        if (!gladLoadGL())
+            return false;
+#endif
+
+        glGenRenderbuffers(1, &colorBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        return complete;
+    }
+
+    // null on the egl path, there is no window at all
+    GLFWwindow* getWindow() const {
+        return window;
+    }
+
+    GLuint getFramebuffer() const {
+        return framebuffer;
+    }
+
+    int getWidth() const {
+        return width;
+    }
+
+    int getHeight() const {
+        return height;
+    }
+
+    // reads the offscreen framebuffer back and writes it as an rgb png
+    bool savePNG(const std::string& path) {
+        std::vector<unsigned char> pixels((size_t)width * height * 4);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+        //png rows go top down with a filter byte in front, gl's go bottom up
+        size_t rowSize = (size_t)width * 3 + 1;
+        std::vector<unsigned char> rows(rowSize * height);
+        for (int y = 0; y < height; y++) {
+            unsigned char* row = &rows[rowSize * y];
+            const unsigned char* source = &pixels[(size_t)width * 4 * (height - 1 - y)];
+            row[0] = 0;
+            for (int x = 0; x < width; x++) {
+                row[1 + x * 3] = source[x * 4];
+                row[2 + x * 3] = source[x * 4 + 1];
+                row[3 + x * 3] = source[x * 4 + 2];
+            }
+        }
+
+        FILE* file = fopen(path.c_str(), "wb");
+        if (file == nullptr)
+            return false;
+
+        const unsigned char signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+        fwrite(signature, 1, sizeof(signature), file);
+
+        std::vector<unsigned char> header;
+        appendBigEndian(header, (uint32_t)width);
+        appendBigEndian(header, (uint32_t)height);
+        //8 bit rgb, no interlacing
+        const unsigned char format[] = { 8, 2, 0, 0, 0 };
+        header.insert(header.end(), format, format + sizeof(format));
+        writeChunk(file, "IHDR", header);
+        writeChunk(file, "IDAT", storeDeflate(rows));
+        writeChunk(file, "IEND", std::vector<unsigned char>());
+
+        fclose(file);
+        return true;
+    }
+
+private:
+    static void appendBigEndian(std::vector<unsigned char>& out, uint32_t value) {
+        out.push_back((unsigned char)(value >> 24));
+        out.push_back((unsigned char)(value >> 16));
+        out.push_back((unsigned char)(value >> 8));
+        out.push_back((unsigned char)value);
+    }
+
+    static uint32_t crc32(const unsigned char* data, size_t size, uint32_t crc) {
+        crc = ~crc;
+        for (size_t i = 0; i < size; i++) {
+            crc ^= data[i];
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+        return ~crc;
+    }
+
+    static void writeChunk(FILE* file, const char* type, const std::vector<unsigned char>& data) {
+        std::vector<unsigned char> length;
+        appendBigEndian(length, (uint32_t)data.size());
+        fwrite(length.data(), 1, length.size(), file);
+        fwrite(type, 1, 4, file);
+        if (!data.empty())
+            fwrite(data.data(), 1, data.size(), file);
+
+        uint32_t crc = crc32((const unsigned char*)type, 4, 0);
+        crc = crc32(data.data(), data.size(), crc);
+        std::vector<unsigned char> footer;
+        appendBigEndian(footer, crc);
+        fwrite(footer.data(), 1, footer.size(), file);
+    }
+
+    // zlib stream made of uncompressed deflate blocks, bigger files but no compressor needed
+    static std::vector<unsigned char> storeDeflate(const std::vector<unsigned char>& data) {
+        std::vector<unsigned char> out;
+        out.push_back(0x78);
+        out.push_back(0x01);
+
+        const size_t maxBlock = 65535;
+        size_t offset = 0;
+        do {
+            size_t size = std::min(maxBlock, data.size() - offset);
+            bool last = offset + size == data.size();
+            out.push_back(last ? 1 : 0);
+            out.push_back((unsigned char)size);
+            out.push_back((unsigned char)(size >> 8));
+            out.push_back((unsigned char)~size);
+            out.push_back((unsigned char)(~size >> 8));
+            out.insert(out.end(), data.begin() + offset, data.begin() + offset + size);
+            offset += size;
+        } while (offset < data.size());
+
+        //adler32 of the uncompressed data
+        uint32_t a = 1, b = 0;
+        for (unsigned char byte : data) {
+            a = (a + byte) % 65521;
+            b = (b + a) % 65521;
+        }
+        appendBigEndian(out, (b << 16) | a);
+        return out;
+    }
+
+    int width = 0;
+    int height = 0;
+    GLFWwindow* window = nullptr;
+    GLuint framebuffer = 0;
+    GLuint colorBuffer = 0;
+
+#ifdef HEADLESS_EGL
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+#endif
+};
@@ -0,0 +1,212 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <functional>
+#include <iostream>
+#include <cmath>
+#include "GLState.h"
+#include "MeshArena.h"
+
+// octahedral impostor of one mesh: the mesh is rendered once from FRAMES x FRAMES directions
+// spread over the whole sphere into an albedo and an object space normal atlas, and distant
+// instances draw a single quad showing the frame nearest to their view direction, lit like the
+// mesh. the quad is an arena mesh, so impostor instances go through the same instance buffer
+// and indirect paths as the mesh they stand in for
+class Impostor {
+public:
+    static const int FRAMES = 8;
+    typedef std::function<void(const glm::mat4& viewProj)> DrawFunction;
+
+    // frameSize is each frame's side in texels, a power of two keeps every mip texel inside
+    // one frame
+    Impostor(MeshArena& arena, int frameSize = 128) : arena(arena), frameSize(frameSize), instanceUpload(arena) {
+        //corners in -1..1, the rest of the vertex format is unused
+        GLfloat vertices[4 * MeshArena::VERTEX_FLOATS] = {};
+        const GLfloat corners[] = { -1.0f, -1.0f, 1.0f, -1.0f, 1.0f, 1.0f, -1.0f, 1.0f };
+        for (int i = 0; i < 4; i++) {
+            vertices[i * MeshArena::VERTEX_FLOATS] = corners[i * 2];
+            vertices[i * MeshArena::VERTEX_FLOATS + 1] = corners[i * 2 + 1];
+        }
+        const GLuint indices[] = { 0, 1, 2, 2, 3, 0 };
+        quad = arena.add(vertices, 4, indices, 6);
+
+        int size = frameSize * FRAMES;
+        albedo = createAtlas(size);
+        normals = createAtlas(size);
+    }
+
+    ~Impostor() {
+        glDeleteTextures(1, &albedo);
+        glDeleteTextures(1, &normals);
+    }
+
+    // direction on the unit sphere to -1..1 on the octahedron unfolded into a square, +y in
+    // the middle and -y folded out to the corners
+    static glm::vec2 encodeDirection(const glm::vec3& direction) {
+        glm::vec3 d = direction / (std::abs(direction.x) + std::abs(direction.y) + std::abs(direction.z));
+        glm::vec2 p(d.x, d.z);
+        if (d.y < 0.0f) {
+            p = glm::vec2((1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+                (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+        }
+        return p;
+    }
+
+    static glm::vec3 decodeDirection(const glm::vec2& p) {
+        glm::vec3 d(p.x, 1.0f - std::abs(p.x) - std::abs(p.y), p.y);
+        if (d.y < 0.0f) {
+            d.x = (1.0f - std::abs(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f);
+            d.z = (1.0f - std::abs(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f);
+        }
+        return glm::normalize(d);
+    }
+
+    // view direction (object space, from the mesh towards the eye) of frame x, y
+    static glm::vec3 frameDirection(int x, int y) {
+        return decodeDirection((glm::vec2(x, y) + 0.5f) / (float)FRAMES * 2.0f - 1.0f);
+    }
+
+    // renders every frame into the atlases. draw draws the mesh in object space with viewProj,
+    // through a program that writes albedo to target 0 and the normal to target 1 (bake.frag).
+    // the quad of an instance spans the sphere around boundsMin/Max, so the frames are
+    // orthographic views of that sphere
+    void bake(const glm::vec3& boundsMin, const glm::vec3& boundsMax, const DrawFunction& draw) {
+        center = (boundsMin + boundsMax) * 0.5f;
+        radius = glm::length(boundsMax - boundsMin) * 0.5f;
+
+        int size = frameSize * FRAMES;
+        GLuint framebuffer, depth;
+        glGenFramebuffers(1, &framebuffer);
+        glGenRenderbuffers(1, &depth);
+        glBindRenderbuffer(GL_RENDERBUFFER, depth);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, size, size);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, albedo, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, normals, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth);
+        const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, drawBuffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "impostor: bake framebuffer incomplete" << std::endl;
+
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        //alpha 0 is empty, the impostor shader discards it
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        GLState::get().setDepthMask(true);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        glm::mat4 projection = glm::ortho(-radius, radius, -radius, radius, 0.0f, radius * 2.0f);
+        for (int y = 0; y < FRAMES; y++) {
+            for (int x = 0; x < FRAMES; x++) {
+                glm::vec3 direction = frameDirection(x, y);
+                glm::mat4 view = glm::lookAt(center + direction * radius, center, frameUp(direction));
+                glViewport(x * frameSize, y * frameSize, frameSize, frameSize);
+                draw(projection * view);
+            }
+        }
+
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        glDeleteRenderbuffers(1, &depth);
+        glDeleteFramebuffers(1, &framebuffer);
+
+        for (GLuint atlas : { albedo, normals }) {
+            GLState::get().bindTexture(0, GL_TEXTURE_2D, atlas);
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+    }
+
+    // up vector the frames are rendered with, impostor.vert builds the same quad axes
+    static glm::vec3 frameUp(const glm::vec3& direction) {
+        return std::abs(direction.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+    }
+
+    // this frame's impostor instances, uploaded like Model::setInstances
+    void setInstances(const InstanceData* instances, size_t count) {
+        instanceUpload.set(instances, count);
+    }
+
+    // the instances were picked on the gpu: they live in buffer and their count in the
+    // command-th command of indirect
+    void setCulledInstances(GLuint buffer, GLuint indirect, GLuint command) {
+        instanceUpload.setCulled(buffer, indirect, command);
+    }
+
+    GLuint getInstanceBuffer() const {
+        return instanceUpload.getBuffer();
+    }
+
+    // 0 unless setCulledInstances was called since the last setInstances
+    GLuint getIndirectBuffer() const {
+        return instanceUpload.getIndirectBuffer();
+    }
+
+    GLuint getIndirectCommand() const {
+        return instanceUpload.getIndirectCommand();
+    }
+
+    GLuint getInstanceCount() const {
+        return instanceUpload.getCount();
+    }
+
+    // every instance from setInstances, or one for the gpu to fill in with instances
+    DrawElementsIndirectCommand getDrawCommand(GLuint instances) const {
+        DrawElementsIndirectCommand command = arena.getCommand(quad, instances);
+        command.baseInstance = instanceUpload.getBase();
+        return command;
+    }
+
+    DrawElementsIndirectCommand getDrawCommand() const {
+        return getDrawCommand(instanceUpload.getCount());
+    }
+
+    // identifies the quad in render queue sort keys
+    GLuint getMeshID() const {
+        return quad;
+    }
+
+    GLuint getAlbedoAtlas() const {
+        return albedo;
+    }
+
+    GLuint getNormalAtlas() const {
+        return normals;
+    }
+
+    // object space sphere the quads span, set by bake
+    const glm::vec3& getCenter() const {
+        return center;
+    }
+
+    float getRadius() const {
+        return radius;
+    }
+
+private:
+    GLuint createAtlas(int size) {
+        GLuint atlas;
+        glGenTextures(1, &atlas);
+        GLState::get().bindTexture(0, GL_TEXTURE_2D, atlas);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size, size, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        //stop where a texel would cover more than one frame
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)std::log2((float)frameSize));
+        return atlas;
+    }
+
+    MeshArena& arena;
+    int frameSize;
+    MeshArena::MeshHandle quad;
+    GLuint albedo = 0;
+    GLuint normals = 0;
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = 1.0f;
+
+    InstanceUpload instanceUpload;
+};
@@ -0,0 +1,153 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+// small worker pool for data parallel frame work. the calling thread joins in, so with
+// zero workers everything simply runs inline. never touches gl, workers have no context.
+// the workers take one batch at a time: a batch started while another is in flight, from
+// another thread or from inside fn, runs inline on the thread that started it, as a single
+// call over all of [0, count). so fn must handle any [begin, end) it is given, never just
+// chunkSize items
+class JobSystem {
+public:
+    // thread index 0 is the caller, workers are 1 to getThreadCount() - 1
+    typedef std::function<void(size_t begin, size_t end, unsigned threadIndex)> RangeFunction;
+
+    JobSystem(unsigned workerCount = defaultWorkerCount()) {
+        for (unsigned i = 0; i < workerCount; i++)
+            workers.emplace_back(&JobSystem::workerLoop, this, i + 1);
+    }
+
+    ~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            quitting = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers)
+            worker.join();
+    }
+
+    unsigned getThreadCount() const {
+        return (unsigned)workers.size() + 1;
+    }
+
+    // runs fn over [0, count) in chunks of chunkSize and returns once every chunk is done.
+    // chunkSize is a hint, a call can cover several chunks (see above)
+    void parallelFor(size_t count, size_t chunkSize, const RangeFunction& fn) {
+        if (count == 0)
+            return;
+        chunkSize = std::max<size_t>(chunkSize, 1);
+
+        std::shared_ptr<Batch> batch = std::make_shared<Batch>();
+        batch->fn = fn;
+        batch->count = count;
+        batch->chunkSize = chunkSize;
+        batch->chunks = (count + chunkSize - 1) / chunkSize;
+        batch->nextChunk = 0;
+        batch->remaining = batch->chunks;
+
+        //nothing to share, skip the wake up
+        if (workers.empty() || batch->chunks == 1) {
+            fn(0, count, 0);
+            return;
+        }
+
+        bool workersBusy;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            workersBusy = current != nullptr;
+            if (!workersBusy) {
+                current = batch;
+                generation++;
+            }
+        }
+        if (workersBusy) {
+            fn(0, count, 0);
+            return;
+        }
+        wake.notify_all();
+
+        runChunks(*batch, 0);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [&] { return batch->remaining.load() == 0; });
+        current.reset();
+    }
+
+    // one contiguous slice per thread, handy when every slice fills its own output.
+    // the slice index is begin / getSliceSize(count)
+    void parallelSlices(size_t count, const RangeFunction& fn) {
+        parallelFor(count, getSliceSize(count), fn);
+    }
+
+    size_t getSliceSize(size_t count) const {
+        size_t threads = getThreadCount();
+        return std::max<size_t>((count + threads - 1) / threads, 1);
+    }
+
+    static unsigned defaultWorkerCount() {
+        unsigned hardware = std::thread::hardware_concurrency();
+        return hardware > 1 ? hardware - 1 : 0;
+    }
+
+private:
+    struct Batch {
+        RangeFunction fn;
+        size_t count;
+        size_t chunkSize;
+        size_t chunks;
+        std::atomic<size_t> nextChunk;
+        std::atomic<size_t> remaining;
+    };
+
+    void runChunks(Batch& batch, unsigned threadIndex) {
+        while (true) {
+            size_t chunk = batch.nextChunk.fetch_add(1);
+            if (chunk >= batch.chunks)
+                return;
+
+            size_t begin = chunk * batch.chunkSize;
+            size_t end = std::min(begin + batch.chunkSize, batch.count);
+            batch.fn(begin, end, threadIndex);
+
+            if (batch.remaining.fetch_sub(1) == 1) {
+                //take the lock so the waiting caller can't miss the notify
+                std::lock_guard<std::mutex> lock(mutex);
+                done.notify_all();
+            }
+        }
+    }
+
+    void workerLoop(unsigned threadIndex) {
+        unsigned long long seenGeneration = 0;
+        while (true) {
+            std::shared_ptr<Batch> batch;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return quitting || generation != seenGeneration; });
+                if (quitting)
+                    return;
+                seenGeneration = generation;
+                batch = current;
+            }
+            if (batch)
+                runChunks(*batch, threadIndex);
+        }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::shared_ptr<Batch> current;
+    unsigned long long generation = 0;
+    bool quitting = false;
+};
@@ -0,0 +1,582 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+#include "GLState.h"
+#include "DrawMatrices.h"
+#include "RingBuffer.h"
+
+// layout of glMultiDrawElementsIndirect commands
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+// first fit free list over [0, capacity), neighbouring free ranges are merged on release
+class RangeAllocator {
+public:
+    RangeAllocator(GLuint initialCapacity = 0) : capacity(0) {
+        grow(initialCapacity);
+    }
+
+    bool allocate(GLuint size, GLuint& offset) {
+        for (size_t i = 0; i < freeRanges.size(); i++) {
+            if (freeRanges[i].size < size)
+                continue;
+
+            offset = freeRanges[i].offset;
+            freeRanges[i].offset += size;
+            freeRanges[i].size -= size;
+            if (freeRanges[i].size == 0)
+                freeRanges.erase(freeRanges.begin() + i);
+            return true;
+        }
+        return false;
+    }
+
+    void release(GLuint offset, GLuint size) {
+        if (size == 0)
+            return;
+
+        //keep the list sorted by offset
+        size_t i = 0;
+        while (i < freeRanges.size() && freeRanges[i].offset < offset)
+            i++;
+        freeRanges.insert(freeRanges.begin() + i, { offset, size });
+
+        //merge with the next range, then with the previous one
+        if (i + 1 < freeRanges.size() && freeRanges[i].offset + freeRanges[i].size == freeRanges[i + 1].offset) {
+            freeRanges[i].size += freeRanges[i + 1].size;
+            freeRanges.erase(freeRanges.begin() + i + 1);
+        }
+        if (i > 0 && freeRanges[i - 1].offset + freeRanges[i - 1].size == freeRanges[i].offset) {
+            freeRanges[i - 1].size += freeRanges[i].size;
+            freeRanges.erase(freeRanges.begin() + i);
+        }
+    }
+
+    void grow(GLuint newCapacity) {
+        if (newCapacity <= capacity)
+            return;
+        GLuint oldCapacity = capacity;
+        capacity = newCapacity;
+        release(oldCapacity, newCapacity - oldCapacity);
+    }
+
+    // everything below used is taken, everything above is one free range
+    void reset(GLuint used) {
+        freeRanges.clear();
+        if (used < capacity)
+            freeRanges.push_back({ used, capacity - used });
+    }
+
+    GLuint getCapacity() const {
+        return capacity;
+    }
+
+    size_t getFreeRangeCount() const {
+        return freeRanges.size();
+    }
+
+private:
+    struct Range {
+        GLuint offset;
+        GLuint size;
+    };
+
+    std::vector<Range> freeRanges;
+    GLuint capacity;
+};
+
+// one vertex buffer and one index buffer every mesh sub-allocates from, behind a single vao
+// with the common vertex format (position, normal, uv, tangent, bitangent = 14 floats).
+// indices stay relative to the mesh and are drawn with a base vertex, so compaction can
+// move meshes around without touching their index data.
+// positions are also kept in a stream of their own behind a second vao sharing the index
+// buffer, so depth only passes fetch 12 bytes per vertex instead of 56.
+// where glBufferStorage exists the buffers are immutable and meshes are copied in from a
+// staging buffer
+class MeshArena {
+public:
+    static const GLuint VERTEX_FLOATS = 14;
+    static const GLuint VERTEX_SIZE = VERTEX_FLOATS * sizeof(GLfloat);
+    static const GLuint POSITION_SIZE = 3 * sizeof(GLfloat);
+    //add() walks the free ranges first fit, past this many holes remove() compacts
+    static const size_t COMPACT_FREE_RANGES = 32;
+
+    typedef GLuint MeshHandle;
+
+    enum VertexStream {
+        FULL_STREAM,
+        POSITION_STREAM
+    };
+
+    MeshArena(GLuint vertexCapacity, GLuint indexCapacity)
+        : vertexRanges(vertexCapacity), indexRanges(indexCapacity) {
+        glGenVertexArrays(1, &VAO);
+        glGenVertexArrays(1, &positionVAO);
+        glGenBuffers(1, &indirectBuffer);
+        glGenBuffers(1, &drawDataBuffer);
+        createStorage(vertexCapacity, indexCapacity);
+    }
+
+    ~MeshArena() {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteVertexArrays(1, &positionVAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &positionVBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &indirectBuffer);
+        glDeleteBuffers(1, &drawDataBuffer);
+        glDeleteBuffers(1, &stagingBuffer);
+    }
+
+    // reserves room for a mesh and uploads it, grows the arena when it is full
+    MeshHandle add(const GLfloat* vertices, GLuint vertexCount, const GLuint* indices, GLuint indexCount) {
+        Allocation allocation = { 0, vertexCount, 0, indexCount, true };
+
+        while (true) {
+            bool vertexFit = vertexRanges.allocate(vertexCount, allocation.firstVertex);
+            bool indexFit = indexRanges.allocate(indexCount, allocation.firstIndex);
+            if (vertexFit && indexFit)
+                break;
+
+            //give back the half that did fit, relocating packs the live meshes and grows what was short
+            if (vertexFit)
+                vertexRanges.release(allocation.firstVertex, vertexCount);
+            if (indexFit)
+                indexRanges.release(allocation.firstIndex, indexCount);
+
+            GLuint vertexCapacity = vertexRanges.getCapacity();
+            GLuint indexCapacity = indexRanges.getCapacity();
+            relocate(vertexFit ? vertexCapacity : std::max(vertexCapacity * 2, vertexCapacity + vertexCount),
+                indexFit ? indexCapacity : std::max(indexCapacity * 2, indexCapacity + indexCount));
+        }
+
+        upload(VBO, (GLintptr)allocation.firstVertex * VERTEX_SIZE, (GLsizeiptr)vertexCount * VERTEX_SIZE, vertices);
+
+        positionScratch.resize((size_t)vertexCount * 3);
+        for (GLuint i = 0; i < vertexCount; i++) {
+            positionScratch[i * 3] = vertices[i * VERTEX_FLOATS];
+            positionScratch[i * 3 + 1] = vertices[i * VERTEX_FLOATS + 1];
+            positionScratch[i * 3 + 2] = vertices[i * VERTEX_FLOATS + 2];
+        }
+        upload(positionVBO, (GLintptr)allocation.firstVertex * POSITION_SIZE,
+            (GLsizeiptr)vertexCount * POSITION_SIZE, positionScratch.data());
+        upload(EBO, (GLintptr)allocation.firstIndex * sizeof(GLuint), (GLsizeiptr)indexCount * sizeof(GLuint), indices);
+
+        allocations.push_back(allocation);
+        return (MeshHandle)allocations.size() - 1;
+    }
+
+    void remove(MeshHandle handle) {
+        Allocation& allocation = allocations[handle];
+        if (!allocation.live)
+            return;
+        vertexRanges.release(allocation.firstVertex, allocation.vertexCount);
+        indexRanges.release(allocation.firstIndex, allocation.indexCount);
+        allocation.live = false;
+
+        if (vertexRanges.getFreeRangeCount() > COMPACT_FREE_RANGES || indexRanges.getFreeRangeCount() > COMPACT_FREE_RANGES)
+            compact();
+    }
+
+    // packs every live mesh to the front of freshly created buffers, closing the holes
+    // left by remove(). handles stay valid, only their offsets change
+    void compact() {
+        relocate(vertexRanges.getCapacity(), indexRanges.getCapacity());
+        compactions++;
+    }
+
+    void bind(VertexStream stream = FULL_STREAM) {
+        GLState::get().bindVertexArray(getVertexArray(stream));
+    }
+
+    // points the per instance attributes (locations 5 to 12, see InstanceData) at buffer
+    void bindInstanceBuffer(GLuint buffer, VertexStream stream = FULL_STREAM) {
+        bind(stream);
+        //the ring can come back from growing under the name it had, only the generation tells
+        unsigned generation = ring != nullptr && buffer == ring->getBuffer() ? ring->getGeneration() : 0;
+        if (buffer == instanceBuffers[stream] && generation == instanceGenerations[stream])
+            return;
+        instanceBuffers[stream] = buffer;
+        instanceGenerations[stream] = generation;
+
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+
+        //model matrix takes 4 locations, one per column
+        for (GLuint i = 0; i < 4; i++) {
+            glVertexAttribPointer(5 + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                (void*)(offsetof(InstanceData, model) + sizeof(glm::vec4) * i));
+            glEnableVertexAttribArray(5 + i);
+            glVertexAttribDivisor(5 + i, 1);
+        }
+
+        //normal matrix takes 3
+        for (GLuint i = 0; i < 3; i++) {
+            glVertexAttribPointer(9 + i, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                (void*)(offsetof(InstanceData, normal) + sizeof(glm::vec3) * i));
+            glEnableVertexAttribArray(9 + i);
+            glVertexAttribDivisor(9 + i, 1);
+        }
+
+        //material index stays an int
+        glVertexAttribIPointer(12, 1, GL_INT, sizeof(InstanceData), (void*)offsetof(InstanceData, materialIndex));
+        glEnableVertexAttribArray(12);
+        glVertexAttribDivisor(12, 1);
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    DrawElementsIndirectCommand getCommand(MeshHandle handle, GLuint instanceCount = 1) const {
+        const Allocation& allocation = allocations[handle];
+        return { allocation.indexCount, instanceCount, allocation.firstIndex, (GLint)allocation.firstVertex, 0 };
+    }
+
+    void draw(const DrawElementsIndirectCommand& command) {
+        bind();
+        glDrawElementsBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+            (void*)((size_t)command.firstIndex * sizeof(GLuint)), command.baseVertex);
+    }
+
+    // a non zero baseInstance offsets the instance attributes, see InstanceUpload
+    void drawInstanced(const DrawElementsIndirectCommand& command) {
+        bind();
+        void* firstIndex = (void*)((size_t)command.firstIndex * sizeof(GLuint));
+        if (command.baseInstance != 0)
+            glDrawElementsInstancedBaseVertexBaseInstance(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, firstIndex,
+                command.instanceCount, command.baseVertex, command.baseInstance);
+        else
+            glDrawElementsInstancedBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT, firstIndex,
+                command.instanceCount, command.baseVertex);
+    }
+
+    // glMultiDrawElementsIndirect plus gl_DrawIDARB and a storage buffer for per draw data
+    static bool supportsMultiDraw() {
+        bool multiDraw = GLAD_GL_VERSION_4_3 || GLAD_GL_ARB_multi_draw_indirect;
+        bool drawParameters = GLAD_GL_VERSION_4_6 || GLAD_GL_ARB_shader_draw_parameters;
+        bool storageBuffers = GLAD_GL_VERSION_4_3 || GLAD_GL_ARB_shader_storage_buffer_object;
+        return multiDraw && drawParameters && storageBuffers;
+    }
+
+    // one api call for the whole batch. drawData[i] is what the shader reads through
+    // gl_DrawIDARB for commands[i], bound as storage buffer 0
+    void multiDraw(const DrawElementsIndirectCommand* commands, size_t count, const MultiDrawData* drawData,
+        VertexStream stream = FULL_STREAM) {
+        if (count == 0)
+            return;
+
+        GLsizeiptr drawDataSize = sizeof(MultiDrawData) * count;
+        GLsizeiptr commandsSize = sizeof(DrawElementsIndirectCommand) * count;
+
+        //straight into the ring when there is room, otherwise respecify the scratch buffers
+        RingBuffer::Allocation ringDrawData = { nullptr, 0 };
+        RingBuffer::Allocation ringCommands = { nullptr, 0 };
+        if (ring != nullptr) {
+            ringDrawData = ring->write(drawData, drawDataSize, storageAlignment);
+            ringCommands = ring->write(commands, commandsSize, sizeof(GLuint));
+        }
+
+        if (ringDrawData.data != nullptr) {
+            glBindBufferRange(GL_SHADER_STORAGE_BUFFER, 0, ring->getBuffer(), ringDrawData.offset, drawDataSize);
+        }
+        else {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, drawDataBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, drawDataSize, drawData, GL_STREAM_DRAW);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, drawDataBuffer);
+        }
+
+        GLintptr commandsOffset = 0;
+        if (ringCommands.data != nullptr) {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, ring->getBuffer());
+            commandsOffset = ringCommands.offset;
+        }
+        else {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+            glBufferData(GL_DRAW_INDIRECT_BUFFER, commandsSize, commands, GL_STREAM_DRAW);
+        }
+
+        bind(stream);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void*)commandsOffset, (GLsizei)count, 0);
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+
+    // per frame draw data and indirect commands go through ring from now on,
+    // null goes back to respecifying buffers every call
+    void setRingBuffer(RingBuffer* ringBuffer) {
+        ring = ringBuffer;
+        GLint alignment = 0;
+        glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        storageAlignment = alignment > 0 ? alignment : 256;
+    }
+
+    RingBuffer* getRingBuffer() const {
+        return ring;
+    }
+
+    static bool supportsImmutableStorage() {
+        return GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+    }
+
+    // bytes copied in by add() since the arena was created
+    unsigned long long getUploadedBytes() const {
+        return uploadedBytes;
+    }
+
+    // compact() calls since the arena was created, remove()'s included
+    unsigned getCompactionCount() const {
+        return compactions;
+    }
+
+    GLuint getVertexArray(VertexStream stream = FULL_STREAM) const {
+        return stream == POSITION_STREAM ? positionVAO : VAO;
+    }
+
+private:
+    struct Allocation {
+        GLuint firstVertex;
+        GLuint vertexCount;
+        GLuint firstIndex;
+        GLuint indexCount;
+        bool live;
+    };
+
+    void createStorage(GLuint vertexCapacity, GLuint indexCapacity) {
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &positionVBO);
+        glGenBuffers(1, &EBO);
+
+        GLState::get().bindVertexArray(VAO);
+
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        allocateStorage(GL_ARRAY_BUFFER, (GLsizeiptr)vertexCapacity * VERTEX_SIZE);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        allocateStorage(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)indexCapacity * sizeof(GLuint));
+
+        //position, normal, uv, tangent, bitangent
+        const GLint sizes[] = { 3, 3, 2, 3, 3 };
+        GLuint offset = 0;
+        for (GLuint i = 0; i < 5; i++) {
+            glVertexAttribPointer(i, sizes[i], GL_FLOAT, GL_FALSE, VERTEX_SIZE, (void*)(size_t)(offset * sizeof(GLfloat)));
+            glEnableVertexAttribArray(i);
+            offset += sizes[i];
+        }
+
+        //position only stream, same element buffer
+        GLState::get().bindVertexArray(positionVAO);
+        glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+        allocateStorage(GL_ARRAY_BUFFER, (GLsizeiptr)vertexCapacity * POSITION_SIZE);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, POSITION_SIZE, (void*)0);
+        glEnableVertexAttribArray(0);
+
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    // immutable when possible, the contents only ever change through copies
+    void allocateStorage(GLenum target, GLsizeiptr size) {
+        if (supportsImmutableStorage())
+            glBufferStorage(target, size, NULL, 0);
+        else
+            glBufferData(target, size, NULL, GL_STATIC_DRAW);
+    }
+
+    // immutable buffers can't take glBufferSubData, stage the data and copy it over
+    void upload(GLuint buffer, GLintptr offset, GLsizeiptr size, const void* data) {
+        if (size == 0)
+            return;
+        uploadedBytes += size;
+
+        if (!supportsImmutableStorage()) {
+            glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+            glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+            glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+            return;
+        }
+
+        //one staging buffer for every upload, respecified only when a mesh outgrows it
+        if (stagingBuffer == 0)
+            glGenBuffers(1, &stagingBuffer);
+        glBindBuffer(GL_COPY_READ_BUFFER, stagingBuffer);
+        if (size > stagingCapacity) {
+            glBufferData(GL_COPY_READ_BUFFER, size, data, GL_STREAM_COPY);
+            stagingCapacity = size;
+        }
+        else {
+            glBufferSubData(GL_COPY_READ_BUFFER, 0, size, data);
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, offset, size);
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    // copies every live mesh, packed, into new buffers of the given capacity
+    void relocate(GLuint vertexCapacity, GLuint indexCapacity) {
+        GLuint oldVBO = VBO;
+        GLuint oldPositionVBO = positionVBO;
+        GLuint oldEBO = EBO;
+        createStorage(vertexCapacity, indexCapacity);
+
+        glBindBuffer(GL_COPY_READ_BUFFER, oldVBO);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+        GLuint vertexCursor = 0;
+        for (Allocation& allocation : allocations) {
+            if (!allocation.live)
+                continue;
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                (GLintptr)allocation.firstVertex * VERTEX_SIZE, (GLintptr)vertexCursor * VERTEX_SIZE,
+                (GLsizeiptr)allocation.vertexCount * VERTEX_SIZE);
+            vertexCursor += allocation.vertexCount;
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, oldPositionVBO);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, positionVBO);
+        vertexCursor = 0;
+        for (Allocation& allocation : allocations) {
+            if (!allocation.live)
+                continue;
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                (GLintptr)allocation.firstVertex * POSITION_SIZE, (GLintptr)vertexCursor * POSITION_SIZE,
+                (GLsizeiptr)allocation.vertexCount * POSITION_SIZE);
+            allocation.firstVertex = vertexCursor;
+            vertexCursor += allocation.vertexCount;
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, oldEBO);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+        GLuint indexCursor = 0;
+        for (Allocation& allocation : allocations) {
+            if (!allocation.live)
+                continue;
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                (GLintptr)allocation.firstIndex * sizeof(GLuint), (GLintptr)indexCursor * sizeof(GLuint),
+                (GLsizeiptr)allocation.indexCount * sizeof(GLuint));
+            allocation.firstIndex = indexCursor;
+            indexCursor += allocation.indexCount;
+        }
+
+        glBindBuffer(GL_COPY_READ_BUFFER, 0);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &oldVBO);
+        glDeleteBuffers(1, &oldPositionVBO);
+        glDeleteBuffers(1, &oldEBO);
+
+        vertexRanges.grow(vertexCapacity);
+        vertexRanges.reset(vertexCursor);
+        indexRanges.grow(indexCapacity);
+        indexRanges.reset(indexCursor);
+    }
+
+    RangeAllocator vertexRanges;
+    RangeAllocator indexRanges;
+    std::vector<Allocation> allocations;
+
+    GLuint VAO = 0, VBO = 0, EBO = 0;
+    GLuint positionVAO = 0, positionVBO = 0;
+    //last instance buffer wired into each stream's vao, with the ring's generation when it was the ring
+    GLuint instanceBuffers[2] = { 0, 0 };
+    unsigned instanceGenerations[2] = { 0, 0 };
+    std::vector<GLfloat> positionScratch;
+    GLuint stagingBuffer = 0;
+    GLsizeiptr stagingCapacity = 0;
+    GLuint indirectBuffer = 0;
+    GLuint drawDataBuffer = 0;
+
+    RingBuffer* ring = nullptr;
+    GLint storageAlignment = 256;
+    unsigned long long uploadedBytes = 0;
+    unsigned compactions = 0;
+};
+
+// one mesh's instances for the frame, what Model and Impostor upload through. with the
+// arena's ring buffer they are copied straight into mapped memory and picked up through
+// baseInstance, otherwise they go into a buffer of their own orphaned every frame. gpu
+// culling can swap in the buffer and indirect commands it wrote
+class InstanceUpload {
+public:
+    InstanceUpload(MeshArena& arena) : arena(arena) {
+    }
+
+    ~InstanceUpload() {
+        if (VBO != 0)
+            glDeleteBuffers(1, &VBO);
+    }
+
+    // one buffer update however many instances there are
+    void set(const InstanceData* instances, size_t count) {
+        instanceCount = (GLsizei)count;
+        base = 0;
+        indirectBuffer = 0;
+        indirectCommand = 0;
+
+        RingBuffer* ring = arena.getRingBuffer();
+        if (ring != nullptr) {
+            RingBuffer::Allocation allocation = ring->write(instances, sizeof(InstanceData) * count, sizeof(InstanceData));
+            if (allocation.data != nullptr) {
+                source = ring->getBuffer();
+                base = (GLuint)(allocation.offset / sizeof(InstanceData));
+                return;
+            }
+        }
+
+        if (VBO == 0)
+            glGenBuffers(1, &VBO);
+        if (count > capacity)
+            capacity = count;
+
+        //orphan last frame's storage so the driver doesn't wait on draws still reading it
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(InstanceData) * capacity, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(InstanceData) * count, instances);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        source = VBO;
+    }
+
+    // the instances were culled on the gpu after set: they live in buffer and their counts
+    // in indirect, from the command-th command on
+    void setCulled(GLuint buffer, GLuint indirect, GLuint command = 0) {
+        source = buffer;
+        base = 0;
+        indirectBuffer = indirect;
+        indirectCommand = command;
+    }
+
+    // where this frame's instances live, the fallback buffer, the ring or the culled buffer
+    GLuint getBuffer() const {
+        return source;
+    }
+
+    // where set put the first instance in getBuffer
+    GLuint getBase() const {
+        return base;
+    }
+
+    // 0 unless setCulled was called since the last set
+    GLuint getIndirectBuffer() const {
+        return indirectBuffer;
+    }
+
+    GLuint getIndirectCommand() const {
+        return indirectCommand;
+    }
+
+    GLuint getCount() const {
+        return (GLuint)instanceCount;
+    }
+
+private:
+    MeshArena& arena;
+    GLuint VBO = 0;
+    size_t capacity = 0;
+    GLsizei instanceCount = 0;
+    GLuint source = 0;
+    GLuint base = 0;
+    GLuint indirectBuffer = 0;
+    GLuint indirectCommand = 0;
+};
@@ -0,0 +1,399 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <emmintrin.h>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include <cfloat>
+#include <algorithm>
+#include "BVHCommon.h"
+
+// direction doesn't have to be unit length, distances are measured in lengths of it
+struct MeshRay {
+    glm::vec3 origin;
+    glm::vec3 direction;
+    float maxDistance;
+};
+
+// a miss keeps the ray's maxDistance with triangle INVALID. triangle counts from 0 in the
+// order build got the indices, instance is only filled in by raycastInstances
+struct MeshHit {
+    float distance;
+    uint32_t triangle;
+    uint32_t instance;
+};
+
+// bounding volume hierarchy over one mesh's triangles, built once with binned sah. the
+// triangles are copied out in leaf order as a corner and two edges, what the moller trumbore
+// test works from, so a leaf reads one contiguous run. rays go through one at a time or in
+// packets of four sharing a traversal: a node is visited when any ray of the packet hits it
+// and the four are tested with one sse op per step. packets pay off for coherent rays, a fan
+// out of one point, random ones mostly drag each other into nodes they'd have skipped
+class MeshBVH {
+public:
+    static const uint32_t INVALID = 0xFFFFFFFFu;
+
+    typedef BVH::Node Node;
+
+    // three indices per triangle
+    void build(const std::vector<glm::vec3>& positions, const std::vector<uint32_t>& indices) {
+        std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+        size_t count = indices.size() / 3;
+        triangleIds.resize(count);
+        centroids.resize(count);
+        leafBoxes.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            const glm::vec3& a = positions[indices[i * 3]];
+            const glm::vec3& b = positions[indices[i * 3 + 1]];
+            const glm::vec3& c = positions[indices[i * 3 + 2]];
+            triangleIds[i] = (uint32_t)i;
+            centroids[i] = (a + b + c) * (1.0f / 3.0f);
+            leafBoxes[i] = { glm::min(glm::min(a, b), c), glm::max(glm::max(a, b), c) };
+        }
+
+        BVH::Builder<uint32_t>(nodes, leafBoxes, centroids, triangleIds).build();
+
+        triangles.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            const glm::vec3& a = positions[indices[triangleIds[i] * 3]];
+            triangles[i] = { a, positions[indices[triangleIds[i] * 3 + 1]] - a, positions[indices[triangleIds[i] * 3 + 2]] - a };
+        }
+        //only the build needs these
+        std::vector<glm::vec3>().swap(centroids);
+        std::vector<BVH::Box>().swap(leafBoxes);
+        buildMs = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+
+    // closest triangle within the ray's maxDistance
+    bool raycast(const MeshRay& ray, MeshHit& hit) const {
+        hit = { ray.maxDistance, INVALID, INVALID };
+        BVH::raycastClosest(nodes, ray.origin, 1.0f / ray.direction, hit.distance,
+            [&](uint32_t first, uint32_t count, float& closest) {
+                for (uint32_t i = first; i < first + count; i++) {
+                    float distance;
+                    if (intersectTriangle(triangles[i], ray.origin, ray.direction, closest, distance)) {
+                        closest = distance;
+                        hit.triangle = triangleIds[i];
+                    }
+                }
+            });
+        return hit.triangle != INVALID;
+    }
+
+    // whether any triangle lies within the ray's maxDistance, stops at the first one found
+    bool intersects(const MeshRay& ray) const {
+        if (nodes.empty())
+            return false;
+
+        glm::vec3 inverseDirection = 1.0f / ray.direction;
+        uint32_t stack[BVH::MAX_DEPTH + 1];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0) {
+            const Node& node = nodes[stack[--stackSize]];
+            float entry;
+            if (!BVH::intersectBox(node.min, node.max, ray.origin, inverseDirection, ray.maxDistance, entry))
+                continue;
+
+            if (node.count > 0) {
+                for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                    float distance;
+                    if (intersectTriangle(triangles[i], ray.origin, ray.direction, ray.maxDistance, distance))
+                        return true;
+                }
+                continue;
+            }
+            stack[stackSize++] = node.leftOrFirst + 1;
+            stack[stackSize++] = node.leftOrFirst;
+        }
+        return false;
+    }
+
+    // raycast for four rays at once, rays and hits point at four each. a ray with a negative
+    // maxDistance is padding and never hits
+    void raycastPacket(const MeshRay* rays, MeshHit* hits) const {
+        Packet packet;
+        packet.originX = _mm_setr_ps(rays[0].origin.x, rays[1].origin.x, rays[2].origin.x, rays[3].origin.x);
+        packet.originY = _mm_setr_ps(rays[0].origin.y, rays[1].origin.y, rays[2].origin.y, rays[3].origin.y);
+        packet.originZ = _mm_setr_ps(rays[0].origin.z, rays[1].origin.z, rays[2].origin.z, rays[3].origin.z);
+        packet.directionX = _mm_setr_ps(rays[0].direction.x, rays[1].direction.x, rays[2].direction.x, rays[3].direction.x);
+        packet.directionY = _mm_setr_ps(rays[0].direction.y, rays[1].direction.y, rays[2].direction.y, rays[3].direction.y);
+        packet.directionZ = _mm_setr_ps(rays[0].direction.z, rays[1].direction.z, rays[2].direction.z, rays[3].direction.z);
+        __m128 one = _mm_set1_ps(1.0f);
+        packet.inverseX = _mm_div_ps(one, packet.directionX);
+        packet.inverseY = _mm_div_ps(one, packet.directionY);
+        packet.inverseZ = _mm_div_ps(one, packet.directionZ);
+        __m128 distance = _mm_setr_ps(rays[0].maxDistance, rays[1].maxDistance, rays[2].maxDistance, rays[3].maxDistance);
+        __m128i triangle = _mm_set1_epi32(-1);
+
+        if (!nodes.empty()) {
+            uint32_t stack[BVH::MAX_DEPTH + 1];
+            int stackSize = 0;
+            stack[stackSize++] = 0;
+
+            while (stackSize > 0) {
+                const Node& node = nodes[stack[--stackSize]];
+                __m128 entry;
+                if (!intersectBoxes(packet, node, distance, entry))
+                    continue;
+
+                if (node.count > 0) {
+                    for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+                        intersectTriangles(packet, triangles[i], triangleIds[i], distance, triangle);
+                    continue;
+                }
+
+                //near first by the closest entry of any ray into each child
+                uint32_t nearChild = node.leftOrFirst, farChild = node.leftOrFirst + 1;
+                __m128 nearEntry, farEntry;
+                int nearMask = intersectBoxes(packet, nodes[nearChild], distance, nearEntry);
+                int farMask = intersectBoxes(packet, nodes[farChild], distance, farEntry);
+                if (nearMask && farMask && closestLane(farEntry, farMask) < closestLane(nearEntry, nearMask)) {
+                    std::swap(nearChild, farChild);
+                    std::swap(nearMask, farMask);
+                }
+                if (farMask)
+                    stack[stackSize++] = farChild;
+                if (nearMask)
+                    stack[stackSize++] = nearChild;
+            }
+        }
+
+        alignas(16) float distances[4];
+        alignas(16) uint32_t triangleIndices[4];
+        _mm_store_ps(distances, distance);
+        _mm_store_si128((__m128i*)triangleIndices, triangle);
+        for (int lane = 0; lane < 4; lane++)
+            hits[lane] = { distances[lane], triangleIndices[lane], INVALID };
+    }
+
+    // raycastPacket over any number of rays, taken four at a time in the order given, so
+    // neighbouring rays should point about the same way
+    void raycastBatch(const MeshRay* rays, size_t count, MeshHit* hits) const {
+        size_t i = 0;
+        for (; i + 4 <= count; i += 4)
+            raycastPacket(rays + i, hits + i);
+        if (i == count)
+            return;
+
+        MeshRay tail[4];
+        MeshHit tailHits[4];
+        for (size_t lane = 0; lane < 4; lane++)
+            tail[lane] = i + lane < count ? rays[i + lane] : MeshRay{ glm::vec3(0.0f), glm::vec3(1.0f), -1.0f };
+        raycastPacket(tail, tailHits);
+        for (size_t lane = 0; i + lane < count; lane++)
+            hits[i + lane] = tailHits[lane];
+    }
+
+    // box around the whole mesh
+    glm::vec3 getBoundsMin() const {
+        return nodes.empty() ? glm::vec3(0.0f) : nodes[0].min;
+    }
+
+    glm::vec3 getBoundsMax() const {
+        return nodes.empty() ? glm::vec3(0.0f) : nodes[0].max;
+    }
+
+    size_t getNodeCount() const {
+        return nodes.size();
+    }
+
+    size_t getTriangleCount() const {
+        return triangles.size();
+    }
+
+    double getBuildMs() const {
+        return buildMs;
+    }
+
+private:
+
+    // a corner and the two edges leaving it
+    struct Triangle {
+        glm::vec3 corner;
+        glm::vec3 edge1;
+        glm::vec3 edge2;
+    };
+
+    // four rays, one lane each
+    struct Packet {
+        __m128 originX, originY, originZ;
+        __m128 directionX, directionY, directionZ;
+        __m128 inverseX, inverseY, inverseZ;
+    };
+
+    // moller trumbore, both sides of the triangle count
+    static bool intersectTriangle(const Triangle& triangle, const glm::vec3& origin, const glm::vec3& direction,
+        float maxDistance, float& distance) {
+        glm::vec3 p = glm::cross(direction, triangle.edge2);
+        float determinant = glm::dot(triangle.edge1, p);
+        //parallel to the triangle's plane
+        if (determinant == 0.0f)
+            return false;
+        float inverseDeterminant = 1.0f / determinant;
+
+        glm::vec3 fromCorner = origin - triangle.corner;
+        float u = glm::dot(fromCorner, p) * inverseDeterminant;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+        glm::vec3 q = glm::cross(fromCorner, triangle.edge1);
+        float v = glm::dot(direction, q) * inverseDeterminant;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+        distance = glm::dot(triangle.edge2, q) * inverseDeterminant;
+        return distance > 0.0f && distance < maxDistance;
+    }
+
+    // mask of the rays that hit the node before their current closest hit, entry per ray
+    static int intersectBoxes(const Packet& packet, const Node& node, __m128 maxDistance, __m128& entry) {
+        __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.x), packet.originX), packet.inverseX);
+        __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.x), packet.originX), packet.inverseX);
+        __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.y), packet.originY), packet.inverseY);
+        __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.y), packet.originY), packet.inverseY);
+        __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min.z), packet.originZ), packet.inverseZ);
+        __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max.z), packet.originZ), packet.inverseZ);
+        entry = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+            _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+        __m128 exit = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+            _mm_min_ps(_mm_max_ps(t0z, t1z), maxDistance));
+        return _mm_movemask_ps(_mm_cmple_ps(entry, exit));
+    }
+
+    // intersectTriangle for every lane, lanes that hit closer take the new distance and id
+    static void intersectTriangles(const Packet& packet, const Triangle& triangle, uint32_t id, __m128& distance,
+        __m128i& hitTriangle) {
+        __m128 edge1X = _mm_set1_ps(triangle.edge1.x), edge1Y = _mm_set1_ps(triangle.edge1.y),
+            edge1Z = _mm_set1_ps(triangle.edge1.z);
+        __m128 edge2X = _mm_set1_ps(triangle.edge2.x), edge2Y = _mm_set1_ps(triangle.edge2.y),
+            edge2Z = _mm_set1_ps(triangle.edge2.z);
+
+        __m128 pX = _mm_sub_ps(_mm_mul_ps(packet.directionY, edge2Z), _mm_mul_ps(packet.directionZ, edge2Y));
+        __m128 pY = _mm_sub_ps(_mm_mul_ps(packet.directionZ, edge2X), _mm_mul_ps(packet.directionX, edge2Z));
+        __m128 pZ = _mm_sub_ps(_mm_mul_ps(packet.directionX, edge2Y), _mm_mul_ps(packet.directionY, edge2X));
+        __m128 determinant = dot(edge1X, edge1Y, edge1Z, pX, pY, pZ);
+        __m128 inverseDeterminant = _mm_div_ps(_mm_set1_ps(1.0f), determinant);
+
+        __m128 fromX = _mm_sub_ps(packet.originX, _mm_set1_ps(triangle.corner.x));
+        __m128 fromY = _mm_sub_ps(packet.originY, _mm_set1_ps(triangle.corner.y));
+        __m128 fromZ = _mm_sub_ps(packet.originZ, _mm_set1_ps(triangle.corner.z));
+        __m128 u = _mm_mul_ps(dot(fromX, fromY, fromZ, pX, pY, pZ), inverseDeterminant);
+        __m128 qX = _mm_sub_ps(_mm_mul_ps(fromY, edge1Z), _mm_mul_ps(fromZ, edge1Y));
+        __m128 qY = _mm_sub_ps(_mm_mul_ps(fromZ, edge1X), _mm_mul_ps(fromX, edge1Z));
+        __m128 qZ = _mm_sub_ps(_mm_mul_ps(fromX, edge1Y), _mm_mul_ps(fromY, edge1X));
+        __m128 v = _mm_mul_ps(dot(packet.directionX, packet.directionY, packet.directionZ, qX, qY, qZ), inverseDeterminant);
+        __m128 t = _mm_mul_ps(dot(edge2X, edge2Y, edge2Z, qX, qY, qZ), inverseDeterminant);
+
+        //a zero determinant leaves u, v and t infinite or nan and every compare below false
+        __m128 zero = _mm_setzero_ps();
+        __m128 hit = _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero));
+        hit = _mm_and_ps(hit, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.0f)));
+        hit = _mm_and_ps(hit, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, distance)));
+        if (_mm_movemask_ps(hit) == 0)
+            return;
+        distance = _mm_or_ps(_mm_and_ps(hit, t), _mm_andnot_ps(hit, distance));
+        __m128i hitMask = _mm_castps_si128(hit);
+        hitTriangle = _mm_or_si128(_mm_and_si128(hitMask, _mm_set1_epi32((int)id)), _mm_andnot_si128(hitMask, hitTriangle));
+    }
+
+    static __m128 dot(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+        return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+    }
+
+    // smallest of the lanes set in mask
+    static float closestLane(__m128 values, int mask) {
+        alignas(16) float lanes[4];
+        _mm_store_ps(lanes, values);
+        float closest = FLT_MAX;
+        for (int lane = 0; lane < 4; lane++) {
+            if (mask & (1 << lane))
+                closest = std::min(closest, lanes[lane]);
+        }
+        return closest;
+    }
+
+    std::vector<Node> nodes;
+    //in leaf order, leaves own contiguous ranges
+    std::vector<Triangle> triangles;
+    std::vector<uint32_t> triangleIds;
+    //in leaf order, only while building
+    std::vector<glm::vec3> centroids;
+    std::vector<BVH::Box> leafBoxes;
+
+    double buildMs = 0.0;
+};
+
+// a mesh placed in the world for raycastInstances and MeshOccluders, min and max are its
+// world space box
+struct MeshInstance {
+    const MeshBVH* bvh;
+    glm::mat4 worldToObject;
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+// what raycastInstances works in, kept by the caller so casting every frame doesn't allocate
+struct MeshRaycastScratch {
+    std::vector<uint32_t> reached;
+    std::vector<MeshRay> rays;
+    std::vector<MeshHit> hits;
+};
+
+// closest hit of every ray over all the instances. the rays that reach an instance's box are
+// taken into its space and go through its bvh in packets, in the order given. directions
+// aren't renormalized on the way, so distances stay in lengths of the world direction
+inline void raycastInstances(const std::vector<MeshInstance>& instances, const MeshRay* rays, size_t count,
+    MeshHit* hits, MeshRaycastScratch& scratch) {
+    for (size_t i = 0; i < count; i++)
+        hits[i] = { rays[i].maxDistance, MeshBVH::INVALID, MeshBVH::INVALID };
+
+    std::vector<uint32_t>& reached = scratch.reached;
+    std::vector<MeshRay>& localRays = scratch.rays;
+    std::vector<MeshHit>& localHits = scratch.hits;
+    for (size_t instance = 0; instance < instances.size(); instance++) {
+        const MeshInstance& placed = instances[instance];
+        reached.clear();
+        localRays.clear();
+        for (size_t i = 0; i < count; i++) {
+            float entry;
+            if (!BVH::intersectBox(placed.min, placed.max, rays[i].origin, 1.0f / rays[i].direction, hits[i].distance,
+                entry))
+                continue;
+            reached.push_back((uint32_t)i);
+            localRays.push_back({ glm::vec3(placed.worldToObject * glm::vec4(rays[i].origin, 1.0f)),
+                glm::vec3(placed.worldToObject * glm::vec4(rays[i].direction, 0.0f)), hits[i].distance });
+        }
+
+        localHits.resize(localRays.size());
+        placed.bvh->raycastBatch(localRays.data(), localRays.size(), localHits.data());
+        for (size_t i = 0; i < reached.size(); i++) {
+            if (localHits[i].triangle != MeshBVH::INVALID)
+                hits[reached[i]] = { localHits[i].distance, localHits[i].triangle, (uint32_t)instance };
+        }
+    }
+}
+
+// line of sight against mesh instances, a segment is blocked when it crosses a triangle.
+// like BoxOccluders, instances whose box holds either end are the viewer's or the target's
+// own and don't count
+struct MeshOccluders {
+    const std::vector<MeshInstance>* instances;
+
+    bool operator()(const glm::vec3& from, const glm::vec3& to) const {
+        glm::vec3 direction = to - from;
+        glm::vec3 inverseDirection = 1.0f / direction;
+        for (const MeshInstance& placed : *instances) {
+            float entry;
+            if (BVH::contains(placed.min, placed.max, from) || BVH::contains(placed.min, placed.max, to) ||
+                !BVH::intersectBox(placed.min, placed.max, from, inverseDirection, 1.0f, entry))
+                continue;
+            //the segment's own 0 to 1 carries over into object space
+            MeshRay ray = { glm::vec3(placed.worldToObject * glm::vec4(from, 1.0f)),
+                glm::vec3(placed.worldToObject * glm::vec4(direction, 0.0f)), 1.0f };
+            if (placed.bvh->intersects(ray))
+                return true;
+        }
+        return false;
+    }
+};
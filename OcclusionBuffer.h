@@ -0,0 +1,309 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <emmintrin.h>
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+#include <cmath>
+#include <algorithm>
+#include "JobSystem.h"
+
+// low resolution cpu depth buffer for occlusion culling, masked hierarchical layout
+// (andersson et al.): every 8x4 pixel tile keeps a conservative depth for the whole tile plus
+// a working layer, the furthest depth of whatever pixels its coverage mask says are filled.
+// once the mask is full the working layer becomes the tile's depth, so a tile only ever
+// stores two floats and a mask instead of 32 depths. depth is 0 near, 1 far
+class OcclusionBuffer {
+public:
+    static const int TILE_WIDTH = 8;
+    static const int TILE_HEIGHT = 4;
+
+    // size is rounded up to whole tiles
+    OcclusionBuffer(int width, int height) {
+        tilesX = (width + TILE_WIDTH - 1) / TILE_WIDTH;
+        tilesY = (height + TILE_HEIGHT - 1) / TILE_HEIGHT;
+        this->width = tilesX * TILE_WIDTH;
+        this->height = tilesY * TILE_HEIGHT;
+        tileDepth.resize(tilesX * tilesY);
+        workingDepth.resize(tilesX * tilesY);
+        coverage.resize(tilesX * tilesY);
+        clear();
+    }
+
+    void clear() {
+        std::fill(tileDepth.begin(), tileDepth.end(), 1.0f);
+        std::fill(workingDepth.begin(), workingDepth.end(), 0.0f);
+        std::fill(coverage.begin(), coverage.end(), 0u);
+        occluders.clear();
+    }
+
+    // queues an indexed triangle mesh, the arrays have to outlive the next rasterize
+    void addOccluder(const glm::vec3* positions, const uint32_t* indices, size_t indexCount, const glm::mat4& mvp) {
+        occluders.push_back({ positions, indices, indexCount / 3, mvp });
+    }
+
+    // transforms and clips every queued triangle across the workers, binning them by the bands
+    // of tile rows they touch, then rasterizes the bands in parallel. each band is done by one
+    // thread, so no two threads ever touch the same tile
+    void rasterize(JobSystem& jobs) {
+        unsigned threads = jobs.getThreadCount();
+        bandRows = (int)jobs.getSliceSize(tilesY);
+        bandCount = (tilesY + bandRows - 1) / bandRows;
+        bins.resize(threads * bandCount);
+        for (std::vector<ScreenTriangle>& bin : bins)
+            bin.clear();
+
+        triangleCount = 0;
+        for (const Occluder& occluder : occluders) {
+            size_t sliceSize = jobs.getSliceSize(occluder.triangleCount);
+            jobs.parallelSlices(occluder.triangleCount, [&](size_t begin, size_t end, unsigned) {
+                std::vector<ScreenTriangle>* sliceBins = &bins[(begin / sliceSize) * bandCount];
+                for (size_t i = begin; i < end; i++)
+                    setupTriangle(occluder, i, sliceBins);
+            });
+            triangleCount += occluder.triangleCount;
+        }
+
+        jobs.parallelFor(bandCount, 1, [&](size_t begin, size_t end, unsigned) {
+            for (size_t band = begin; band < end; band++) {
+                int rowBegin = (int)band * bandRows;
+                int rowEnd = std::min(rowBegin + bandRows, tilesY);
+                for (unsigned slice = 0; slice < threads; slice++) {
+                    for (const ScreenTriangle& triangle : bins[slice * bandCount + band])
+                        rasterizeTriangle(triangle, rowBegin, rowEnd);
+                }
+            }
+        });
+    }
+
+    // false only when every tile under the box's screen rectangle is known to be nearer than
+    // the box's nearest point. boxes crossing the near plane always count as visible
+    bool isVisible(const glm::vec3& min, const glm::vec3& max, const glm::mat4& viewProj) const {
+        glm::vec2 screenMin(FLT_MAX), screenMax(-FLT_MAX);
+        float nearest = 1.0f;
+        for (int corner = 0; corner < 8; corner++) {
+            glm::vec4 position(corner & 1 ? max.x : min.x, corner & 2 ? max.y : min.y, corner & 4 ? max.z : min.z, 1.0f);
+            glm::vec4 clip = viewProj * position;
+            if (nearDistance(clip) < 0.0f)
+                return true;
+
+            glm::vec3 screen = toScreen(clip);
+            screenMin = glm::min(screenMin, glm::vec2(screen));
+            screenMax = glm::max(screenMax, glm::vec2(screen));
+            nearest = std::min(nearest, screen.z);
+        }
+
+        if (screenMax.x < 0.0f || screenMax.y < 0.0f || screenMin.x >= width || screenMin.y >= height)
+            return false;
+        int tileMinX = (int)std::max(screenMin.x, 0.0f) / TILE_WIDTH;
+        int tileMaxX = (int)std::min(screenMax.x, width - 1.0f) / TILE_WIDTH;
+        int tileMinY = (int)std::max(screenMin.y, 0.0f) / TILE_HEIGHT;
+        int tileMaxY = (int)std::min(screenMax.y, height - 1.0f) / TILE_HEIGHT;
+
+        for (int ty = tileMinY; ty <= tileMaxY; ty++) {
+            for (int tx = tileMinX; tx <= tileMaxX; tx++) {
+                //equal depth is the occluder's own surface, not something in front of it
+                if (nearest <= tileDepth[ty * tilesX + tx])
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    size_t getTriangleCount() const {
+        return triangleCount;
+    }
+
+    int getWidth() const {
+        return width;
+    }
+
+    int getHeight() const {
+        return height;
+    }
+
+    // conservative depth of the tile holding pixel x, y, for debug views
+    float getDepth(int x, int y) const {
+        return tileDepth[(y / TILE_HEIGHT) * tilesX + x / TILE_WIDTH];
+    }
+
+private:
+    struct Occluder {
+        const glm::vec3* positions;
+        const uint32_t* indices;
+        size_t triangleCount;
+        glm::mat4 mvp;
+    };
+
+    // pixel space triangle with counter clockwise edge functions (inside is >= 0 for all three)
+    // and its depth plane, depth is linear in screen space after the perspective divide
+    struct ScreenTriangle {
+        float edgeA[3], edgeB[3], edgeC[3];
+        float depthA, depthB, depthC;
+        float depthMin, depthMax;
+        int tileMinX, tileMaxX, tileMinY, tileMaxY;
+    };
+
+    // signed distance to the near plane in gl clip space, negative on the camera's side of it
+    static float nearDistance(const glm::vec4& clip) {
+        return clip.z + clip.w;
+    }
+
+    glm::vec3 toScreen(const glm::vec4& clip) const {
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        return glm::vec3((ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, ndc.z * 0.5f + 0.5f);
+    }
+
+    void setupTriangle(const Occluder& occluder, size_t triangle, std::vector<ScreenTriangle>* out) const {
+        glm::vec4 clip[3];
+        for (int i = 0; i < 3; i++)
+            clip[i] = occluder.mvp * glm::vec4(occluder.positions[occluder.indices[triangle * 3 + i]], 1.0f);
+
+        //clip against the near plane, one triangle in gives up to two out. the other planes are
+        //left to the tile range clamp
+        glm::vec4 polygon[4];
+        int count = 0;
+        for (int i = 0; i < 3; i++) {
+            const glm::vec4& a = clip[i];
+            const glm::vec4& b = clip[(i + 1) % 3];
+            float aDistance = nearDistance(a);
+            float bDistance = nearDistance(b);
+            if (aDistance >= 0.0f)
+                polygon[count++] = a;
+            if ((aDistance >= 0.0f) != (bDistance >= 0.0f))
+                polygon[count++] = glm::mix(a, b, aDistance / (aDistance - bDistance));
+        }
+
+        for (int i = 1; i + 1 < count; i++)
+            addScreenTriangle(toScreen(polygon[0]), toScreen(polygon[i]), toScreen(polygon[i + 1]), out);
+    }
+
+    // out is one bin per band, the triangle goes into every band it overlaps
+    void addScreenTriangle(glm::vec3 v0, glm::vec3 v1, glm::vec3 v2, std::vector<ScreenTriangle>* out) const {
+        float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+        if (std::abs(area) < 1e-6f)
+            return;
+        //occluders are two sided, flip clockwise triangles instead of culling them
+        if (area < 0.0f) {
+            std::swap(v1, v2);
+            area = -area;
+        }
+
+        ScreenTriangle triangle;
+        glm::vec3 vertices[3] = { v0, v1, v2 };
+        float minX = FLT_MAX, maxX = -FLT_MAX, minY = FLT_MAX, maxY = -FLT_MAX;
+        triangle.depthMin = FLT_MAX;
+        triangle.depthMax = -FLT_MAX;
+        for (int i = 0; i < 3; i++) {
+            const glm::vec3& a = vertices[i];
+            const glm::vec3& b = vertices[(i + 1) % 3];
+            triangle.edgeA[i] = -(b.y - a.y);
+            triangle.edgeB[i] = b.x - a.x;
+            triangle.edgeC[i] = -(triangle.edgeA[i] * a.x + triangle.edgeB[i] * a.y);
+
+            minX = std::min(minX, a.x);
+            maxX = std::max(maxX, a.x);
+            minY = std::min(minY, a.y);
+            maxY = std::max(maxY, a.y);
+            triangle.depthMin = std::min(triangle.depthMin, a.z);
+            triangle.depthMax = std::max(triangle.depthMax, a.z);
+        }
+        if (maxX < 0.0f || maxY < 0.0f || minX >= width || minY >= height)
+            return;
+
+        //depth plane z = a * x + b * y + c through the three vertices
+        glm::vec3 e1 = v1 - v0, e2 = v2 - v0;
+        triangle.depthA = (e1.z * e2.y - e2.z * e1.y) / (e1.x * e2.y - e2.x * e1.y);
+        triangle.depthB = (e2.z * e1.x - e1.z * e2.x) / (e1.x * e2.y - e2.x * e1.y);
+        triangle.depthC = v0.z - triangle.depthA * v0.x - triangle.depthB * v0.y;
+
+        triangle.tileMinX = (int)std::max(minX, 0.0f) / TILE_WIDTH;
+        triangle.tileMaxX = (int)std::min(maxX, width - 1.0f) / TILE_WIDTH;
+        triangle.tileMinY = (int)std::max(minY, 0.0f) / TILE_HEIGHT;
+        triangle.tileMaxY = (int)std::min(maxY, height - 1.0f) / TILE_HEIGHT;
+        for (int band = triangle.tileMinY / bandRows; band <= triangle.tileMaxY / bandRows; band++)
+            out[band].push_back(triangle);
+    }
+
+    // coverage of one tile row by row, 8 pixel centers per row as two sse registers per edge
+    void rasterizeTriangle(const ScreenTriangle& triangle, int rowBegin, int rowEnd) {
+        int tileMinY = std::max(triangle.tileMinY, rowBegin);
+        int tileMaxY = std::min(triangle.tileMaxY, rowEnd - 1);
+
+        for (int ty = tileMinY; ty <= tileMaxY; ty++) {
+            for (int tx = triangle.tileMinX; tx <= triangle.tileMaxX; tx++) {
+                float x = (float)(tx * TILE_WIDTH) + 0.5f;
+                __m128 xLow = _mm_add_ps(_mm_set1_ps(x), _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f));
+                __m128 xHigh = _mm_add_ps(xLow, _mm_set1_ps(4.0f));
+
+                uint32_t mask = 0;
+                for (int row = 0; row < TILE_HEIGHT; row++) {
+                    float y = (float)(ty * TILE_HEIGHT + row) + 0.5f;
+                    __m128 insideLow = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                    __m128 insideHigh = insideLow;
+                    for (int edge = 0; edge < 3; edge++) {
+                        __m128 a = _mm_set1_ps(triangle.edgeA[edge]);
+                        __m128 rowValue = _mm_set1_ps(triangle.edgeB[edge] * y + triangle.edgeC[edge]);
+                        insideLow = _mm_and_ps(insideLow, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a, xLow), rowValue), _mm_setzero_ps()));
+                        insideHigh = _mm_and_ps(insideHigh, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(a, xHigh), rowValue), _mm_setzero_ps()));
+                    }
+                    uint32_t rowMask = (uint32_t)_mm_movemask_ps(insideLow) | ((uint32_t)_mm_movemask_ps(insideHigh) << 4);
+                    mask |= rowMask << (row * TILE_WIDTH);
+                }
+                if (mask == 0)
+                    continue;
+
+                //furthest the triangle gets inside the tile, the plane at the tile's corners
+                //kept within the triangle's own depth range
+                float left = (float)(tx * TILE_WIDTH), right = left + TILE_WIDTH;
+                float bottom = (float)(ty * TILE_HEIGHT), top = bottom + TILE_HEIGHT;
+                float cornerMax = std::max(
+                    std::max(planeDepth(triangle, left, bottom), planeDepth(triangle, right, bottom)),
+                    std::max(planeDepth(triangle, left, top), planeDepth(triangle, right, top)));
+                float depth = std::min(std::max(cornerMax, triangle.depthMin), triangle.depthMax);
+
+                updateTile(ty * tilesX + tx, mask, depth);
+            }
+        }
+    }
+
+    static float planeDepth(const ScreenTriangle& triangle, float x, float y) {
+        return triangle.depthA * x + triangle.depthB * y + triangle.depthC;
+    }
+
+    void updateTile(int tile, uint32_t mask, float depth) {
+        //behind what the whole tile already hides
+        if (depth >= tileDepth[tile])
+            return;
+
+        //a much nearer triangle is worth more than the coverage collected so far, restart the
+        //working layer from it rather than pushing its depth back
+        if (coverage[tile] != 0 && workingDepth[tile] - depth > tileDepth[tile] - workingDepth[tile]) {
+            coverage[tile] = 0;
+            workingDepth[tile] = 0.0f;
+        }
+
+        coverage[tile] |= mask;
+        workingDepth[tile] = std::max(workingDepth[tile], depth);
+
+        if (coverage[tile] == 0xFFFFFFFFu) {
+            tileDepth[tile] = workingDepth[tile];
+            workingDepth[tile] = 0.0f;
+            coverage[tile] = 0;
+        }
+    }
+
+    int width, height;
+    int tilesX, tilesY;
+    std::vector<float> tileDepth;
+    std::vector<float> workingDepth;
+    std::vector<uint32_t> coverage;
+
+    std::vector<Occluder> occluders;
+    //setup output, bandCount bins per thread slice
+    std::vector<std::vector<ScreenTriangle>> bins;
+    int bandRows = 1;
+    int bandCount = 0;
+    size_t triangleCount = 0;
+};
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include <vector>
+#include "GLState.h"
+
+// per object GL_ANY_SAMPLES_PASSED queries on bounding boxes for conditional rendering. boxes
+// are queried after the opaque passes and next frame the object's draws go inside
+// glBeginConditionalRender on that query, so the decision stays on the gpu and the cpu never
+// reads a result to make it. results are read back only once available, for the stats.
+// the price is a frame of latency, an object coming out from behind an occluder shows up late
+class OcclusionQueries {
+public:
+    static const unsigned LATENCY = 4;
+
+    ~OcclusionQueries() {
+        if (!queries.empty())
+            glDeleteQueries((GLsizei)queries.size(), queries.data());
+    }
+
+    // objects are stable indices picked by the caller, LATENCY queries each
+    void resize(size_t objectCount) {
+        if (objectCount == lastIssued.size())
+            return;
+        if (!queries.empty())
+            glDeleteQueries((GLsizei)queries.size(), queries.data());
+
+        queries.resize(objectCount * LATENCY);
+        if (!queries.empty())
+            glGenQueries((GLsizei)queries.size(), queries.data());
+        slots.assign(queries.size(), Slot());
+        //-2 so even frame 0's lookup of the previous frame misses
+        lastIssued.assign(objectCount, -2);
+    }
+
+    // collects finished results and moves on to this frame's slots, call once per frame
+    void beginFrame() {
+        frame++;
+        boxes.clear();
+
+        for (size_t i = 0; i < slots.size(); i++) {
+            Slot& slot = slots[i];
+            if (!slot.pending)
+                continue;
+
+            GLuint available = 0;
+            glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+
+            glGetQueryObjectuiv(queries[i], GL_QUERY_RESULT, &slot.samplesPassed);
+            if (slot.conditioned && slot.samplesPassed == 0)
+                skippedDraws++;
+            slot.pending = false;
+        }
+    }
+
+    // the query this frame's draws of object should be conditioned on, 0 when its box wasn't
+    // queried last frame (first frame, or it was culled or skipped since)
+    GLuint useCondition(size_t object) {
+        if (lastIssued[object] != frame - 1)
+            return 0;
+        size_t index = object * LATENCY + (frame - 1) % LATENCY;
+        Slot& slot = slots[index];
+        conditionalDraws++;
+        //a result that already came back is counted now, a pending one when it's collected
+        if (!slot.pending && slot.samplesPassed == 0)
+            skippedDraws++;
+        slot.conditioned = true;
+        return queries[index];
+    }
+
+    // queues object's box for this frame's query. boxes are pushed out a little so a flat
+    // object's box doesn't z-fight with the object itself
+    void queryBox(size_t object, const glm::vec3& min, const glm::vec3& max) {
+        glm::vec3 padding = glm::vec3(0.01f + glm::length(max - min) * 0.01f);
+        boxes.push_back({ object, min - padding, max + padding });
+    }
+
+    // draws the queued boxes against the bound depth buffer with color and depth writes off.
+    // cubeVAO holds a 36 index -1..1 cube, program is position only with an mvp uniform
+    void execute(GLuint program, GLint mvpLocation, GLuint cubeVAO, const glm::mat4& viewProj) {
+        if (boxes.empty())
+            return;
+
+        GLState& state = GLState::get();
+        state.useProgram(program);
+        state.bindVertexArray(cubeVAO);
+        state.setDepthMask(false);
+        state.setCullFace(false);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+
+        for (const Box& box : boxes) {
+            glm::mat4 transform = glm::translate(glm::mat4(1.0f), (box.min + box.max) * 0.5f);
+            transform = glm::scale(transform, (box.max - box.min) * 0.5f);
+            glUniformMatrix4fv(mvpLocation, 1, GL_FALSE, glm::value_ptr(viewProj * transform));
+
+            //a result nobody collected yet is simply dropped from the stats
+            size_t index = box.object * LATENCY + frame % LATENCY;
+            glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[index]);
+            glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+            glEndQuery(GL_ANY_SAMPLES_PASSED);
+
+            slots[index].pending = true;
+            slots[index].conditioned = false;
+            lastIssued[box.object] = frame;
+        }
+
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        state.setDepthMask(true);
+    }
+
+    // totals since the last resetStats, skipped only counts results that have come back so far
+    unsigned getConditionalDraws() const {
+        return conditionalDraws;
+    }
+
+    unsigned getSkippedDraws() const {
+        return skippedDraws;
+    }
+
+    void resetStats() {
+        conditionalDraws = 0;
+        skippedDraws = 0;
+    }
+
+private:
+    struct Slot {
+        bool pending = false;
+        //some draw was conditioned on it, so its result says whether that draw was skipped
+        bool conditioned = false;
+        GLuint samplesPassed = 0;
+    };
+
+    struct Box {
+        size_t object;
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+
+    std::vector<GLuint> queries;
+    std::vector<Slot> slots;
+    std::vector<long long> lastIssued;
+    std::vector<Box> boxes;
+    long long frame = 0;
+
+    unsigned conditionalDraws = 0;
+    unsigned skippedDraws = 0;
+};
@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// passes in execution order, the top bits of every sort key. the skybox goes after the
+// opaques so the depth test rejects every pixel they already covered
+enum RenderPass : uint64_t {
+    PASS_OPAQUE = 0,
+    PASS_ALPHA_TEST = 1,
+    PASS_SKYBOX = 2,
+    PASS_TRANSPARENT = 3,
+    PASS_COUNT = 4
+};
+
+// 64 bit sort keys, most significant bits first:
+//   opaque:      pass(4) | 0 | program(8) | material(12) | mesh(15) | depth(24)
+//   transparent: pass(4) | 1 | ~depth(24) | program(8) | material(12) | mesh(15)
+// opaques group by state and then go front to back, transparents go back to front
+namespace RenderKey {
+    const int DEPTH_BITS = 24;
+    const uint64_t DEPTH_MAX = (1ull << DEPTH_BITS) - 1;
+    //ids past these would be cut off and sort with unrelated draws. gl names and arena handles
+    //are handed out in order, so they only get there with that many programs, textures or meshes
+    const uint32_t PROGRAM_MAX = 0xFF;
+    const uint32_t MATERIAL_MAX = 0xFFF;
+    const uint32_t MESH_MAX = 0x7FFF;
+
+    // depth01 is view distance / far plane, clamped to [0, 1]
+    inline uint64_t quantizeDepth(float depth01) {
+        if (depth01 < 0.0f)
+            depth01 = 0.0f;
+        if (depth01 > 1.0f)
+            depth01 = 1.0f;
+        return (uint64_t)(depth01 * (float)DEPTH_MAX);
+    }
+
+    inline uint64_t opaque(uint64_t pass, uint32_t program, uint32_t material, uint32_t mesh, float depth01) {
+        assert(program <= PROGRAM_MAX && material <= MATERIAL_MAX && mesh <= MESH_MAX);
+        return ((pass & 0xF) << 60)
+            | ((uint64_t)(program & PROGRAM_MAX) << 51)
+            | ((uint64_t)(material & MATERIAL_MAX) << 39)
+            | ((uint64_t)(mesh & MESH_MAX) << 24)
+            | quantizeDepth(depth01);
+    }
+
+    inline uint64_t transparent(uint64_t pass, uint32_t program, uint32_t material, uint32_t mesh, float depth01) {
+        assert(program <= PROGRAM_MAX && material <= MATERIAL_MAX && mesh <= MESH_MAX);
+        return ((pass & 0xF) << 60)
+            | (1ull << 59)
+            | ((DEPTH_MAX - quantizeDepth(depth01)) << 35)
+            | ((uint64_t)(program & PROGRAM_MAX) << 27)
+            | ((uint64_t)(material & MATERIAL_MAX) << 15)
+            | (uint64_t)(mesh & MESH_MAX);
+    }
+}
+
+// every frame: clear, submit, sort, then walk getItems() and execute. the index points
+// into whatever draw list the caller keeps, the queue itself never touches gl
+class RenderQueue {
+public:
+    struct Item {
+        uint64_t key;
+        uint32_t index;
+    };
+
+    void clear() {
+        items.clear();
+    }
+
+    void submit(uint64_t key, uint32_t index) {
+        items.push_back({ key, index });
+    }
+
+    // lsd radix sort, 11 bits per pass so 64 bit keys take 6 passes. all histograms are
+    // built in one read and passes where every key has the same digit are skipped
+    void sort() {
+        size_t count = items.size();
+        if (count < 2)
+            return;
+
+        scratch.resize(count);
+
+        memset(histograms, 0, sizeof(histograms));
+        for (size_t i = 0; i < count; i++) {
+            uint64_t key = items[i].key;
+            for (int pass = 0; pass < RADIX_PASSES; pass++)
+                histograms[pass][(key >> (pass * RADIX_BITS)) & RADIX_MASK]++;
+        }
+
+        Item* source = items.data();
+        Item* destination = scratch.data();
+
+        for (int pass = 0; pass < RADIX_PASSES; pass++) {
+            uint32_t* histogram = histograms[pass];
+            int shift = pass * RADIX_BITS;
+
+            if (histogram[(source[0].key >> shift) & RADIX_MASK] == count)
+                continue;
+
+            //bucket start offsets
+            uint32_t offset = 0;
+            for (int bucket = 0; bucket < RADIX_BUCKETS; bucket++) {
+                uint32_t bucketCount = histogram[bucket];
+                histogram[bucket] = offset;
+                offset += bucketCount;
+            }
+
+            for (size_t i = 0; i < count; i++)
+                destination[histogram[(source[i].key >> shift) & RADIX_MASK]++] = source[i];
+
+            Item* swap = source;
+            source = destination;
+            destination = swap;
+        }
+
+        if (source != items.data())
+            items.swap(scratch);
+    }
+
+    // [begin, end) of the sorted items belonging to pass, empty when it has none
+    void getPassRange(uint64_t pass, size_t& begin, size_t& end) const {
+        begin = lowerBound(pass << 60);
+        end = pass + 1 < 16 ? lowerBound((pass + 1) << 60) : items.size();
+    }
+
+    const std::vector<Item>& getItems() const {
+        return items;
+    }
+
+    size_t size() const {
+        return items.size();
+    }
+
+private:
+    static const int RADIX_BITS = 11;
+    static const int RADIX_BUCKETS = 1 << RADIX_BITS;
+    static const uint64_t RADIX_MASK = RADIX_BUCKETS - 1;
+    static const int RADIX_PASSES = (64 + RADIX_BITS - 1) / RADIX_BITS;
+
+    size_t lowerBound(uint64_t key) const {
+        size_t low = 0;
+        size_t high = items.size();
+        while (low < high) {
+            size_t middle = (low + high) / 2;
+            if (items[middle].key < key)
+                low = middle + 1;
+            else
+                high = middle;
+        }
+        return low;
+    }
+
+    std::vector<Item> items;
+    std::vector<Item> scratch;
+    uint32_t histograms[RADIX_PASSES][RADIX_BUCKETS];
+};
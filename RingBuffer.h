@@ -0,0 +1,167 @@
+#pragma once
+
+#include <glad/glad.h>
+#include <chrono>
+#include <cstring>
+
+// persistently mapped buffer split into one region per frame in flight. each frame writes
+// into its own region and fences it when done, the fence is waited on only when that region
+// comes around again, so writes are plain memcpys with no driver copy or orphaning.
+// target agnostic, the same buffer feeds instance attributes, storage and indirect reads
+class RingBuffer {
+public:
+    static const unsigned FRAMES = 3;
+
+    struct Allocation {
+        void* data;
+        GLintptr offset;
+    };
+
+    // glBufferStorage and persistent mapping, core in 4.4
+    static bool supported() {
+        return GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+    }
+
+    RingBuffer(GLsizeiptr frameSize) {
+        create(frameSize);
+    }
+
+    ~RingBuffer() {
+        destroy();
+    }
+
+    // waits for the gpu to finish with the region this frame reuses. a region that
+    // overflowed last time grows here, once nothing is in flight
+    void beginFrame() {
+        if (overflowed) {
+            for (unsigned i = 0; i < FRAMES; i++)
+                waitForRegion(i);
+            GLsizeiptr newSize = frameSize * 2;
+            destroy();
+            create(newSize);
+            overflowed = false;
+        }
+
+        region = (region + 1) % FRAMES;
+        waitForRegion(region);
+        cursor = 0;
+    }
+
+    // fences this frame's region, call after the last draw reading it
+    void endFrame() {
+        fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+
+    // room for size bytes at an absolute offset that is a multiple of alignment.
+    // data is null when the region is full, the caller has to take its fallback path
+    Allocation allocate(GLsizeiptr size, GLintptr alignment) {
+        GLintptr regionStart = (GLintptr)region * frameSize;
+        GLintptr offset = (regionStart + cursor + alignment - 1) / alignment * alignment;
+        if (offset + size > regionStart + frameSize) {
+            overflowed = true;
+            return { nullptr, 0 };
+        }
+
+        cursor = offset + size - regionStart;
+        bytesWritten += size;
+        return { mapped + offset, offset };
+    }
+
+    // allocate plus copy
+    Allocation write(const void* source, GLsizeiptr size, GLintptr alignment) {
+        Allocation allocation = allocate(size, alignment);
+        if (allocation.data != nullptr)
+            memcpy(allocation.data, source, size);
+        return allocation;
+    }
+
+    GLuint getBuffer() const {
+        return buffer;
+    }
+
+    // bumped every time growing recreates the buffer, gl is free to hand the new one the old name
+    unsigned getGeneration() const {
+        return generation;
+    }
+
+    GLsizeiptr getFrameSize() const {
+        return frameSize;
+    }
+
+    // totals since the last resetStats, stalls count waits on a fence that wasn't signaled yet
+    unsigned long long getBytesWritten() const {
+        return bytesWritten;
+    }
+
+    unsigned getStallCount() const {
+        return stallCount;
+    }
+
+    double getStallMs() const {
+        return stallMs;
+    }
+
+    void resetStats() {
+        bytesWritten = 0;
+        stallCount = 0;
+        stallMs = 0.0;
+    }
+
+private:
+    void create(GLsizeiptr size) {
+        frameSize = size;
+        generation++;
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glBufferStorage(GL_COPY_WRITE_BUFFER, frameSize * FRAMES, NULL, flags);
+        mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, frameSize * FRAMES, flags);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    }
+
+    void destroy() {
+        for (unsigned i = 0; i < FRAMES; i++) {
+            if (fences[i] != 0)
+                glDeleteSync(fences[i]);
+            fences[i] = 0;
+        }
+        glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        glDeleteBuffers(1, &buffer);
+        mapped = nullptr;
+    }
+
+    void waitForRegion(unsigned index) {
+        GLsync fence = fences[index];
+        if (fence == 0)
+            return;
+
+        GLenum result = glClientWaitSync(fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED) {
+            auto start = std::chrono::high_resolution_clock::now();
+            while (result == GL_TIMEOUT_EXPIRED)
+                result = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            auto end = std::chrono::high_resolution_clock::now();
+            stallCount++;
+            stallMs += std::chrono::duration<double, std::milli>(end - start).count();
+        }
+
+        glDeleteSync(fence);
+        fences[index] = 0;
+    }
+
+    GLuint buffer = 0;
+    unsigned char* mapped = nullptr;
+    GLsizeiptr frameSize = 0;
+    GLsync fences[FRAMES] = {};
+    unsigned region = 0;
+    GLintptr cursor = 0;
+    bool overflowed = false;
+    unsigned generation = 0;
+
+    unsigned long long bytesWritten = 0;
+    unsigned stallCount = 0;
+    double stallMs = 0.0;
+};
@@ -0,0 +1,257 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <cfloat>
+#include <algorithm>
+#include "FrustumCulling.h"
+#include "BVHCommon.h"
+
+// bounding volume hierarchy over object boxes, built with binned sah. moving objects only
+// refit the boxes bottom up, the tree is rebuilt once refitting has made it too much worse
+// than a fresh build (or the object count changed)
+class SceneBVH {
+public:
+    typedef BVH::Node Node;
+
+    // cost after refitting divided by the cost right after a build, past this it rebuilds
+    void setRebuildRatio(float ratio) {
+        rebuildRatio = ratio;
+    }
+
+    // refits to this frame's boxes, rebuilds when needed. bounds is indexed by object
+    void update(const BoundsSoA& bounds) {
+        if (bounds.size() != objects.size() || nodes.empty()) {
+            build(bounds);
+            return;
+        }
+
+        refit(bounds);
+        if (cost > buildCost * rebuildRatio)
+            build(bounds);
+        else
+            refitCount++;
+    }
+
+    void build(const BoundsSoA& bounds) {
+        size_t count = bounds.size();
+        objects.resize(count);
+        centroids.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            objects[i] = (uint32_t)i;
+            centroids[i] = (bounds.getMin(i) + bounds.getMax(i)) * 0.5f;
+        }
+
+        leafBoxes.resize(count);
+        for (size_t i = 0; i < count; i++)
+            leafBoxes[i] = { bounds.getMin(i), bounds.getMax(i) };
+
+        BVH::Builder<uint32_t>(nodes, leafBoxes, centroids, objects).build();
+        if (nodes.empty()) {
+            cost = buildCost = 0.0f;
+            return;
+        }
+        cost = buildCost = computeCost();
+        rebuildCount++;
+    }
+
+    // marks every object whose box is at least partly inside. nodes fully inside a plane
+    // stop testing it, subtrees fully inside all planes are marked without any test
+    size_t cullFrustum(const Frustum& frustum, std::vector<uint8_t>& visible) const {
+        visible.assign(objects.size(), 0);
+        if (nodes.empty())
+            return 0;
+
+        size_t visibleCount = 0;
+        cullNode(0, frustum, 0x3F, visible, visibleCount);
+        return visibleCount;
+    }
+
+    // closest object box hit by the ray within maxDistance, -1 when nothing is hit.
+    // distance is where the ray enters the box (0 when it starts inside)
+    int raycast(const glm::vec3& origin, const glm::vec3& direction, float maxDistance, float& distance) const {
+        distance = maxDistance;
+        glm::vec3 inverseDirection = 1.0f / direction;
+        int hit = -1;
+        BVH::raycastClosest(nodes, origin, inverseDirection, distance, [&](uint32_t first, uint32_t count, float& closest) {
+            for (uint32_t i = first; i < first + count; i++) {
+                float entry;
+                if (BVH::intersectBox(leafBoxes[i].min, leafBoxes[i].max, origin, inverseDirection, closest, entry)) {
+                    closest = entry;
+                    hit = (int)objects[i];
+                }
+            }
+        });
+        return hit;
+    }
+
+    // every object whose box comes within radius of center
+    void querySphere(const glm::vec3& center, float radius, std::vector<uint32_t>& out) const {
+        out.clear();
+        if (nodes.empty())
+            return;
+
+        float radiusSquared = radius * radius;
+        uint32_t stack[BVH::MAX_DEPTH + 1];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+
+        while (stackSize > 0) {
+            const Node& node = nodes[stack[--stackSize]];
+            if (distanceSquared(node.min, node.max, center) > radiusSquared)
+                continue;
+
+            if (node.count > 0) {
+                for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                    if (distanceSquared(leafBoxes[i].min, leafBoxes[i].max, center) <= radiusSquared)
+                        out.push_back(objects[i]);
+                }
+                continue;
+            }
+            stack[stackSize++] = node.leftOrFirst;
+            stack[stackSize++] = node.leftOrFirst + 1;
+        }
+    }
+
+    size_t getNodeCount() const {
+        return nodes.size();
+    }
+
+    // sah cost now and right after the last build, the ratio is what triggers rebuilds
+    float getCost() const {
+        return cost;
+    }
+
+    float getBuildCost() const {
+        return buildCost;
+    }
+
+    // totals since the last resetStats
+    unsigned getRefitCount() const {
+        return refitCount;
+    }
+
+    unsigned getRebuildCount() const {
+        return rebuildCount;
+    }
+
+    void resetStats() {
+        refitCount = 0;
+        rebuildCount = 0;
+    }
+
+private:
+    typedef BVH::Box Box;
+
+    static float distanceSquared(const glm::vec3& min, const glm::vec3& max, const glm::vec3& point) {
+        glm::vec3 closest = glm::clamp(point, min, max);
+        glm::vec3 offset = point - closest;
+        return glm::dot(offset, offset);
+    }
+
+    // children always come after their parent, so one reverse sweep updates everything
+    void refit(const BoundsSoA& bounds) {
+        for (size_t i = 0; i < objects.size(); i++)
+            leafBoxes[i] = { bounds.getMin(objects[i]), bounds.getMax(objects[i]) };
+
+        for (size_t i = nodes.size(); i-- > 0;) {
+            Node& node = nodes[i];
+            if (node.count > 0) {
+                BVH::setNodeBounds(node, leafBoxes);
+                continue;
+            }
+            const Node& left = nodes[node.leftOrFirst];
+            const Node& right = nodes[node.leftOrFirst + 1];
+            node.min = glm::min(left.min, right.min);
+            node.max = glm::max(left.max, right.max);
+        }
+        cost = computeCost();
+    }
+
+    // sah cost relative to the root's area, one unit per node visited and per box tested
+    float computeCost() const {
+        float rootArea = BVH::area(nodes[0].min, nodes[0].max);
+        if (rootArea <= 0.0f)
+            return 0.0f;
+
+        float total = 0.0f;
+        for (const Node& node : nodes)
+            total += BVH::area(node.min, node.max) * (node.count > 0 ? (float)node.count : 1.0f);
+        return total / rootArea;
+    }
+
+    void cullNode(uint32_t nodeIndex, const Frustum& frustum, unsigned planeMask,
+        std::vector<uint8_t>& visible, size_t& visibleCount) const {
+        const Node& node = nodes[nodeIndex];
+
+        for (int p = 0; p < 6; p++) {
+            if (!(planeMask & (1u << p)))
+                continue;
+            const glm::vec4& plane = frustum.planes[p];
+            //furthest and nearest corner along the plane normal
+            glm::vec3 positive(plane.x >= 0.0f ? node.max.x : node.min.x, plane.y >= 0.0f ? node.max.y : node.min.y,
+                plane.z >= 0.0f ? node.max.z : node.min.z);
+            glm::vec3 negative(plane.x >= 0.0f ? node.min.x : node.max.x, plane.y >= 0.0f ? node.min.y : node.max.y,
+                plane.z >= 0.0f ? node.min.z : node.max.z);
+            if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+                return;
+            if (glm::dot(glm::vec3(plane), negative) + plane.w >= 0.0f)
+                planeMask &= ~(1u << p);
+        }
+
+        if (planeMask == 0) {
+            markSubtree(nodeIndex, visible, visibleCount);
+            return;
+        }
+
+        if (node.count > 0) {
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++) {
+                bool inside = true;
+                for (int p = 0; p < 6 && inside; p++) {
+                    if (!(planeMask & (1u << p)))
+                        continue;
+                    const glm::vec4& plane = frustum.planes[p];
+                    const Box& box = leafBoxes[i];
+                    glm::vec3 positive(plane.x >= 0.0f ? box.max.x : box.min.x, plane.y >= 0.0f ? box.max.y : box.min.y,
+                        plane.z >= 0.0f ? box.max.z : box.min.z);
+                    inside = glm::dot(glm::vec3(plane), positive) + plane.w >= 0.0f;
+                }
+                if (inside) {
+                    visible[objects[i]] = 1;
+                    visibleCount++;
+                }
+            }
+            return;
+        }
+
+        cullNode(node.leftOrFirst, frustum, planeMask, visible, visibleCount);
+        cullNode(node.leftOrFirst + 1, frustum, planeMask, visible, visibleCount);
+    }
+
+    void markSubtree(uint32_t nodeIndex, std::vector<uint8_t>& visible, size_t& visibleCount) const {
+        const Node& node = nodes[nodeIndex];
+        if (node.count > 0) {
+            for (uint32_t i = node.leftOrFirst; i < node.leftOrFirst + node.count; i++)
+                visible[objects[i]] = 1;
+            visibleCount += node.count;
+            return;
+        }
+        markSubtree(node.leftOrFirst, visible, visibleCount);
+        markSubtree(node.leftOrFirst + 1, visible, visibleCount);
+    }
+
+    std::vector<Node> nodes;
+    //object index per leaf slot, leaves own contiguous ranges of it
+    std::vector<uint32_t> objects;
+    //boxes in leaf slot order, so leaf tests don't gather through objects
+    std::vector<Box> leafBoxes;
+    //in leaf slot order like leafBoxes, only the build reads them
+    std::vector<glm::vec3> centroids;
+
+    float rebuildRatio = 1.5f;
+    float cost = 0.0f;
+    float buildCost = 0.0f;
+    unsigned refitCount = 0;
+    unsigned rebuildCount = 0;
+};
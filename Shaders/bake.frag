@@ -0,0 +1,22 @@
+#version 330 core
+
+//impostor frames, drawn with the plain variant of sample.vert and an identity transform so
+//the normal comes out in object space. see Impostor::bake
+
+uniform sampler2D tex0;
+
+uniform sampler2D norm_tex;
+
+in vec2 texCoord;
+
+in mat3 TBN;
+
+layout (location = 0) out vec4 albedo;
+
+layout (location = 1) out vec4 normal;
+
+void main(){
+	vec3 mapped = normalize(texture(norm_tex, texCoord).rgb * 2.0 - 1.0);
+	albedo = vec4(texture(tex0, texCoord).rgb, 1.0);
+	normal = vec4(normalize(TBN * mapped) * 0.5 + 0.5, 1.0);
+}
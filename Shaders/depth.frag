@@ -0,0 +1,5 @@
+#version 330 core
+
+//depth only, no color attachment to write to
+void main(){
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+#version 330 core
+
+#ifdef MULTI_DRAW
+#extension GL_ARB_shader_draw_parameters : require
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+
+//position only stream, see MeshArena::POSITION_STREAM
+layout (location = 0) in vec3 aPos;
+
+#ifdef INSTANCED
+layout (location = 5) in mat4 instanceTransform;
+#endif
+
+//has to match sample.vert exactly, the main pass tests against this depth with GL_EQUAL
+invariant gl_Position;
+
+#if defined(INSTANCED)
+uniform mat4 viewProj;
+#elif defined(MULTI_DRAW)
+struct DrawData {
+	mat4 mvp;
+	mat4 transform;
+	mat4 normalMatrix;
+};
+
+layout (std430) readonly buffer DrawDataBuffer {
+	DrawData draws[];
+};
+#else
+uniform mat4 mvp;
+#endif
+
+void main(){
+#if defined(INSTANCED)
+	vec3 fragPos = vec3 (instanceTransform * vec4(aPos, 1.0));
+	gl_Position = viewProj * vec4(fragPos, 1.0);
+#elif defined(MULTI_DRAW)
+	gl_Position = draws[gl_DrawIDARB].mvp * vec4(aPos, 1.0);
+#else
+	gl_Position = mvp * vec4(aPos, 1.0);
+#endif
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+#version 330 core
+
+uniform vec3 lightPos;
+
+uniform vec3 lightColor;
+
+uniform float ambientStr;
+
+uniform vec3 ambientColor;
+
+uniform vec3 cameraPos;
+
+uniform float specStr;
+
+uniform float specPhong;
+
+in vec3 fragPos;
+
+in vec3 normal;
+
+in float shade;
+
+out vec4 FragColor;
+
+void main(){
+	//the tail fin is a single two sided triangle
+	vec3 n = normalize(gl_FrontFacing ? normal : -normal);
+
+	vec3 lightDir = normalize(lightPos - fragPos);
+	float distance = length(lightPos - fragPos);
+	float attenuation = 1.0 / (1.0 + 0.01 * distance + 0.001 * distance * distance);
+
+	vec3 diffuse = max(dot(n, lightDir), 0.0) * lightColor * attenuation;
+	vec3 ambientCol = ambientColor * ambientStr;
+
+	vec3 viewDir = normalize(cameraPos - fragPos);
+	vec3 reflectDir = reflect(-lightDir, n);
+	vec3 specColor = pow(max(dot(reflectDir, viewDir), 0.0), specPhong) * specStr * lightColor * attenuation;
+
+	//silver scales
+	vec3 base = vec3(0.55, 0.62, 0.68) * shade;
+	FragColor = vec4((diffuse + ambientCol) * base + specColor, 1.0);
+}
@@ -0,0 +1,40 @@
+#version 330 core
+
+//one fish per instance, turned to face the way it swims with its tail swinging. see FishSchool
+
+//unshared corners of the fish mesh, nose towards +z
+layout (location = 0) in vec3 aPos;
+
+layout (location = 1) in vec3 vertexNormal;
+
+//per instance attributes, see FishInstance
+layout (location = 2) in vec4 instancePositionPhase;
+
+layout (location = 3) in vec4 instanceVelocity;
+
+uniform mat4 viewProj;
+
+out vec3 fragPos;
+
+out vec3 normal;
+
+out float shade;
+
+void main(){
+	vec3 forward = normalize(instanceVelocity.xyz);
+	vec3 right = cross(vec3(0.0, 1.0, 0.0), forward);
+	//straight up or down has no sideways, any will do
+	right = length(right) > 0.001 ? normalize(right) : vec3(1.0, 0.0, 0.0);
+	vec3 up = cross(forward, right);
+	mat3 basis = mat3(right, up, forward);
+
+	//everything behind the middle swings sideways, the further back the more
+	vec3 position = aPos;
+	position.x += sin(instancePositionPhase.w) * max(-position.z, 0.0) * 0.35;
+
+	fragPos = instancePositionPhase.xyz + basis * position;
+	gl_Position = viewProj * vec4(fragPos, 1.0);
+	normal = basis * vertexNormal;
+	//dark backs and pale bellies
+	shade = clamp(0.5 - aPos.y * 2.5, 0.2, 1.0);
+}
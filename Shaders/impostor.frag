@@ -0,0 +1,69 @@
+#version 330 core
+
+//albedo atlas, alpha is coverage
+uniform sampler2D tex0;
+
+//object space normal atlas
+uniform sampler2D norm_tex;
+
+uniform vec3 lightPos;
+
+uniform vec3 lightColor;
+
+uniform float ambientStr;
+
+uniform vec3 ambientColor;
+
+uniform vec3 cameraPos;
+
+uniform float specStr;
+
+uniform float specPhong;
+
+#define MAX_MATERIALS 8
+
+//tint per material index, set with Shader::setMaterialTints
+uniform vec3 materialTint[MAX_MATERIALS];
+
+in vec2 texCoord;
+
+in vec3 fragPos;
+
+in mat3 normalMatrix;
+
+flat in int materialIndex;
+
+out vec4 FragColor;
+
+float calculateAttenuation(vec3 lightDir, float distance) {
+    float attenuation = 1.0 / (1.0 + 0.01 * distance + 0.001 * distance * distance); // Adjust attenuation factors
+    return attenuation;
+}
+
+void main(){
+	vec4 albedo = texture(tex0, texCoord);
+	if (albedo.a < 0.5)
+		discard;
+
+	//empty texels are all zero, filtering towards them scales color and normal by coverage
+	vec4 packedNormal = texture(norm_tex, texCoord);
+	vec3 normal = normalize(normalMatrix * (packedNormal.rgb / packedNormal.a * 2.0 - 1.0));
+
+	//same lighting as sample.frag
+	vec3 lightDir = normalize(lightPos - fragPos);
+	float distance = length(lightPos - fragPos);
+	float attenuation = calculateAttenuation(lightDir, distance);
+
+	float diff = max(dot(normal, lightDir), 0.0);
+	vec3 diffuse = diff * lightColor * attenuation;
+
+	vec3 ambientCol = ambientColor * ambientStr;
+
+	vec3 viewDir = normalize(cameraPos - fragPos);
+	vec3 reflectDir = reflect(-lightDir, normal);
+	float spec = pow(max(dot(reflectDir, viewDir), 0.1), specPhong);
+	vec3 specColor = spec * specStr * lightColor * attenuation;
+
+	FragColor = vec4(specColor + diffuse + ambientCol, 1.0) * vec4(albedo.rgb / albedo.a, 1.0);
+	FragColor.rgb *= materialTint[materialIndex];
+}
@@ -0,0 +1,73 @@
+#version 330 core
+
+//one quad per instance showing the impostor frame nearest to the instance's view direction.
+//the quad lies in that frame's image plane, so it matches the baked view exactly and only the
+//choice of frame lags the real direction. see Impostor
+
+//quad corner in -1..1, the quad is an arena mesh
+layout (location = 0) in vec3 aPos;
+
+//per instance attributes, see InstanceData
+layout (location = 5) in mat4 instanceTransform;
+
+layout (location = 9) in mat3 instanceNormalMatrix;
+
+layout (location = 12) in int instanceMaterial;
+
+uniform mat4 viewProj;
+
+uniform vec3 cameraPos;
+
+//object space sphere the frames were rendered around, Impostor::getCenter and getRadius
+uniform vec3 impostorCenter;
+
+uniform float impostorRadius;
+
+//frames per side of the atlas, Impostor::FRAMES
+uniform int impostorFrames;
+
+out vec2 texCoord;
+
+out vec3 fragPos;
+
+out mat3 normalMatrix;
+
+flat out int materialIndex;
+
+//same folding as Impostor::encodeDirection and decodeDirection
+vec2 encodeDirection(vec3 direction){
+	vec3 d = direction / (abs(direction.x) + abs(direction.y) + abs(direction.z));
+	vec2 p = d.xz;
+	if (d.y < 0.0)
+		p = (1.0 - abs(p.yx)) * vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+	return p;
+}
+
+vec3 decodeDirection(vec2 p){
+	vec3 d = vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y);
+	if (d.y < 0.0)
+		d.xz = (1.0 - abs(p.yx)) * vec2(p.x >= 0.0 ? 1.0 : -1.0, p.y >= 0.0 ? 1.0 : -1.0);
+	return normalize(d);
+}
+
+void main(){
+	vec3 center = vec3(instanceTransform * vec4(impostorCenter, 1.0));
+	//the normal matrix's transpose is the inverse of the instance's rotation and scale
+	vec3 view = normalize(transpose(instanceNormalMatrix) * (cameraPos - center));
+
+	vec2 cell = clamp(floor((encodeDirection(view) * 0.5 + 0.5) * float(impostorFrames)), 0.0, float(impostorFrames - 1));
+	vec3 direction = decodeDirection((cell + 0.5) / float(impostorFrames) * 2.0 - 1.0);
+
+	//the axes glm::lookAt gave the frame, see Impostor::frameUp
+	vec3 up = abs(direction.y) > 0.99 ? vec3(1.0, 0.0, 0.0) : vec3(0.0, 1.0, 0.0);
+	vec3 right = normalize(cross(-direction, up));
+	up = cross(right, -direction);
+
+	vec3 position = impostorCenter + (right * aPos.x + up * aPos.y) * impostorRadius;
+	fragPos = vec3(instanceTransform * vec4(position, 1.0));
+	gl_Position = viewProj * vec4(fragPos, 1.0);
+
+	texCoord = (cell + aPos.xy * 0.5 + 0.5) / float(impostorFrames);
+	normalMatrix = instanceNormalMatrix;
+	materialIndex = instanceMaterial;
+}
@@ -28,6 +28,20 @@ in vec3 fragPos;
 
 in mat3 TBN;
 
+#ifdef BLENDED
+//submesh opacity, set per draw
+uniform float opacity;
+#endif
+
+#ifdef INSTANCED
+#define MAX_MATERIALS 8
+
+flat in int materialIndex;
+
+//tint per material index, set with Shader::setMaterialTints
+uniform vec3 materialTint[MAX_MATERIALS];
+#endif
+
 float calculateAttenuation(vec3 lightDir, float distance) {
     float attenuation = 1.0 / (1.0 + 0.01 * distance + 0.001 * distance * distance); // Adjust attenuation factors
     return attenuation;
@@ -36,9 +50,12 @@ float calculateAttenuation(vec3 lightDir, float distance) {
 void main(){
 	vec4 pixelColor = texture(tex0, texCoord);
 
+#ifdef ALPHA_TEST
+	//only alpha tested materials pay for the discard, it costs everyone else early z
 	if(pixelColor.a < 0.1){
 		discard;
 	}
+#endif
 
 	vec3 normal = texture(norm_tex, texCoord).rgb;
 
@@ -61,4 +78,11 @@ void main(){
     vec3 specColor = spec * specStr * lightColor * attenuation;
 
 	FragColor = vec4(specColor + diffuse + ambientCol, 1.0) * texture(tex0, texCoord);
+
+#ifdef INSTANCED
+	FragColor.rgb *= materialTint[materialIndex];
+#endif
+#ifdef BLENDED
+	FragColor.a *= opacity;
+#endif
 }
\ No newline at end of file
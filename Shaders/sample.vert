@@ -1,5 +1,11 @@
 #version 330 core
 
+#ifdef MULTI_DRAW
+//per draw data comes from a storage buffer indexed by gl_DrawIDARB
+#extension GL_ARB_shader_draw_parameters : require
+#extension GL_ARB_shader_storage_buffer_object : require
+#endif
+
 layout (location = 0) in vec3 aPos;
 
 layout (location = 1) in vec3 vertexNormal;
@@ -10,6 +16,17 @@ layout (location = 3) in vec3 m_tan;
 
 layout (location = 4) in vec3 m_btan;
 
+#ifdef INSTANCED
+//per instance attributes, see InstanceData
+layout (location = 5) in mat4 instanceTransform;
+
+layout (location = 9) in mat3 instanceNormalMatrix;
+
+layout (location = 12) in int instanceMaterial;
+
+flat out int materialIndex;
+#endif
+
 out vec2 texCoord;
 
 out vec3 normCoord;
@@ -18,14 +35,52 @@ out vec3 fragPos;
 
 out mat3 TBN;
 
+//the optional depth prepass (depth.vert) has to produce bit identical positions
+invariant gl_Position;
+
+#if defined(INSTANCED)
+uniform mat4 viewProj;
+#elif defined(MULTI_DRAW)
+//see MultiDrawData
+struct DrawData {
+	mat4 mvp;
+	mat4 transform;
+	mat4 normalMatrix;
+};
+
+layout (std430) readonly buffer DrawDataBuffer {
+	DrawData draws[];
+};
+#elif defined(PER_VERTEX_MATRICES)
+//old path, only kept so the vertex benchmark can compare against it
 uniform mat4 transform;
 
 uniform mat4 projection;
 
 uniform mat4 view;
+#else
+uniform mat4 transform;
+
+//projection * view * transform, computed once per object on the cpu
+uniform mat4 mvp;
+
+//transpose(inverse(transform)), computed once per object on the cpu
+uniform mat3 normalMatrix;
+#endif
 
 void main(){
+#if defined(INSTANCED)
+	mat4 transform = instanceTransform;
+	mat3 modelMat = instanceNormalMatrix;
+	materialIndex = instanceMaterial;
+#elif defined(MULTI_DRAW)
+	mat4 transform = draws[gl_DrawIDARB].transform;
+	mat3 modelMat = mat3(draws[gl_DrawIDARB].normalMatrix);
+#elif defined(PER_VERTEX_MATRICES)
 	mat3 modelMat = mat3(transpose(inverse(transform)));
+#else
+	mat3 modelMat = normalMatrix;
+#endif
 	normCoord =  modelMat * vertexNormal;
 
 	vec3 T = normalize(modelMat * m_tan);
@@ -35,6 +90,14 @@ void main(){
 	TBN = mat3(T, B, N);
 
 	fragPos = vec3 (transform * vec4(aPos, 1.0));
+#if defined(INSTANCED)
+	gl_Position = viewProj * vec4(fragPos, 1.0);
+#elif defined(MULTI_DRAW)
+	gl_Position = draws[gl_DrawIDARB].mvp * vec4(aPos, 1.0);
+#elif defined(PER_VERTEX_MATRICES)
 	gl_Position = projection * view * transform * vec4(aPos, 1.0);
+#else
+	gl_Position = mvp * vec4(aPos, 1.0);
+#endif
 	texCoord = aTex;
 }
\ No newline at end of file
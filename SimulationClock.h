@@ -0,0 +1,131 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <cstdint>
+
+// fixed step clock: frame time goes into an accumulator and comes out as whole steps, what's
+// left over is how far the frame is between the last two simulated states
+class FixedStepClock {
+public:
+    // after a stall at most maxStepsPerFrame steps are caught up on and the rest is dropped,
+    // otherwise slow steps make slower frames make more steps
+    FixedStepClock(double stepSeconds, int maxStepsPerFrame = 8)
+        : stepSeconds(stepSeconds), maxStepsPerFrame(maxStepsPerFrame) {}
+
+    // steps to run for a frame that took frameSeconds
+    int advance(double frameSeconds) {
+        accumulator += frameSeconds;
+        //frame times that are exact multiples of the step shouldn't lose one to rounding
+        int steps = (int)((accumulator + 1e-9) / stepSeconds);
+        accumulator = std::max(accumulator - steps * stepSeconds, 0.0);
+        if (steps > maxStepsPerFrame) {
+            droppedSeconds += (steps - maxStepsPerFrame) * stepSeconds;
+            steps = maxStepsPerFrame;
+        }
+        stepCount += steps;
+        return steps;
+    }
+
+    // 0 at the latest state, towards 1 as the next one comes due
+    float getAlpha() const {
+        return (float)(accumulator / stepSeconds);
+    }
+
+    double getStepSeconds() const {
+        return stepSeconds;
+    }
+
+    uint64_t getStepCount() const {
+        return stepCount;
+    }
+
+    double getDroppedSeconds() const {
+        return droppedSeconds;
+    }
+
+    void reset() {
+        accumulator = 0.0;
+    }
+
+private:
+    double stepSeconds;
+    int maxStepsPerFrame;
+    double accumulator = 0.0;
+    uint64_t stepCount = 0;
+    double droppedSeconds = 0.0;
+};
+
+// calls step every stepSeconds of wall time on a thread of its own, so a slow frame doesn't
+// hold the simulation back and a slow step doesn't hold up the frame. step has to hand its
+// results over to the renderer itself
+class SimulationThread {
+public:
+    typedef std::function<void(double stepSeconds)> StepFunction;
+
+    SimulationThread(double stepSeconds, const StepFunction& step, int maxBehindSteps = 8)
+        : stepSeconds(stepSeconds), step(step), maxBehindSteps(maxBehindSteps) {}
+
+    ~SimulationThread() {
+        stop();
+    }
+
+    void start() {
+        if (thread.joinable())
+            return;
+        running = true;
+        thread = std::thread(&SimulationThread::run, this);
+    }
+
+    // returns once the step in progress has finished
+    void stop() {
+        if (!thread.joinable())
+            return;
+        running = false;
+        thread.join();
+    }
+
+    bool isRunning() const {
+        return thread.joinable();
+    }
+
+    // steps run and times the thread fell too far behind and skipped ahead
+    uint64_t getStepCount() const {
+        return stepCount;
+    }
+
+    uint64_t getSkipCount() const {
+        return skipCount;
+    }
+
+private:
+    void run() {
+        typedef std::chrono::steady_clock Clock;
+        Clock::duration interval = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(stepSeconds));
+        Clock::time_point next = Clock::now();
+
+        while (running) {
+            step(stepSeconds);
+            stepCount++;
+
+            next += interval;
+            Clock::time_point now = Clock::now();
+            if (now - next > interval * maxBehindSteps) {
+                next = now;
+                skipCount++;
+            }
+            std::this_thread::sleep_until(next);
+        }
+    }
+
+    double stepSeconds;
+    StepFunction step;
+    int maxBehindSteps;
+    std::thread thread;
+    std::atomic<bool> running{ false };
+    std::atomic<uint64_t> stepCount{ 0 };
+    std::atomic<uint64_t> skipCount{ 0 };
+};
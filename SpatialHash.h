@@ -0,0 +1,344 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <cmath>
+#include <cfloat>
+#include <algorithm>
+
+// uniform grid over point entities for proximity queries. cells are looked up through an open
+// addressed hash of their coordinates, so the world has no bounds. every cell keeps its entities
+// in fixed size chunks from one shared pool, a query reads whole chunks of positions instead of
+// chasing one pointer per entity. insert, move and remove are O(1): a move within the same cell
+// only rewrites the position, and removal fills the hole with the cell's newest entry.
+// ids are dense and chosen by the caller (0 to n - 1 works best)
+class SpatialHash {
+public:
+    static const uint32_t CHUNK_SIZE = 16;
+    static const uint32_t INVALID = 0xFFFFFFFFu;
+
+    struct Neighbor {
+        uint32_t id;
+        float distanceSquared;
+    };
+
+    // cells about twice the usual query radius keep a radius query to 2x2x2 cells
+    SpatialHash(float cellSize) : cellSize(cellSize), inverseCellSize(1.0f / cellSize) {
+        table.assign(64, Slot{ 0, INVALID });
+    }
+
+    float getCellSize() const {
+        return cellSize;
+    }
+
+    size_t size() const {
+        return entityCount;
+    }
+
+    // cells ever touched, empty ones are kept so entities moving back and forth don't churn the table
+    size_t getCellCount() const {
+        return cells.size();
+    }
+
+    size_t getChunkCount() const {
+        return chunks.size() - freeChunks.size();
+    }
+
+    bool contains(uint32_t id) const {
+        return id < entities.size() && entities[id].cell != INVALID;
+    }
+
+    const glm::vec3& getPosition(uint32_t id) const {
+        const Entity& entity = entities[id];
+        return chunks[entity.chunk].entries[entity.slot].position;
+    }
+
+    void insert(uint32_t id, const glm::vec3& position) {
+        if (id >= entities.size())
+            entities.resize(id + 1, Entity{ INVALID, INVALID, INVALID });
+        if (entities[id].cell != INVALID) {
+            move(id, position);
+            return;
+        }
+        addToCell(findOrAddCell(cellCoord(position)), id, position);
+        entityCount++;
+    }
+
+    void move(uint32_t id, const glm::vec3& position) {
+        Entity& entity = entities[id];
+        glm::ivec3 coord = cellCoord(position);
+        if (coord == cells[entity.cell].coord) {
+            chunks[entity.chunk].entries[entity.slot].position = position;
+            return;
+        }
+        removeFromCell(id);
+        addToCell(findOrAddCell(coord), id, position);
+    }
+
+    void remove(uint32_t id) {
+        if (!contains(id))
+            return;
+        removeFromCell(id);
+        entities[id].cell = INVALID;
+        entityCount--;
+    }
+
+    void clear() {
+        cells.clear();
+        chunks.clear();
+        freeChunks.clear();
+        entities.clear();
+        table.assign(64, Slot{ 0, INVALID });
+        entityCount = 0;
+    }
+
+    // every entity within radius of center, appended to out in no particular order
+    void queryRadius(const glm::vec3& center, float radius, std::vector<uint32_t>& out) const {
+        out.clear();
+        float radiusSquared = radius * radius;
+        glm::ivec3 low = cellCoord(center - radius);
+        glm::ivec3 high = cellCoord(center + radius);
+
+        auto visit = [&](const Cell& cell) {
+            for (uint32_t chunk = cell.head; chunk != INVALID; chunk = chunks[chunk].next) {
+                const Chunk& entries = chunks[chunk];
+                for (uint32_t i = 0; i < entries.count; i++) {
+                    glm::vec3 offset = entries.entries[i].position - center;
+                    if (glm::dot(offset, offset) <= radiusSquared)
+                        out.push_back(entries.entries[i].id);
+                }
+            }
+        };
+
+        //a radius much larger than the cells spans more coordinates than there are cells
+        glm::ivec3 span = high - low + 1;
+        if ((size_t)span.x * span.y * span.z > cells.size()) {
+            for (const Cell& cell : cells) {
+                if (cell.count > 0 && glm::all(glm::greaterThanEqual(cell.coord, low)) &&
+                    glm::all(glm::lessThanEqual(cell.coord, high)))
+                    visit(cell);
+            }
+            return;
+        }
+
+        for (int x = low.x; x <= high.x; x++) {
+            for (int y = low.y; y <= high.y; y++) {
+                for (int z = low.z; z <= high.z; z++) {
+                    uint32_t cell = findCell(glm::ivec3(x, y, z));
+                    if (cell != INVALID && cells[cell].count > 0)
+                        visit(cells[cell]);
+                }
+            }
+        }
+    }
+
+    // the k entities nearest to center and no further than maxRadius, nearest first. searches
+    // shells of cells outwards and stops once the k-th candidate is closer than anything the
+    // next shell could hold
+    void queryNearest(const glm::vec3& center, size_t k, float maxRadius, std::vector<Neighbor>& out) const {
+        out.clear();
+        if (k == 0 || entityCount == 0)
+            return;
+
+        float maxSquared = maxRadius * maxRadius;
+        glm::ivec3 origin = cellCoord(center);
+        auto closer = [](const Neighbor& a, const Neighbor& b) { return a.distanceSquared < b.distanceSquared; };
+
+        //out is a max heap on distance while searching
+        auto visit = [&](const glm::ivec3& coord) {
+            uint32_t cellIndex = findCell(coord);
+            if (cellIndex == INVALID || cells[cellIndex].count == 0)
+                return;
+            float bound = out.size() == k ? out.front().distanceSquared : maxSquared;
+            if (cellDistanceSquared(coord, center) > bound)
+                return;
+
+            for (uint32_t chunk = cells[cellIndex].head; chunk != INVALID; chunk = chunks[chunk].next) {
+                const Chunk& entries = chunks[chunk];
+                for (uint32_t i = 0; i < entries.count; i++) {
+                    glm::vec3 offset = entries.entries[i].position - center;
+                    float distanceSquared = glm::dot(offset, offset);
+                    if (distanceSquared > bound)
+                        continue;
+                    if (out.size() == k) {
+                        std::pop_heap(out.begin(), out.end(), closer);
+                        out.pop_back();
+                    }
+                    out.push_back(Neighbor{ entries.entries[i].id, distanceSquared });
+                    std::push_heap(out.begin(), out.end(), closer);
+                    if (out.size() == k)
+                        bound = out.front().distanceSquared;
+                }
+            }
+        };
+
+        for (int ring = 0;; ring++) {
+            //the shell is the surface of the cube of cells ring away from origin
+            for (int x = -ring; x <= ring; x++) {
+                for (int y = -ring; y <= ring; y++) {
+                    bool side = x == -ring || x == ring || y == -ring || y == ring;
+                    for (int z = -ring; z <= ring; z += side ? 1 : std::max(ring * 2, 1))
+                        visit(origin + glm::ivec3(x, y, z));
+                }
+            }
+
+            //everything closer than the searched cube's nearest face has been seen
+            glm::vec3 low = glm::vec3(origin - ring) * cellSize;
+            glm::vec3 high = glm::vec3(origin + ring + 1) * cellSize;
+            glm::vec3 inside = glm::min(center - low, high - center);
+            float covered = std::min(inside.x, std::min(inside.y, inside.z));
+            float coveredSquared = covered * covered;
+            if (out.size() == entityCount)
+                break;
+            if (out.size() == k && out.front().distanceSquared <= coveredSquared)
+                break;
+            if (coveredSquared >= maxSquared)
+                break;
+        }
+
+        std::sort_heap(out.begin(), out.end(), closer);
+    }
+
+private:
+    struct Entry {
+        glm::vec3 position;
+        uint32_t id;
+    };
+
+    // entries of one cell, newest chunk first. only the first chunk of a cell is ever partly full
+    struct Chunk {
+        Entry entries[CHUNK_SIZE];
+        uint32_t count;
+        uint32_t next;
+    };
+
+    struct Cell {
+        glm::ivec3 coord;
+        uint32_t head;
+        uint32_t count;
+    };
+
+    struct Entity {
+        uint32_t cell;
+        uint32_t chunk;
+        uint32_t slot;
+    };
+
+    // hash table slot, cell indexes stay valid when the table grows
+    struct Slot {
+        uint64_t key;
+        uint32_t cell;
+    };
+
+    glm::ivec3 cellCoord(const glm::vec3& position) const {
+        return glm::ivec3(glm::floor(position * inverseCellSize));
+    }
+
+    // 21 bits per axis, cells two million apart share a key and are told apart by coord
+    static uint64_t cellKey(const glm::ivec3& coord) {
+        return ((uint64_t)(coord.x & 0x1FFFFF) << 42) | ((uint64_t)(coord.y & 0x1FFFFF) << 21) |
+            (uint64_t)(coord.z & 0x1FFFFF);
+    }
+
+    size_t slotIndex(uint64_t key) const {
+        //fibonacci hashing, the top bits are the best mixed
+        return (size_t)((key * 0x9E3779B97F4A7C15ull) >> 32) & (table.size() - 1);
+    }
+
+    uint32_t findCell(const glm::ivec3& coord) const {
+        uint64_t key = cellKey(coord);
+        for (size_t i = slotIndex(key);; i = (i + 1) & (table.size() - 1)) {
+            const Slot& slot = table[i];
+            if (slot.cell == INVALID)
+                return INVALID;
+            if (slot.key == key && cells[slot.cell].coord == coord)
+                return slot.cell;
+        }
+    }
+
+    uint32_t findOrAddCell(const glm::ivec3& coord) {
+        uint32_t found = findCell(coord);
+        if (found != INVALID)
+            return found;
+
+        //at most half full keeps the probes short
+        if ((cells.size() + 1) * 2 > table.size())
+            growTable();
+
+        uint32_t cell = (uint32_t)cells.size();
+        cells.push_back(Cell{ coord, INVALID, 0 });
+        insertSlot(cellKey(coord), cell);
+        return cell;
+    }
+
+    void insertSlot(uint64_t key, uint32_t cell) {
+        size_t i = slotIndex(key);
+        while (table[i].cell != INVALID)
+            i = (i + 1) & (table.size() - 1);
+        table[i] = Slot{ key, cell };
+    }
+
+    void growTable() {
+        table.assign(table.size() * 2, Slot{ 0, INVALID });
+        for (uint32_t i = 0; i < cells.size(); i++)
+            insertSlot(cellKey(cells[i].coord), i);
+    }
+
+    void addToCell(uint32_t cellIndex, uint32_t id, const glm::vec3& position) {
+        Cell& cell = cells[cellIndex];
+        if (cell.head == INVALID || chunks[cell.head].count == CHUNK_SIZE) {
+            uint32_t chunk;
+            if (!freeChunks.empty()) {
+                chunk = freeChunks.back();
+                freeChunks.pop_back();
+            }
+            else {
+                chunk = (uint32_t)chunks.size();
+                chunks.push_back(Chunk());
+            }
+            chunks[chunk].count = 0;
+            chunks[chunk].next = cell.head;
+            cell.head = chunk;
+        }
+
+        Chunk& head = chunks[cell.head];
+        head.entries[head.count] = Entry{ position, id };
+        entities[id] = Entity{ cellIndex, cell.head, head.count };
+        head.count++;
+        cell.count++;
+    }
+
+    // the cell's newest entry takes the removed one's place
+    void removeFromCell(uint32_t id) {
+        const Entity& entity = entities[id];
+        Cell& cell = cells[entity.cell];
+        Chunk& head = chunks[cell.head];
+        const Entry& last = head.entries[head.count - 1];
+        chunks[entity.chunk].entries[entity.slot] = last;
+        entities[last.id].chunk = entity.chunk;
+        entities[last.id].slot = entity.slot;
+
+        head.count--;
+        cell.count--;
+        if (head.count == 0) {
+            freeChunks.push_back(cell.head);
+            cell.head = head.next;
+        }
+    }
+
+    float cellDistanceSquared(const glm::ivec3& coord, const glm::vec3& point) const {
+        glm::vec3 low = glm::vec3(coord) * cellSize;
+        glm::vec3 offset = glm::max(glm::max(low - point, point - (low + cellSize)), glm::vec3(0.0f));
+        return glm::dot(offset, offset);
+    }
+
+    float cellSize;
+    float inverseCellSize;
+    std::vector<Cell> cells;
+    std::vector<Chunk> chunks;
+    std::vector<uint32_t> freeChunks;
+    std::vector<Entity> entities;
+    std::vector<Slot> table;
+    size_t entityCount = 0;
+};
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cassert>
+#include <algorithm>
+#include "DrawMatrices.h"
+#include "JobSystem.h"
+
+// parent/child transforms. nodes are stored sorted by depth, so every parent comes before its
+// children and each depth is one contiguous range: a level only reads the finished level above
+// it and is split across the workers. setLocal marks a node dirty, update recomputes the dirty
+// nodes and everything under them and leaves the rest alone. storage is reordered after the
+// tree changes shape, handles stay valid through that
+class TransformHierarchy {
+public:
+    static const uint32_t INVALID = 0xFFFFFFFFu;
+
+    // parent is a handle or INVALID for a root, the new node starts at identity
+    uint32_t add(uint32_t parent = INVALID) {
+        uint32_t handle;
+        if (!freeHandles.empty()) {
+            handle = freeHandles.back();
+            freeHandles.pop_back();
+        }
+        else {
+            handle = (uint32_t)slotOf.size();
+            slotOf.push_back(0);
+        }
+
+        //appending keeps parents first, only the levels need regrouping
+        uint32_t slot = (uint32_t)handles.size();
+        slotOf[handle] = slot;
+        handles.push_back(handle);
+        uint32_t parentSlot = parent == INVALID ? INVALID : slotOf[parent];
+        parents.push_back(parentSlot);
+        positions.push_back(glm::vec3(0.0f));
+        rotations.push_back(glm::quat(1.0f, 0.0f, 0.0f, 0.0f));
+        scales.push_back(glm::vec3(1.0f));
+        locals.push_back(glm::mat4(1.0f));
+        worlds.push_back(glm::mat4(1.0f));
+        localDirty.push_back(1);
+        changed.push_back(0);
+        reorderNeeded = true;
+        return handle;
+    }
+
+    // removes the node and everything under it
+    void remove(uint32_t handle) {
+        reorderIfNeeded();
+        std::vector<uint8_t> removed(handles.size(), 0);
+        for (uint32_t slot = slotOf[handle]; slot < handles.size(); slot++) {
+            removed[slot] = slot == slotOf[handle] || (parents[slot] != INVALID && removed[parents[slot]]);
+            if (removed[slot]) {
+                freeHandles.push_back(handles[slot]);
+                slotOf[handles[slot]] = INVALID;
+                handles[slot] = INVALID;
+            }
+        }
+        reorderNeeded = true;
+    }
+
+    // parent can't be the node itself or one of its descendants
+    void setParent(uint32_t handle, uint32_t parent) {
+        parents[slotOf[handle]] = parent == INVALID ? INVALID : slotOf[parent];
+        localDirty[slotOf[handle]] = 1;
+        reorderNeeded = true;
+    }
+
+    // only marks the node dirty when something actually changed
+    void setLocal(uint32_t handle, const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale) {
+        uint32_t slot = slotOf[handle];
+        if (positions[slot] == position && rotations[slot] == rotation && scales[slot] == scale)
+            return;
+        positions[slot] = position;
+        rotations[slot] = rotation;
+        scales[slot] = scale;
+        localDirty[slot] = 1;
+    }
+
+    // valid after update
+    const glm::mat4& getWorld(uint32_t handle) const {
+        return worlds[slotOf[handle]];
+    }
+
+    // whether the last update recomputed the node's world matrix
+    bool wasChanged(uint32_t handle) const {
+        return changed[slotOf[handle]] != 0;
+    }
+
+    void update(JobSystem& jobs) {
+        reorderIfNeeded();
+
+        std::atomic<size_t> recomputed(0);
+        for (size_t level = 0; level + 1 < levelStarts.size(); level++) {
+            size_t levelBegin = levelStarts[level];
+            jobs.parallelFor(levelStarts[level + 1] - levelBegin, 256, [&](size_t begin, size_t end, unsigned) {
+                size_t count = 0;
+                for (size_t slot = levelBegin + begin; slot < levelBegin + end; slot++) {
+                    uint32_t parent = parents[slot];
+                    changed[slot] = localDirty[slot] || (parent != INVALID && changed[parent]);
+                    if (!changed[slot])
+                        continue;
+
+                    if (localDirty[slot]) {
+                        locals[slot] = composeLocal(positions[slot], rotations[slot], scales[slot]);
+                        localDirty[slot] = 0;
+                    }
+                    if (parent == INVALID)
+                        worlds[slot] = locals[slot];
+                    else
+                        multiplyMat4SSE(&worlds[parent][0][0], &locals[slot][0][0], &worlds[slot][0][0]);
+                    count++;
+                }
+                recomputed += count;
+            });
+        }
+        changedCount = recomputed;
+    }
+
+    size_t getNodeCount() const {
+        return handles.size();
+    }
+
+    size_t getLevelCount() const {
+        return levelStarts.empty() ? 0 : levelStarts.size() - 1;
+    }
+
+    // world matrices recomputed by the last update
+    size_t getChangedCount() const {
+        return changedCount;
+    }
+
+private:
+    // translate * rotate * scale, the rotation's columns scaled in place
+    static glm::mat4 composeLocal(const glm::vec3& position, const glm::quat& rotation, const glm::vec3& scale) {
+        glm::mat4 local = glm::mat4_cast(rotation);
+        local[0] *= scale.x;
+        local[1] *= scale.y;
+        local[2] *= scale.z;
+        local[3] = glm::vec4(position, 1.0f);
+        return local;
+    }
+
+    // counting sort of the live nodes by depth, stable so siblings keep their order
+    void reorderIfNeeded() {
+        if (!reorderNeeded)
+            return;
+        reorderNeeded = false;
+
+        //after setParent a parent can sit after its child, walk up until a known depth
+        std::vector<int> depths(handles.size(), -1);
+        std::vector<uint32_t> chain;
+        size_t levelCount = 0;
+        for (uint32_t slot = 0; slot < handles.size(); slot++) {
+            if (handles[slot] == INVALID)
+                continue;
+            chain.clear();
+            uint32_t walk = slot;
+            while (walk != INVALID && depths[walk] < 0) {
+                chain.push_back(walk);
+                walk = parents[walk];
+                assert(chain.size() <= handles.size());
+            }
+            int depth = walk == INVALID ? -1 : depths[walk];
+            for (size_t i = chain.size(); i-- > 0;)
+                depths[chain[i]] = ++depth;
+            levelCount = std::max(levelCount, (size_t)depths[slot] + 1);
+        }
+
+        levelStarts.assign(levelCount + 1, 0);
+        for (uint32_t slot = 0; slot < handles.size(); slot++) {
+            if (handles[slot] != INVALID)
+                levelStarts[depths[slot] + 1]++;
+        }
+        for (size_t level = 1; level <= levelCount; level++)
+            levelStarts[level] += levelStarts[level - 1];
+
+        std::vector<uint32_t> order(levelStarts.back());
+        std::vector<uint32_t> newSlot(handles.size(), 0);
+        std::vector<size_t> next(levelStarts.begin(), levelStarts.end() - 1);
+        for (uint32_t slot = 0; slot < handles.size(); slot++) {
+            if (handles[slot] == INVALID)
+                continue;
+            newSlot[slot] = (uint32_t)next[depths[slot]]++;
+            order[newSlot[slot]] = slot;
+        }
+
+        for (uint32_t& parent : parents) {
+            if (parent != INVALID)
+                parent = newSlot[parent];
+        }
+        permute(handles, order);
+        permute(parents, order);
+        permute(positions, order);
+        permute(rotations, order);
+        permute(scales, order);
+        permute(locals, order);
+        permute(worlds, order);
+        permute(localDirty, order);
+        permute(changed, order);
+        for (uint32_t slot = 0; slot < handles.size(); slot++)
+            slotOf[handles[slot]] = slot;
+    }
+
+    template <typename T>
+    static void permute(std::vector<T>& values, const std::vector<uint32_t>& order) {
+        std::vector<T> sorted(order.size());
+        for (size_t i = 0; i < order.size(); i++)
+            sorted[i] = values[order[i]];
+        values.swap(sorted);
+    }
+
+    //per handle
+    std::vector<uint32_t> slotOf;
+    std::vector<uint32_t> freeHandles;
+
+    //per slot, sorted by depth
+    std::vector<uint32_t> handles;
+    std::vector<uint32_t> parents;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::quat> rotations;
+    std::vector<glm::vec3> scales;
+    std::vector<glm::mat4> locals;
+    std::vector<glm::mat4> worlds;
+    std::vector<uint8_t> localDirty;
+    std::vector<uint8_t> changed;
+
+    //first slot of each depth, plus one past the end
+    std::vector<size_t> levelStarts;
+    bool reorderNeeded = false;
+    size_t changedCount = 0;
+};